@@ -85,8 +85,18 @@ REQUEST_STATS=3
 STATS=4
 ISREADY=5
 SHUTDOWN=6
-
-messages = (WORK, RESPONSE, NEW_WORKER, REQUEST_STATS, STATS, ISREADY, SHUTDOWN)
+ENCODING=7
+TRANSPORT=8
+CANCEL=9
+TRACE=10
+METRICS=11
+
+messages = (WORK, RESPONSE, NEW_WORKER, REQUEST_STATS, STATS, ISREADY, SHUTDOWN,
+            ENCODING, TRANSPORT, CANCEL, TRACE, METRICS)
+
+# Tags carried by ENCODING messages. Clients that never negotiate get text.
+ENCODING_TEXT=0
+ENCODING_BINARY=1
 
 class TaggedMessage(CStruct):
   struct = struct.Struct("ii")
@@ -0,0 +1,41 @@
+#!/usr/bin/env python2.7
+
+import argparse
+import comm
+import socket
+import string
+import sys
+import time
+
+def positive_float(value):
+  fvalue = float(value)
+  if fvalue <= 0:
+      raise argparse.ArgumentTypeError("%s is not a positive value" % value)
+  return fvalue
+
+def hostport(value):
+  host, sport = string.split(value, ":", 1)
+  return (host, int(sport))
+
+parser = argparse.ArgumentParser(
+    description="Print a running master's latency and load metrics")
+parser.add_argument("--interval",
+    help="Keep printing them every INTERVAL seconds",
+    type=positive_float)
+parser.add_argument("address",
+    help="Address of master",
+    type=hostport)
+
+args = parser.parse_args()
+
+sock = socket.create_connection(args.address)
+while True:
+  comm.TaggedMessage(comm.METRICS, 0).to_socket(sock)
+  comm.TaggedMessage.from_socket(sock)
+  sys.stdout.write(comm.recv_string(sock))
+  sys.stdout.flush()
+
+  if args.interval is None:
+    break
+  time.sleep(args.interval)
+  print
@@ -0,0 +1,36 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef BENCH_BENCH_H_
+#define BENCH_BENCH_H_
+
+#include <string>
+#include <vector>
+
+// Every benchmark reports through these, so that all results come out
+// in one format: a table for people (--format=table) or one JSON object
+// per line for scripts comparing runs (--format=json). A result is the
+// median, mean and standard deviation of --repetitions samples, each
+// taken after --warmup untimed runs.
+
+// Called once by main() before any benchmark runs.
+void bench_begin();
+
+// Times 'run(arg)', and reports milliseconds per call. 'params' tells
+// apart the results of one benchmark, e.g. "n=850060".
+void bench_time(const char* benchmark, const std::string& params,
+                void (*run)(void*), void* arg);
+
+// As bench_time(), but each call of 'run' performs 'ops' operations,
+// and the result is nanoseconds per operation.
+void bench_time_ops(const char* benchmark, const std::string& params,
+                    void (*run)(void*), void* arg, long long ops);
+
+// Reports samples the benchmark measured itself, in 'unit'. Any warmup
+// is up to the caller.
+void bench_report(const char* benchmark, const std::string& params,
+                  const char* unit, const std::vector<double>& samples);
+
+// How many samples to take (--repetitions).
+int bench_repetitions();
+
+#endif  // BENCH_BENCH_H_
@@ -0,0 +1,70 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <gflags/gflags.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "bench/bench.h"
+#include "server/messages.h"
+#include "server/worker.h"
+
+extern void init_work_engine(bool forceFileIO, const std::string& assetsDir);
+
+DECLARE_int32(cache_mb);
+
+// worker/stats.cpp reports a worker's thread counts. Here every kernel
+// runs on the benchmark's own thread.
+DEFINE_int32(cpu_threads, 1, "Unused by the benchmarks");
+DEFINE_int32(memory_threads, 1, "Unused by the benchmarks");
+DEFINE_int32(io_threads, 1, "Unused by the benchmarks");
+DEFINE_string(assets_dir, "/afs/cs/academic/class/15418-s13/public/data",
+              "Assets directory holding the mostviewed pageview files");
+
+// Requests shaped like the ones in tests/*.txt, from the smallest to
+// the largest of each command.
+static const char* KERNEL_REQUESTS[] = {
+  "cmd=418wisdom;x=4222",
+  "cmd=countprimes;n=99999",
+  "cmd=countprimes;n=450090",
+  "cmd=countprimes;n=850060",
+  "cmd=minicompute;x=12345",
+  "cmd=highmem;x=1",
+  "cmd=mostviewed;start=2013-02-01;end=2013-02-14",
+  "cmd=mostviewed;start=2013-01-08;end=2013-03-24",
+};
+
+static const int NUM_KERNEL_REQUESTS =
+  sizeof(KERNEL_REQUESTS) / sizeof(KERNEL_REQUESTS[0]);
+
+static void run_request(void* arg) {
+  const Request_msg* req = reinterpret_cast<const Request_msg*>(arg);
+  Response_msg resp(req->get_tag());
+  execute_work(*req, resp);
+}
+
+// Each request goes through execute_work(), as on a worker, but with
+// the result cache off so every sample does the full computation.
+void bench_kernels() {
+  FLAGS_cache_mb = 0;
+  init_work_engine(false, FLAGS_assets_dir);
+
+  for (int i = 0; i < NUM_KERNEL_REQUESTS; i++) {
+    Request_msg req(0, KERNEL_REQUESTS[i]);
+    std::string cmd = req.get_arg("cmd");
+
+    if (cmd == "mostviewed") {
+      Response_msg probe(0);
+      execute_work(req, probe);
+      if (probe.get_response().find("Could not open") == 0) {
+        fprintf(stderr, "# kernels: skipping mostviewed, no pageviews in %s\n",
+                FLAGS_assets_dir.c_str());
+        continue;
+      }
+    }
+
+    // The request string without its cmd names the input size.
+    std::string params = KERNEL_REQUESTS[i] + cmd.size() + 5;
+    bench_time(cmd.c_str(), params.empty() ? "-" : params, run_request, &req);
+  }
+}
@@ -0,0 +1,67 @@
+// Copyright 2013 15418 Course Staff
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "bench/bench.h"
+
+void bench_work_queue();
+void bench_messages();
+void bench_kernels();
+
+typedef struct {
+  const char* name;
+  void (*run)();
+} benchmark_t;
+
+static const benchmark_t benchmarks[] = {
+  { "work_queue", bench_work_queue },
+  { "messages", bench_messages },
+  { "kernels", bench_kernels },
+};
+
+static const int NUM_BENCHMARKS = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+int main(int argc, char** argv) {
+
+  std::string usage("Usage: " + std::string(argv[0]) +
+                    " [options] [benchmark...]\n");
+  usage += "  Runs the named benchmarks, or all of them:";
+  for (int i = 0; i < NUM_BENCHMARKS; i++) {
+    usage += std::string(" ") + benchmarks[i].name;
+  }
+  google::SetUsageMessage(usage);
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  for (int j = 1; j < argc; j++) {
+    bool found = false;
+    for (int i = 0; i < NUM_BENCHMARKS; i++) {
+      if (strcmp(argv[j], benchmarks[i].name) == 0)
+        found = true;
+    }
+    if (!found) {
+      fprintf(stderr, "Unknown benchmark %s\n%s\n", argv[j],
+              google::ProgramUsage());
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  bench_begin();
+  for (int i = 0; i < NUM_BENCHMARKS; i++) {
+    bool selected = (argc < 2);
+    for (int j = 1; j < argc; j++) {
+      if (strcmp(argv[j], benchmarks[i].name) == 0)
+        selected = true;
+    }
+    if (selected)
+      benchmarks[i].run();
+  }
+
+  return 0;
+}
@@ -0,0 +1,132 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <string>
+
+#include "bench/bench.h"
+#include "server/messages.h"
+#include "types/types.h"
+#include "types/wire.h"
+
+DEFINE_int32(msg_ops, 1 << 18, "Operations per sample of the message benchmarks");
+
+// Requests as clients send them, one per command class.
+static const char* MESSAGE_REQUESTS[] = {
+  "cmd=countprimes;n=850060",
+  "cmd=418wisdom;x=4222",
+  "cmd=mostviewed;start=2013-01-08;end=2013-03-24",
+};
+
+static const int NUM_MESSAGE_REQUESTS =
+  sizeof(MESSAGE_REQUESTS) / sizeof(MESSAGE_REQUESTS[0]);
+
+typedef struct {
+  std::string text;
+  Request_msg* req;
+  encoding_t encoding;
+  work_t work;
+} message_run_t;
+
+// Keeps results alive so the compiler cannot drop the work.
+static volatile size_t sink;
+
+static void run_parse(void* arg) {
+  message_run_t* run = reinterpret_cast<message_run_t*>(arg);
+  size_t n = 0;
+  for (int i = 0; i < FLAGS_msg_ops; i++) {
+    Request_msg req(i, run->text);
+    n += req.get_tag();
+  }
+  sink = n;
+}
+
+static void run_get_arg(void* arg) {
+  message_run_t* run = reinterpret_cast<message_run_t*>(arg);
+  static const std::string cmd("cmd");
+  size_t n = 0;
+  for (int i = 0; i < FLAGS_msg_ops; i++) {
+    n += run->req->get_arg(cmd).size();
+  }
+  sink = n;
+}
+
+static void run_serialize(void* arg) {
+  message_run_t* run = reinterpret_cast<message_run_t*>(arg);
+  size_t n = 0;
+  for (int i = 0; i < FLAGS_msg_ops; i++) {
+    n += run->req->get_request_string().size();
+  }
+  sink = n;
+}
+
+static void run_encode(void* arg) {
+  message_run_t* run = reinterpret_cast<message_run_t*>(arg);
+  size_t n = 0;
+  for (int i = 0; i < FLAGS_msg_ops; i++) {
+    work_t work;
+    encode_request(*run->req, run->encoding, &work);
+    n += work.buf_len;
+  }
+  sink = n;
+}
+
+static void run_decode(void* arg) {
+  message_run_t* run = reinterpret_cast<message_run_t*>(arg);
+  size_t n = 0;
+  for (int i = 0; i < FLAGS_msg_ops; i++) {
+    Request_msg req(i);
+    CHECK(decode_request(run->work, run->encoding, &req));
+    n += req.get_tag();
+  }
+  sink = n;
+}
+
+static void run_response(void* arg) {
+  message_run_t* run = reinterpret_cast<message_run_t*>(arg);
+  size_t n = 0;
+  for (int i = 0; i < FLAGS_msg_ops; i++) {
+    resp_t resp;
+    encode_response("82025", run->encoding, &resp);
+    Response_msg msg(i);
+    CHECK(decode_response(resp, run->encoding, &msg));
+    n += msg.get_tag();
+  }
+  sink = n;
+}
+
+static const char* encoding_name(encoding_t encoding) {
+  return encoding == ENCODING_BINARY ? "binary" : "text";
+}
+
+// Request_msg parsing, lookup and serialization, and the wire encodings
+// of requests and responses, each timed per operation.
+void bench_messages() {
+  for (int i = 0; i < NUM_MESSAGE_REQUESTS; i++) {
+    message_run_t run;
+    run.text = MESSAGE_REQUESTS[i];
+    run.req = new Request_msg(0, run.text);
+    std::string cmd = run.req->get_arg("cmd");
+
+    bench_time_ops("request_parse", cmd, run_parse, &run, FLAGS_msg_ops);
+    bench_time_ops("request_getarg", cmd, run_get_arg, &run, FLAGS_msg_ops);
+    bench_time_ops("request_string", cmd, run_serialize, &run, FLAGS_msg_ops);
+
+    for (int e = ENCODING_TEXT; e <= ENCODING_BINARY; e++) {
+      run.encoding = static_cast<encoding_t>(e);
+      encode_request(*run.req, run.encoding, &run.work);
+      std::string params = cmd + "," + encoding_name(run.encoding);
+      bench_time_ops("wire_encode", params, run_encode, &run, FLAGS_msg_ops);
+      bench_time_ops("wire_decode", params, run_decode, &run, FLAGS_msg_ops);
+    }
+    delete run.req;
+  }
+
+  for (int e = ENCODING_TEXT; e <= ENCODING_BINARY; e++) {
+    message_run_t run;
+    run.encoding = static_cast<encoding_t>(e);
+    bench_time_ops("wire_response", encoding_name(run.encoding), run_response,
+                   &run, FLAGS_msg_ops);
+  }
+}
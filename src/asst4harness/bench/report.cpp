@@ -0,0 +1,103 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "bench/bench.h"
+#include "tools/cycle_timer.h"
+
+DEFINE_int32(warmup, 1, "Untimed runs before each benchmark's samples");
+DEFINE_int32(repetitions, 5, "Timed samples per benchmark");
+DEFINE_string(format, "table", "Output format: 'table' or 'json'");
+
+static bool json_output() {
+  return FLAGS_format == "json";
+}
+
+void bench_begin() {
+  CHECK(FLAGS_format == "table" || FLAGS_format == "json")
+    << "Unknown --format " << FLAGS_format;
+  CHECK_GT(FLAGS_repetitions, 0) << "--repetitions must be positive";
+  CHECK_GE(FLAGS_warmup, 0) << "--warmup must not be negative";
+
+  if (!json_output()) {
+    printf("%-14s %-28s %-10s %12s %12s %8s %12s %12s %5s\n", "benchmark",
+           "params", "unit", "median", "mean", "stddev%", "min", "max", "n");
+  }
+}
+
+int bench_repetitions() {
+  return FLAGS_repetitions;
+}
+
+void bench_report(const char* benchmark, const std::string& params,
+                  const char* unit, const std::vector<double>& samples) {
+  CHECK(!samples.empty());
+  std::vector<double> sorted(samples);
+  std::sort(sorted.begin(), sorted.end());
+
+  size_t n = sorted.size();
+  double median = (n % 2) ? sorted[n / 2] :
+    (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+  double mean = 0;
+  for (size_t i = 0; i < n; i++) {
+    mean += sorted[i];
+  }
+  mean /= n;
+  double variance = 0;
+  for (size_t i = 0; i < n; i++) {
+    variance += (sorted[i] - mean) * (sorted[i] - mean);
+  }
+  variance = n > 1 ? variance / (n - 1) : 0;
+
+  if (json_output()) {
+    printf("{\"benchmark\": \"%s\", \"params\": \"%s\", \"unit\": \"%s\", "
+           "\"median\": %.6g, \"mean\": %.6g, \"variance\": %.6g, "
+           "\"min\": %.6g, \"max\": %.6g, \"samples\": %d}\n",
+           benchmark, params.c_str(), unit, median, mean, variance,
+           sorted.front(), sorted.back(), static_cast<int>(n));
+  } else {
+    printf("%-14s %-28s %-10s %12.4g %12.4g %7.2f%% %12.4g %12.4g %5d\n",
+           benchmark, params.c_str(), unit, median, mean,
+           mean != 0 ? 100 * sqrt(variance) / mean : 0, sorted.front(),
+           sorted.back(), static_cast<int>(n));
+  }
+  fflush(stdout);
+}
+
+static std::vector<double> take_samples(void (*run)(void*), void* arg) {
+  for (int i = 0; i < FLAGS_warmup; i++) {
+    run(arg);
+  }
+  std::vector<double> samples(FLAGS_repetitions);
+  for (int i = 0; i < FLAGS_repetitions; i++) {
+    double start = CycleTimer::currentSeconds();
+    run(arg);
+    samples[i] = CycleTimer::currentSeconds() - start;
+  }
+  return samples;
+}
+
+void bench_time(const char* benchmark, const std::string& params,
+                void (*run)(void*), void* arg) {
+  std::vector<double> samples = take_samples(run, arg);
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i] *= 1e3;
+  }
+  bench_report(benchmark, params, "ms", samples);
+}
+
+void bench_time_ops(const char* benchmark, const std::string& params,
+                    void (*run)(void*), void* arg, long long ops) {
+  std::vector<double> samples = take_samples(run, arg);
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i] *= 1e9 / ops;
+  }
+  bench_report(benchmark, params, "ns/op", samples);
+}
@@ -0,0 +1,170 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <gflags/gflags.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "bench/bench.h"
+#include "tools/cycle_timer.h"
+#include "tools/work_queue.h"
+
+DEFINE_int32(wq_max_threads, 64,
+             "Largest number of producers (and of consumers) to try");
+DEFINE_int32(wq_items, 1 << 20, "Items pushed through the queue per run");
+DEFINE_int32(wq_batch, 16, "Batch size for the batched run");
+
+// The mutex/condvar queue that WorkQueue replaced, kept as a baseline.
+// It stores items in a std::deque rather than the original vector, whose
+// erase from the front made a run quadratic once the producer got ahead.
+template <class T>
+class LockedWorkQueue {
+private:
+  std::deque<T> storage;
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_cond;
+
+public:
+
+  LockedWorkQueue() {
+    pthread_cond_init(&queue_cond, NULL);
+    pthread_mutex_init(&queue_lock, NULL);
+  }
+
+  T get_work() {
+    pthread_mutex_lock(&queue_lock);
+    while (storage.size() == 0) {
+      pthread_cond_wait(&queue_cond, &queue_lock);
+    }
+
+    T item = storage.front();
+    storage.pop_front();
+
+    pthread_mutex_unlock(&queue_lock);
+    return item;
+  }
+
+  void put_work(const T& item) {
+    pthread_mutex_lock(&queue_lock);
+    storage.push_back(item);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_cond_signal(&queue_cond);
+  }
+};
+
+template <class Queue>
+struct QueueRun {
+  Queue* queue;
+  int items_per_thread;
+  int batch;
+  long long sum;  // consumers' checksum, so no work can be elided
+};
+
+template <class Queue>
+static void* produce(void* arg) {
+  QueueRun<Queue>* run = reinterpret_cast<QueueRun<Queue>*>(arg);
+  for (int i = 0; i < run->items_per_thread; i++) {
+    run->queue->put_work(i);
+  }
+  return NULL;
+}
+
+template <class Queue>
+static void* consume(void* arg) {
+  QueueRun<Queue>* run = reinterpret_cast<QueueRun<Queue>*>(arg);
+  long long sum = 0;
+  for (int i = 0; i < run->items_per_thread; i++) {
+    sum += run->queue->get_work();
+  }
+  __sync_fetch_and_add(&run->sum, sum);
+  return NULL;
+}
+
+static void* produce_batched(void* arg) {
+  QueueRun<WorkQueue<int> >* run =
+    reinterpret_cast<QueueRun<WorkQueue<int> >*>(arg);
+  std::vector<int> items(run->batch);
+  for (int i = 0; i < run->items_per_thread; i += run->batch) {
+    int n = std::min(run->batch, run->items_per_thread - i);
+    for (int j = 0; j < n; j++) {
+      items[j] = i + j;
+    }
+    run->queue->put_work(items.begin(), items.begin() + n);
+  }
+  return NULL;
+}
+
+static void* consume_batched(void* arg) {
+  QueueRun<WorkQueue<int> >* run =
+    reinterpret_cast<QueueRun<WorkQueue<int> >*>(arg);
+  std::vector<int> items(run->batch);
+  long long sum = 0;
+  for (int left = run->items_per_thread; left > 0; ) {
+    int n = run->queue->get_work(&items[0], std::min(run->batch, left));
+    for (int j = 0; j < n; j++) {
+      sum += items[j];
+    }
+    left -= n;
+  }
+  __sync_fetch_and_add(&run->sum, sum);
+  return NULL;
+}
+
+// Runs 'threads' producers against as many consumers and returns the
+// throughput in millions of items per second.
+template <class Queue>
+static double run_queue(int threads, void* (*producer)(void*),
+                        void* (*consumer)(void*), int batch) {
+  Queue queue;
+  QueueRun<Queue> run;
+  run.queue = &queue;
+  run.items_per_thread = FLAGS_wq_items / threads;
+  run.batch = batch;
+  run.sum = 0;
+
+  std::vector<pthread_t> tids(2 * threads);
+  double start = CycleTimer::currentSeconds();
+  for (int i = 0; i < threads; i++) {
+    pthread_create(&tids[2 * i], NULL, consumer, &run);
+    pthread_create(&tids[2 * i + 1], NULL, producer, &run);
+  }
+  for (size_t i = 0; i < tids.size(); i++) {
+    pthread_join(tids[i], NULL);
+  }
+  double elapsed = CycleTimer::currentSeconds() - start;
+
+  long long n = run.items_per_thread;
+  if (run.sum != threads * (n * (n - 1) / 2)) {
+    fprintf(stderr, "work_queue: lost items with %d threads\n", threads);
+  }
+  return threads * n / elapsed / 1e6;
+}
+
+template <class Queue>
+static void report_queue(const char* kind, int threads,
+                         void* (*producer)(void*), void* (*consumer)(void*),
+                         int batch) {
+  std::vector<double> samples(bench_repetitions());
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i] = run_queue<Queue>(threads, producer, consumer, batch);
+  }
+  char params[64];
+  snprintf(params, sizeof(params), "%s,threads=%d", kind, threads);
+  bench_report("work_queue", params, "Mitems/s", samples);
+}
+
+void bench_work_queue() {
+  for (int threads = 1; threads <= FLAGS_wq_max_threads; threads *= 2) {
+    report_queue<LockedWorkQueue<int> >(
+      "locked", threads, produce<LockedWorkQueue<int> >,
+      consume<LockedWorkQueue<int> >, 1);
+    report_queue<WorkQueue<int> >(
+      "lockfree", threads, produce<WorkQueue<int> >,
+      consume<WorkQueue<int> >, 1);
+    report_queue<WorkQueue<int> >(
+      "batched", threads, produce_batched, consume_batched, FLAGS_wq_batch);
+  }
+}
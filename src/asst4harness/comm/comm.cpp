@@ -1,14 +1,21 @@
 // Copyright 2013 15418 Course Staff.
 
 #include <assert.h>
-#include <boost/make_shared.hpp>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include "comm/comm.h"
+#include "comm/transport.h"
 
 static int send_all(int fd, const void* buf, size_t len) {
+  if (is_shm_transport(fd)) {
+    return shm_send_all(fd, buf, len);
+  }
+
   const char* cbuf = reinterpret_cast<const char*>(buf);
   size_t sent = 0;
   do {
@@ -25,6 +32,10 @@ static int send_all(int fd, const void* buf, size_t len) {
 }
 
 static int recv_all(int fd, void* buf, size_t len) {
+  if (is_shm_transport(fd)) {
+    return shm_recv_all(fd, buf, len);
+  }
+
   char* cbuf = reinterpret_cast<char*>(buf);
   size_t received = 0;
   do {
@@ -40,6 +51,61 @@ static int recv_all(int fd, void* buf, size_t len) {
   return 0;
 }
 
+// Sends all of 'iov' with as few syscalls as the socket allows, so a
+// header, length and body go out together instead of one send apiece.
+static int send_iov(int fd, struct iovec* iov, int iovcnt) {
+  if (is_shm_transport(fd)) {
+    for (int i = 0; i < iovcnt; i++) {
+      if (shm_send_all(fd, iov[i].iov_base, iov[i].iov_len) < 0) return -1;
+    }
+    return 0;
+  }
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+
+  while (msg.msg_iovlen > 0) {
+    ssize_t ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    } else if (ret <= 0) {
+      return -1;
+    }
+
+    size_t sent = ret;
+    while (msg.msg_iovlen > 0 && sent >= msg.msg_iov->iov_len) {
+      sent -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + sent;
+      msg.msg_iov->iov_len -= sent;
+    }
+  }
+
+  return 0;
+}
+
+// Sends a tagged message followed by a length-prefixed body.
+static int send_with_body(int fd, message_t message, int tag,
+                          const int* buf_len, const frame_ptr& buf) {
+  tagged_message_t header;
+  header.message = message;
+  header.tag = tag;
+
+  struct iovec iov[3];
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = const_cast<int*>(buf_len);
+  iov[1].iov_len = sizeof(*buf_len);
+  iov[2].iov_base = buf->data();
+  iov[2].iov_len = *buf_len;
+  return send_iov(fd, iov, 3);
+}
+
 int send_message(int fd, const message_t message, const int tag) {
   tagged_message_t to_send;
 
@@ -65,41 +131,83 @@ int recv_message(int fd, message_t* message, int* tag) {
 int recv_work(int fd, work_t* work) {
   int err = recv_all(fd, &work->buf_len, sizeof(work->buf_len));
   if (err == 0) {
-    work->buf = boost::make_shared<char[]>(work->buf_len);
-    err = recv_all(fd, work->buf.get(), work->buf_len);
+    work->buf = alloc_frame(work->buf_len);
+    err = recv_all(fd, work->buf->data(), work->buf_len);
   }
   return err;
 }
 
 int send_work(int fd, const work_t& work, int tag) {
-  int err = send_message(fd, WORK, tag);
-  if (err == 0) {
-    err = send_all(fd, &work.buf_len, sizeof(work.buf_len));
-    if (err == 0) {
-      err = send_all(fd, work.buf.get(), work.buf_len);
-    }
-  }
-  return err;
+  return send_with_body(fd, WORK, tag, &work.buf_len, work.buf);
 }
 
 int recv_resp(int fd, resp_t* resp) {
   int err = recv_all(fd, &resp->buf_len, sizeof(resp->buf_len));
   if (err == 0) {
-    resp->buf = boost::make_shared<char[]>(resp->buf_len);
-    err = recv_all(fd, resp->buf.get(), resp->buf_len);
+    resp->buf = alloc_frame(resp->buf_len);
+    err = recv_all(fd, resp->buf->data(), resp->buf_len);
   }
   return err;
 }
 
 int send_resp(int fd, const resp_t& resp, int tag) {
-  int err = send_message(fd, RESPONSE, tag);
-  if (err == 0) {
-    err = send_all(fd, &resp.buf_len, sizeof(resp.buf_len));
-    if (err == 0) {
-      err = send_all(fd, resp.buf.get(), resp.buf_len);
+  return send_with_body(fd, RESPONSE, tag, &resp.buf_len, resp.buf);
+}
+
+void gather_resps(const tagged_resp_t* resps, int n,
+                  const trace_hops_t* traces, resps_iov_t* out) {
+  tagged_message_t* headers = out->headers;
+  tagged_message_t* trace_headers = out->trace_headers;
+  struct iovec* iov = out->iov;
+  assert(n <= MAX_RESPS_PER_SEND);
+
+  int iovcnt = 0;
+  for (int i = 0; i < n; i++) {
+    // The trace goes first, so the master has it when the response is
+    // handed on to the client.
+    if (traces != NULL) {
+      trace_headers[i].message = TRACE;
+      trace_headers[i].tag = resps[i].tag;
+      iov[iovcnt].iov_base = &trace_headers[i];
+      iov[iovcnt++].iov_len = sizeof(trace_headers[i]);
+      iov[iovcnt].iov_base = const_cast<trace_hops_t*>(&traces[i]);
+      iov[iovcnt++].iov_len = sizeof(traces[i]);
     }
+
+    headers[i].message = RESPONSE;
+    headers[i].tag = resps[i].tag;
+    iov[iovcnt].iov_base = &headers[i];
+    iov[iovcnt++].iov_len = sizeof(headers[i]);
+    iov[iovcnt].iov_base = const_cast<int*>(&resps[i].resp.buf_len);
+    iov[iovcnt++].iov_len = sizeof(resps[i].resp.buf_len);
+    iov[iovcnt].iov_base = resps[i].resp.buf->data();
+    iov[iovcnt++].iov_len = resps[i].resp.buf_len;
   }
-  return err;
+  out->iovcnt = iovcnt;
+}
+
+int send_resps(int fd, const tagged_resp_t* resps, int n,
+               const trace_hops_t* traces) {
+  resps_iov_t gathered;
+  gather_resps(resps, n, traces, &gathered);
+  return send_iov(fd, gathered.iov, gathered.iovcnt);
+}
+
+int recv_trace(int fd, trace_hops_t* trace) {
+  return recv_all(fd, trace, sizeof(*trace));
+}
+
+int send_trace(int fd, const trace_hops_t& trace, int tag) {
+  tagged_message_t header;
+  header.message = TRACE;
+  header.tag = tag;
+
+  struct iovec iov[2];
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = const_cast<trace_hops_t*>(&trace);
+  iov[1].iov_len = sizeof(trace);
+  return send_iov(fd, iov, 2);
 }
 
 int recv_worker_stats(int fd, worker_stats_t* stats) {
@@ -110,6 +218,19 @@ int send_worker_stats(int fd, const worker_stats_t& stats) {
   return send_all(fd, &stats, sizeof(stats));
 }
 
+int send_worker_stats(int fd, const worker_stats_t& stats, int tag) {
+  tagged_message_t header;
+  header.message = STATS;
+  header.tag = tag;
+
+  struct iovec iov[2];
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = const_cast<worker_stats_t*>(&stats);
+  iov[1].iov_len = sizeof(stats);
+  return send_iov(fd, iov, 2);
+}
+
 int send_string(int fd, const std::string& s) {
   int len = s.length();
   assert(sizeof(len) == 4);
@@ -117,3 +238,138 @@ int send_string(int fd, const std::string& s) {
   if (err < 0) return err;
   return send_all(fd, s.c_str(), len);
 }
+
+MessageReader::MessageReader()
+  : chunk(NULL), chunk_len(0), header_have(0), in_body(false), body_have(0),
+    bad(false) {
+}
+
+void MessageReader::feed(const char* buf, size_t len) {
+  chunk = buf;
+  chunk_len = len;
+}
+
+// Points '*hdr' at the first 'want' bytes of the current header: into
+// the chunk when they are all there, else into 'header', topped up from
+// the chunk (which they are then consumed from).
+bool MessageReader::header_bytes(size_t want, const char** hdr) {
+  if (header_have == 0 && chunk_len >= want) {
+    *hdr = chunk;
+    return true;
+  }
+  if (header_have < want) {
+    size_t n = std::min(want - header_have, chunk_len);
+    memcpy(header + header_have, chunk, n);
+    header_have += n;
+    chunk += n;
+    chunk_len -= n;
+  }
+  *hdr = header;
+  return header_have >= want;
+}
+
+// Parses the next header and sets up the frame for its body.
+bool MessageReader::start_message() {
+  const char* hdr;
+  tagged_message_t h;
+  size_t header_len = sizeof(h);
+  if (!header_bytes(header_len, &hdr)) return false;
+  memcpy(&h, hdr, sizeof(h));
+
+  int body_len = 0;
+  bool has_body = true;
+  if (h.message == WORK || h.message == RESPONSE) {
+    header_len += sizeof(body_len);
+    if (!header_bytes(header_len, &hdr)) return false;
+    memcpy(&body_len, hdr + sizeof(h), sizeof(body_len));
+    if (body_len < 0 || body_len > MAX_MESSAGE_BODY) {
+      bad = true;
+      return false;
+    }
+  } else if (h.message == STATS) {
+    body_len = sizeof(worker_stats_t);
+  } else if (h.message == TRACE) {
+    body_len = sizeof(trace_hops_t);
+  } else {
+    has_body = false;
+  }
+
+  // A header read in place is still in the chunk; a staged one is not.
+  if (header_have == 0) {
+    chunk += header_len;
+    chunk_len -= header_len;
+  }
+  header_have = 0;
+
+  in_body = true;
+  message = h.message;
+  tag = h.tag;
+  partial.buf_len = body_len;
+  partial.buf = has_body ? alloc_frame(body_len) : frame_ptr();
+  body_have = 0;
+  return true;
+}
+
+bool MessageReader::next(message_t* message_out, int* tag_out, work_t* body) {
+  if (bad) return false;
+  if (!in_body && !start_message()) return false;
+
+  size_t n = std::min(static_cast<size_t>(partial.buf_len - body_have),
+                      chunk_len);
+  if (n > 0) {
+    memcpy(partial.buf->data() + body_have, chunk, n);
+    body_have += n;
+    chunk += n;
+    chunk_len -= n;
+  }
+  if (body_have < partial.buf_len) return false;
+
+  *message_out = message;
+  *tag_out = tag;
+  *body = partial;
+  partial.buf.reset();
+  in_body = false;
+  return true;
+}
+
+size_t MessageReader::body_space(char** dst) {
+  if (!in_body || body_have == partial.buf_len) return 0;
+  *dst = partial.buf->data() + body_have;
+  return partial.buf_len - body_have;
+}
+
+void MessageReader::body_received(size_t len) {
+  body_have += len;
+}
+
+int recv_message_stream(int fd, message_handler_t handler, void* arg) {
+  MessageReader reader;
+  char buf[MESSAGE_STREAM_CHUNK];
+  message_t message;
+  int tag;
+  work_t body;
+
+  for (;;) {
+    // The rest of a body of a chunk or more is received straight into
+    // its frame.
+    char* dst;
+    size_t space = reader.body_space(&dst);
+    bool direct = space >= sizeof(buf);
+    ssize_t ret = direct ? recv(fd, dst, space, 0) : recv(fd, buf, sizeof(buf), 0);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    } else if (ret <= 0) {
+      return -1;
+    }
+
+    if (direct) {
+      reader.body_received(ret);
+    } else {
+      reader.feed(buf, ret);
+    }
+    while (reader.next(&message, &tag, &body)) {
+      handler(message, tag, body, arg);
+    }
+    if (reader.malformed()) return -1;
+  }
+}
@@ -3,6 +3,9 @@
 #ifndef COMM_COMM_H_
 #define COMM_COMM_H_
 
+#include <stddef.h>
+#include <sys/uio.h>
+
 #include <string>
 
 #include "types/types.h"
@@ -15,11 +18,99 @@ int send_work(int fd, const work_t& work, int tag);
 
 int recv_worker_stats(int fd, worker_stats_t* stats);
 int send_worker_stats(int fd, const worker_stats_t& stats);
+int send_worker_stats(int fd, const worker_stats_t& stats, int tag);
+
+int recv_trace(int fd, trace_hops_t* trace);
+int send_trace(int fd, const trace_hops_t& trace, int tag);
 
 int recv_resp(int fd, resp_t* resp);
 int send_resp(int fd, const resp_t& resp);
 int send_resp(int fd, const resp_t& resp, int tag);
 
+typedef struct {
+  int tag;
+  resp_t resp;
+} tagged_resp_t;
+
+// Sends up to MAX_RESPS_PER_SEND responses with a single writev. If
+// 'traces' is not NULL, each response goes out right after a TRACE
+// carrying traces[i].
+#define MAX_RESPS_PER_SEND 64
+int send_resps(int fd, const tagged_resp_t* resps, int n,
+               const trace_hops_t* traces = NULL);
+
+// The gather list send_resps() writes, for senders that submit it some
+// other way. The iovecs point into the struct and into resps[].
+typedef struct {
+  tagged_message_t headers[MAX_RESPS_PER_SEND];
+  tagged_message_t trace_headers[MAX_RESPS_PER_SEND];
+  struct iovec iov[5 * MAX_RESPS_PER_SEND];
+  int iovcnt;
+} resps_iov_t;
+void gather_resps(const tagged_resp_t* resps, int n,
+                  const trace_hops_t* traces, resps_iov_t* out);
+
 int send_string(int fd, const std::string& args);
 
+// Reassembles tagged messages (and their bodies) from a byte stream read
+// in arbitrary chunks, so readers can take whatever the socket has rather
+// than issuing one recv per field. Headers are parsed straight out of
+// each chunk and a body is copied once, into its own frame; only a
+// header split between two chunks is staged on the side.
+class MessageReader {
+ public:
+  MessageReader();
+
+  // Makes 'buf' the chunk next() reads from. The previous chunk must
+  // have been drained, and 'buf' must stay valid until next() returns
+  // false.
+  void feed(const char* buf, size_t len);
+
+  // Pops the next complete message, if any. 'body' holds the payload of
+  // WORK, RESPONSE, STATS and TRACE messages and is empty otherwise.
+  // Returns false once the chunk is used up, keeping any partial
+  // message for the next one, or once the stream is malformed().
+  bool next(message_t* message, int* tag, work_t* body);
+
+  // Where the rest of a partly received body goes, so that a reader can
+  // receive it there directly and report it with body_received().
+  // Returns 0 when no body is in progress.
+  size_t body_space(char** dst);
+  void body_received(size_t len);
+
+  // Whether a message declared a body length out of range.
+  bool malformed() const { return bad; }
+
+ private:
+  bool header_bytes(size_t want, const char** hdr);
+  bool start_message();
+
+  const char* chunk;
+  size_t chunk_len;
+
+  char header[sizeof(tagged_message_t) + sizeof(int)];
+  size_t header_have;
+
+  // the message whose body is being filled in
+  bool in_body;
+  message_t message;
+  int tag;
+  work_t partial;
+  int body_have;
+
+  bool bad;
+};
+
+// Longest WORK or RESPONSE body accepted from the stream.
+#define MAX_MESSAGE_BODY (16 * 1024 * 1024)
+
+#define MESSAGE_STREAM_CHUNK (64 * 1024)
+
+typedef void (*message_handler_t)(message_t message, int tag,
+                                  const work_t& body, void* arg);
+
+// Reads messages from 'fd' until the connection closes, handing each to
+// 'handler'. Always returns -1.
+int recv_message_stream(int fd, message_handler_t handler, void* arg);
+
 #endif  // COMM_COMM_H_
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "./connect.h"
@@ -99,3 +101,86 @@ int listen_to(const char* hostport) {
   addr[127] = 0;
   return connect_common(addr, try_bind_listen, AI_PASSIVE);
 }
+
+// A host is local iff we can bind a socket to one of its addresses.
+bool is_local_address(const char* hostport) {
+  struct addrinfo *result;
+  struct addrinfo *res;
+  struct addrinfo hints;
+  char addr[128];
+  char* host;
+  char* port;
+  bool local = false;
+
+  strncpy(addr, hostport, 127);
+  addr[127] = 0;
+  parse_hostport(addr, &host, &port);
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  // Port 0 so the probe never collides with a real listener.
+  if (getaddrinfo(host, "0", &hints, &result) != 0) {
+    return false;
+  }
+
+  for (res = result; res != NULL && !local; res = res->ai_next) {
+    int sfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sfd == -1) continue;
+    local = (bind(sfd, res->ai_addr, res->ai_addrlen) == 0);
+    close(sfd);
+  }
+
+  freeaddrinfo(result);
+  return local;
+}
+
+void local_socket_path(const char* hostport, char* path, size_t path_len) {
+  const char* port = strrchr(hostport, ':');
+  snprintf(path, path_len, "%s/asst4-%s.sock", LOCAL_SOCKET_DIR,
+           port != NULL ? port + 1 : hostport);
+}
+
+static int local_common(const char* path, bool listening) {
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);  // NOLINT
+
+  int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sfd == -1) {
+    return -1;
+  }
+
+  int ret;
+  if (listening) {
+    // A previous master may have left its socket file behind.
+    unlink(path);
+    ret = bind(sfd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    if (ret == 0) {
+      ret = listen(sfd, MAX_BACKLOG);
+    }
+  } else {
+    ret = connect(sfd, reinterpret_cast<struct sockaddr*>(&addr),
+                  sizeof(addr));
+  }
+
+  if (ret < 0) {
+    close(sfd);
+    return -1;
+  }
+  return sfd;
+}
+
+int connect_to_local(const char* path) {
+  return local_common(path, false);
+}
+
+int listen_to_local(const char* path) {
+  return local_common(path, true);
+}
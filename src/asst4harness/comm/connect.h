@@ -3,9 +3,19 @@
 #ifndef COMM_CONNECT_H
 #define COMM_CONNECT_H
 
+#include <stddef.h>
+
 #define MAX_BACKLOG 128
+#define LOCAL_SOCKET_DIR "/tmp"
 
 int connect_to(const char* hostport);
 int listen_to(const char* hostport);
 
+// Co-located peers can skip TCP: a master listening on host:port also
+// listens on the Unix-domain socket named by local_socket_path().
+bool is_local_address(const char* hostport);
+void local_socket_path(const char* hostport, char* path, size_t path_len);
+int connect_to_local(const char* path);
+int listen_to_local(const char* path);
+
 #endif // COMM_CONNECT_H
@@ -0,0 +1,72 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <errno.h>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "comm/inproc.h"
+#include "tools/work_queue.h"
+
+// Deep enough that the master never waits on a busy node's queue.
+#define INPROC_QUEUE_CAPACITY (64 * 1024)
+
+static WorkQueue<inproc_message_t>* to_node = NULL;
+static WorkQueue<inproc_message_t>* to_master = NULL;
+static int wakeup_fd = -1;
+
+// Set while the master has found its queue empty, as it has before it
+// first looks; whoever clears it owes the master a wakeup.
+static int master_waiting = 1;
+
+void inproc_channel_open() {
+  CHECK(to_node == NULL) << "In-process channel opened twice";
+  to_node = new WorkQueue<inproc_message_t>(INPROC_QUEUE_CAPACITY);
+  to_master = new WorkQueue<inproc_message_t>(INPROC_QUEUE_CAPACITY);
+  wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  PCHECK(wakeup_fd >= 0) << "Could not create in-process wakeup fd";
+}
+
+bool inproc_channel_active() {
+  return to_node != NULL;
+}
+
+void inproc_send_to_node(const inproc_message_t& message) {
+  to_node->put_work(message);
+}
+
+inproc_message_t inproc_node_receive() {
+  return to_node->get_work();
+}
+
+void inproc_send_to_master(const inproc_message_t& message) {
+  to_master->put_work(message);
+  if (__atomic_exchange_n(&master_waiting, 0, __ATOMIC_SEQ_CST)) {
+    uint64_t one = 1;
+    while (write(wakeup_fd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+  }
+}
+
+int inproc_wakeup_fd() {
+  return wakeup_fd;
+}
+
+bool inproc_master_receive(inproc_message_t* message) {
+  if (to_master->try_get_work(message))
+    return true;
+
+  // Clear any stale wakeup, announce that we are going to sleep, and
+  // look once more in case a message slipped in before the node could
+  // see the announcement.
+  uint64_t count;
+  while (read(wakeup_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+  }
+  __atomic_store_n(&master_waiting, 1, __ATOMIC_SEQ_CST);
+  if (to_master->try_get_work(message)) {
+    __atomic_store_n(&master_waiting, 0, __ATOMIC_SEQ_CST);
+    return true;
+  }
+  return false;
+}
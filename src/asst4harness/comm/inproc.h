@@ -0,0 +1,52 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef COMM_INPROC_H_
+#define COMM_INPROC_H_
+
+#include <string>
+
+#include "server/messages.h"
+#include "types/types.h"
+
+// In-memory channel between the master's event loop and a worker node
+// running in the same process (the server program), standing in for
+// the worker's connection. Messages are the ones the wire protocol
+// would carry, already decoded, so nothing is encoded, copied into a
+// socket or parsed again.
+//
+// The node reads its queue with a blocking get. The master's queue is
+// drained from the event loop, which watches wakeup_fd(); the node only
+// signals it when the master has said it found the queue empty, so a
+// busy master costs the node no system calls.
+
+typedef struct {
+  message_t message;
+  int tag;
+  Request_msg* req;      // WORK, and NEW_WORKER's parameters; the reader deletes it
+  std::string response;  // RESPONSE
+  worker_stats_t stats;  // STATS
+  trace_hops_t trace;    // TRACE
+} inproc_message_t;
+
+// Creates the channel. Called once, by the server program, before the
+// master starts.
+void inproc_channel_open();
+
+// Whether this process has a channel, i.e. its worker node is in-process.
+bool inproc_channel_active();
+
+// Master to node.
+void inproc_send_to_node(const inproc_message_t& message);
+inproc_message_t inproc_node_receive();
+
+// Node to master.
+void inproc_send_to_master(const inproc_message_t& message);
+
+// Readable when the master should call inproc_master_receive().
+int inproc_wakeup_fd();
+
+// Takes the next message for the master, if any. When there is none,
+// the node will signal wakeup_fd() once there is.
+bool inproc_master_receive(inproc_message_t* message);
+
+#endif  // COMM_INPROC_H_
@@ -0,0 +1,293 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "comm/transport.h"
+
+#define SHM_RING_SIZE (1 << 20)
+#define MAX_SHM_FDS 4096
+#define CACHE_LINE 64
+
+// head and tail run freely and wrap mod 2^32; the ring size divides that.
+typedef struct {
+  volatile uint32_t head;
+  char pad0[CACHE_LINE - sizeof(uint32_t)];
+  volatile uint32_t tail;
+  char pad1[CACHE_LINE - sizeof(uint32_t)];
+  volatile int reader_waiting;
+  char pad2[CACHE_LINE - sizeof(int)];
+  char data[SHM_RING_SIZE];
+} shm_ring_t;
+
+// Ring 0 carries master->worker traffic, ring 1 worker->master.
+typedef struct {
+  shm_ring_t rings[2];
+} shm_channel_t;
+
+typedef struct {
+  shm_channel_t* channel;
+  shm_ring_t* tx;
+  shm_ring_t* rx;
+  int tx_efd;
+  int sock;
+} shm_transport_t;
+
+// Indexed by receive eventfd.
+static shm_transport_t* transports[MAX_SHM_FDS];
+
+static shm_transport_t* find_transport(int fd) {
+  if (fd < 0 || fd >= MAX_SHM_FDS) return NULL;
+  return transports[fd];
+}
+
+static void signal_efd(int efd) {
+  uint64_t one = 1;
+  ssize_t ret;
+  do {
+    ret = write(efd, &one, sizeof(one));
+  } while (ret == -1 && errno == EINTR);
+}
+
+static void drain_efd(int efd) {
+  uint64_t count;
+  while (read(efd, &count, sizeof(count)) == -1 && errno == EINTR) {}
+}
+
+// Any activity on the socket after the switch means the peer went away.
+static bool peer_gone(int sock, int timeout_ms) {
+  struct pollfd pfd;
+  pfd.fd = sock;
+  pfd.events = POLLIN | POLLRDHUP;
+  pfd.revents = 0;
+  return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+int shm_channel_create(int fds[SHM_CHANNEL_FDS]) {
+  fds[0] = memfd_create("asst4-shm", MFD_CLOEXEC);
+  fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0 ||
+      ftruncate(fds[0], sizeof(shm_channel_t)) < 0) {
+    for (int i = 0; i < SHM_CHANNEL_FDS; i++) {
+      if (fds[i] >= 0) close(fds[i]);
+    }
+    return -1;
+  }
+
+  // Both readers start out asleep, so the first message on either ring
+  // always signals, however the two ends' attaches are ordered.
+  void* mem = mmap(NULL, sizeof(shm_channel_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fds[0], 0);
+  if (mem == MAP_FAILED) {
+    for (int i = 0; i < SHM_CHANNEL_FDS; i++) {
+      close(fds[i]);
+    }
+    return -1;
+  }
+  shm_channel_t* channel = reinterpret_cast<shm_channel_t*>(mem);
+  channel->rings[0].reader_waiting = 1;
+  channel->rings[1].reader_waiting = 1;
+  munmap(mem, sizeof(shm_channel_t));
+  return 0;
+}
+
+int shm_transport_attach(int sock, const int fds[SHM_CHANNEL_FDS],
+                         bool is_master) {
+  void* mem = mmap(NULL, sizeof(shm_channel_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fds[0], 0);
+  close(fds[0]);
+
+  // fds[1] wakes the worker (ring 0's reader), fds[2] wakes the master.
+  int rx_efd = is_master ? fds[2] : fds[1];
+  int tx_efd = is_master ? fds[1] : fds[2];
+  if (mem == MAP_FAILED || rx_efd >= MAX_SHM_FDS) {
+    if (mem != MAP_FAILED) munmap(mem, sizeof(shm_channel_t));
+    close(fds[1]);
+    close(fds[2]);
+    return -1;
+  }
+
+  shm_transport_t* t = new shm_transport_t;
+  t->channel = reinterpret_cast<shm_channel_t*>(mem);
+  t->tx = &t->channel->rings[is_master ? 0 : 1];
+  t->rx = &t->channel->rings[is_master ? 1 : 0];
+  t->tx_efd = tx_efd;
+  t->sock = sock;
+  transports[rx_efd] = t;
+  return rx_efd;
+}
+
+bool is_shm_transport(int fd) {
+  return find_transport(fd) != NULL;
+}
+
+int shm_send_all(int fd, const void* buf, size_t len) {
+  shm_transport_t* t = find_transport(fd);
+  shm_ring_t* ring = t->tx;
+  const char* cbuf = reinterpret_cast<const char*>(buf);
+
+  while (len > 0) {
+    uint32_t tail = ring->tail;
+    uint32_t space = SHM_RING_SIZE - (tail - ring->head);
+    if (space == 0) {
+      // The reader is behind; rings are sized so this is rare enough
+      // that yielding beats a second eventfd per direction.
+      if (peer_gone(t->sock, 0)) return -1;
+      sched_yield();
+      continue;
+    }
+
+    uint32_t n = len < space ? len : space;
+    uint32_t offset = tail & (SHM_RING_SIZE - 1);
+    uint32_t first = n < SHM_RING_SIZE - offset ? n : SHM_RING_SIZE - offset;
+    memcpy(&ring->data[offset], cbuf, first);
+    memcpy(&ring->data[0], cbuf + first, n - first);
+
+    __sync_synchronize();
+    ring->tail = tail + n;
+    __sync_synchronize();
+    if (ring->reader_waiting) {
+      signal_efd(t->tx_efd);
+    }
+
+    cbuf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int shm_recv_all(int fd, void* buf, size_t len) {
+  shm_transport_t* t = find_transport(fd);
+  shm_ring_t* ring = t->rx;
+  char* cbuf = reinterpret_cast<char*>(buf);
+
+  while (len > 0) {
+    uint32_t head = ring->head;
+    uint32_t avail = ring->tail - head;
+    if (avail == 0) {
+      ring->reader_waiting = 1;
+      __sync_synchronize();
+      if (ring->tail == head) {
+        struct pollfd pfds[2];
+        pfds[0].fd = fd;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = t->sock;
+        pfds[1].events = POLLIN | POLLRDHUP;
+        pfds[1].revents = 0;
+        if (poll(pfds, 2, -1) < 0 && errno != EINTR) return -1;
+        if (pfds[1].revents) return -1;
+        drain_efd(fd);
+      }
+      ring->reader_waiting = 0;
+      continue;
+    }
+
+    __sync_synchronize();
+    uint32_t n = len < avail ? len : avail;
+    uint32_t offset = head & (SHM_RING_SIZE - 1);
+    uint32_t first = n < SHM_RING_SIZE - offset ? n : SHM_RING_SIZE - offset;
+    memcpy(cbuf, &ring->data[offset], first);
+    memcpy(cbuf + first, &ring->data[0], n - first);
+
+    __sync_synchronize();
+    ring->head = head + n;
+
+    cbuf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+bool shm_transport_poll(int fd) {
+  shm_transport_t* t = find_transport(fd);
+  if (t == NULL) return false;
+
+  drain_efd(fd);
+  if (t->rx->tail != t->rx->head) {
+    t->rx->reader_waiting = 0;
+    return true;
+  }
+
+  t->rx->reader_waiting = 1;
+  __sync_synchronize();
+  if (t->rx->tail != t->rx->head) {
+    t->rx->reader_waiting = 0;
+    return true;
+  }
+  return false;
+}
+
+void shm_transport_close(int fd) {
+  shm_transport_t* t = find_transport(fd);
+  if (t == NULL) return;
+
+  transports[fd] = NULL;
+  munmap(t->channel, sizeof(shm_channel_t));
+  close(t->tx_efd);
+  close(t->sock);
+  delete t;
+}
+
+int send_fds(int sock, const int* fds, int num_fds) {
+  struct msghdr msg;
+  struct iovec iov;
+  char byte = 0;
+  char control[CMSG_SPACE(sizeof(int) * SHM_CHANNEL_FDS)];
+
+  if (num_fds > SHM_CHANNEL_FDS) return -1;
+
+  // Ancillary data must ride along with at least one byte of payload.
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+
+  return sendmsg(sock, &msg, 0) == 1 ? 0 : -1;
+}
+
+int recv_fds(int sock, int* fds, int num_fds) {
+  struct msghdr msg;
+  struct iovec iov;
+  char byte;
+  char control[CMSG_SPACE(sizeof(int) * SHM_CHANNEL_FDS)];
+
+  if (num_fds > SHM_CHANNEL_FDS) return -1;
+
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int) * num_fds)) {
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * num_fds);
+  return 0;
+}
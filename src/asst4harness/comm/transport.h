@@ -0,0 +1,46 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef COMM_TRANSPORT_H_
+#define COMM_TRANSPORT_H_
+
+#include <stddef.h>
+
+// Shared-memory transport for a master and worker on the same host.
+//
+// The channel is one shared mapping holding two single-producer,
+// single-consumer byte rings (master->worker and worker->master) plus an
+// eventfd per ring that the writer signals only when the reader has
+// announced it is about to sleep. The worker creates the channel and
+// hands the descriptors to the master over their Unix-domain socket,
+// which both ends keep open purely to notice when the other side dies.
+//
+// Once attached, a connection is identified by its receive eventfd: the
+// comm layer routes send/recv on that fd through the rings, and the fd
+// becomes readable whenever a sleeping reader has new data.
+
+#define SHM_CHANNEL_FDS 3
+
+// Creates a channel; fds receives the mapping and the two eventfds.
+int shm_channel_create(int fds[SHM_CHANNEL_FDS]);
+
+// Maps the channel and returns the fd to use for this end of the
+// connection from now on, or -1. Takes ownership of 'sock' and 'fds'.
+int shm_transport_attach(int sock, const int fds[SHM_CHANNEL_FDS],
+                         bool is_master);
+
+bool is_shm_transport(int fd);
+int shm_send_all(int fd, const void* buf, size_t len);
+int shm_recv_all(int fd, void* buf, size_t len);
+
+// For event loops: clears a wakeup and returns true if a message is
+// waiting. Otherwise asks the writer to signal the fd when one arrives
+// and returns false.
+bool shm_transport_poll(int fd);
+
+// Unmaps the channel and closes everything except 'fd' itself.
+void shm_transport_close(int fd);
+
+int send_fds(int sock, const int* fds, int num_fds);
+int recv_fds(int sock, int* fds, int num_fds);
+
+#endif  // COMM_TRANSPORT_H_
@@ -0,0 +1,499 @@
+// Copyright 2013 15418 Course Staff.
+
+#include "comm/uring.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// Multishot recv is the newest thing we use; headers that lack it get
+// the fallback stubs at the bottom of the file.
+#ifdef IORING_RECV_MULTISHOT
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define RECV_RING_ENTRIES 8
+#define RECV_BUFFERS 64
+#define RECV_BUFFER_SIZE (16 * 1024)
+#define RECV_BUFFER_GROUP 0
+
+#define FILE_RING_ENTRIES 4
+#define FILE_BUFFERS 2
+
+#define SEND_RING_ENTRIES 2
+
+template <typename T>
+static inline T load_acquire(const T* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+static inline void store_release(T* p, T v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// A submission/completion queue pair. Only what the worker needs: no
+// SQ polling, no linked requests, one thread per ring.
+class Uring {
+ public:
+  Uring() : fd(-1), sq_mem(NULL), cq_mem(NULL), sqes(NULL),
+            sq_len(0), cq_len(0), sqes_len(0), sqe_tail(0), submitted(0) {}
+
+  ~Uring() {
+    if (sqes != NULL) munmap(sqes, sqes_len);
+    if (cq_mem != NULL && cq_mem != sq_mem) munmap(cq_mem, cq_len);
+    if (sq_mem != NULL) munmap(sq_mem, sq_len);
+    if (fd >= 0) close(fd);
+  }
+
+  bool init(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) return false;
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      if (cq_len > sq_len) sq_len = cq_len;
+      cq_len = sq_len;
+    }
+
+    sq_mem = map(sq_len, IORING_OFF_SQ_RING);
+    if (sq_mem == NULL) return false;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      cq_mem = sq_mem;
+    } else {
+      cq_mem = map(cq_len, IORING_OFF_CQ_RING);
+      if (cq_mem == NULL) return false;
+    }
+    sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = reinterpret_cast<struct io_uring_sqe*>(map(sqes_len,
+                                                      IORING_OFF_SQES));
+    if (sqes == NULL) return false;
+
+    char* sq = reinterpret_cast<char*>(sq_mem);
+    char* cq = reinterpret_cast<char*>(cq_mem);
+    sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_entries = p.sq_entries;
+    sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+
+    sqe_tail = submitted = *sq_tail;
+    return true;
+  }
+
+  int register_op(unsigned opcode, void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+  }
+
+  // Returns a zeroed entry to fill in, or NULL if the queue is full.
+  struct io_uring_sqe* get_sqe() {
+    if (sqe_tail - load_acquire(sq_head) >= sq_entries) return NULL;
+    unsigned index = sqe_tail & sq_mask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    sqe_tail++;
+    return sqe;
+  }
+
+  // Submits everything queued so far and waits for at least 'wait_nr'
+  // completions.
+  int submit_and_wait(unsigned wait_nr) {
+    store_release(sq_tail, sqe_tail);
+    unsigned to_submit = sqe_tail - submitted;
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+      long ret = syscall(__NR_io_uring_enter, fd, to_submit, wait_nr, flags,
+                         NULL, 0);
+      if (ret >= 0) {
+        submitted += ret;
+        to_submit -= ret;
+        if (to_submit == 0) return 0;
+      } else if (errno != EINTR) {
+        return -1;
+      }
+    }
+  }
+
+  struct io_uring_cqe* peek_cqe() {
+    unsigned head = *cq_head;
+    if (head == load_acquire(cq_tail)) return NULL;
+    return &cqes[head & cq_mask];
+  }
+
+  void cqe_seen() {
+    store_release(cq_head, *cq_head + 1);
+  }
+
+  // Blocks until a completion is available.
+  struct io_uring_cqe* wait_cqe() {
+    struct io_uring_cqe* cqe;
+    while ((cqe = peek_cqe()) == NULL) {
+      if (submit_and_wait(1) < 0) return NULL;
+    }
+    return cqe;
+  }
+
+ private:
+  void* map(size_t len, off_t offset) {
+    void* mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, offset);
+    return mem == MAP_FAILED ? NULL : mem;
+  }
+
+  int fd;
+  void* sq_mem;
+  void* cq_mem;
+  struct io_uring_sqe* sqes;
+  size_t sq_len;
+  size_t cq_len;
+  size_t sqes_len;
+
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+
+  unsigned sqe_tail;
+  unsigned submitted;
+};
+
+// Buffers the kernel picks from when a recv completes. The ring's tail
+// overlays the 'resv' field of its first entry.
+class RecvBufferRing {
+ public:
+  RecvBufferRing() : entries(NULL), buffers(NULL), tail(0) {}
+
+  ~RecvBufferRing() {
+    if (entries != NULL) munmap(entries, ring_len());
+    free(buffers);
+  }
+
+  bool init(Uring* ring) {
+    void* mem = mmap(NULL, ring_len(), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return false;
+    entries = reinterpret_cast<struct io_uring_buf*>(mem);
+    if (posix_memalign(reinterpret_cast<void**>(&buffers), 4096,
+                       RECV_BUFFERS * RECV_BUFFER_SIZE) != 0) {
+      buffers = NULL;
+      return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uintptr_t>(entries);
+    reg.ring_entries = RECV_BUFFERS;
+    reg.bgid = RECV_BUFFER_GROUP;
+    if (ring->register_op(IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+      return false;
+
+    for (int i = 0; i < RECV_BUFFERS; i++) {
+      recycle(i);
+    }
+    return true;
+  }
+
+  const char* buffer(int bid) const {
+    return buffers + bid * RECV_BUFFER_SIZE;
+  }
+
+  // Hands buffer 'bid' back to the kernel.
+  void recycle(int bid) {
+    struct io_uring_buf* buf = &entries[tail & (RECV_BUFFERS - 1)];
+    buf->addr = reinterpret_cast<uintptr_t>(buffer(bid));
+    buf->len = RECV_BUFFER_SIZE;
+    buf->bid = bid;
+    tail++;
+    store_release(&entries[0].resv, tail);
+  }
+
+ private:
+  static size_t ring_len() {
+    return RECV_BUFFERS * sizeof(struct io_uring_buf);
+  }
+
+  struct io_uring_buf* entries;
+  char* buffers;
+  uint16_t tail;
+};
+
+static bool arm_recv(Uring* ring, int fd) {
+  struct io_uring_sqe* sqe = ring->get_sqe();
+  if (sqe == NULL) return false;
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = RECV_BUFFER_GROUP;
+  return true;
+}
+
+int uring_recv_message_stream(int fd, message_handler_t handler, void* arg) {
+  Uring ring;
+  RecvBufferRing buffers;
+  if (!ring.init(RECV_RING_ENTRIES) || !buffers.init(&ring))
+    return URING_UNAVAILABLE;
+
+  MessageReader reader;
+  message_t message;
+  int tag;
+  work_t body;
+  bool armed = false;
+  bool got_data = false;
+
+  for (;;) {
+    if (!armed) {
+      if (!arm_recv(&ring, fd)) return -1;
+      armed = true;
+    }
+
+    struct io_uring_cqe* cqe = ring.wait_cqe();
+    if (cqe == NULL) return -1;
+    int res = cqe->res;
+    unsigned flags = cqe->flags;
+    ring.cqe_seen();
+
+    // The kernel drops a multishot recv when it runs out of buffers or
+    // hits an error; either way it has to be re-armed.
+    if (!(flags & IORING_CQE_F_MORE)) armed = false;
+
+    if (res == -ENOBUFS || res == -EINTR) {
+      continue;
+    } else if (res < 0) {
+      if (!got_data && (res == -EINVAL || res == -EOPNOTSUPP))
+        return URING_UNAVAILABLE;
+      return -1;
+    } else if (res == 0) {
+      return -1;
+    }
+
+    got_data = true;
+    int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    // Messages are parsed in place, so the buffer goes back to the
+    // kernel only once they are all out of it.
+    reader.feed(buffers.buffer(bid), res);
+    while (reader.next(&message, &tag, &body)) {
+      handler(message, tag, body, arg);
+    }
+    buffers.recycle(bid);
+    if (reader.malformed()) return -1;
+  }
+}
+
+// One per thread that reads files, since a ring is not thread-safe.
+// Threads are long-lived, so these are never torn down.
+struct FileReadRing {
+  Uring ring;
+  char* buffers[FILE_BUFFERS];
+};
+
+static __thread FileReadRing* file_read_ring = NULL;
+static __thread bool file_read_ring_failed = false;
+
+static FileReadRing* get_file_read_ring() {
+  if (file_read_ring != NULL || file_read_ring_failed)
+    return file_read_ring;
+
+  FileReadRing* r = new FileReadRing;
+  struct iovec iov[FILE_BUFFERS];
+  bool ok = r->ring.init(FILE_RING_ENTRIES);
+  for (int i = 0; i < FILE_BUFFERS; i++) {
+    if (posix_memalign(reinterpret_cast<void**>(&r->buffers[i]), 4096,
+                       URING_READ_CHUNK) != 0) {
+      r->buffers[i] = NULL;
+      ok = false;
+    }
+    iov[i].iov_base = r->buffers[i];
+    iov[i].iov_len = URING_READ_CHUNK;
+  }
+  if (ok) {
+    ok = r->ring.register_op(IORING_REGISTER_BUFFERS, iov, FILE_BUFFERS) == 0;
+  }
+
+  if (!ok) {
+    for (int i = 0; i < FILE_BUFFERS; i++) {
+      free(r->buffers[i]);
+    }
+    delete r;
+    file_read_ring_failed = true;
+    return NULL;
+  }
+  file_read_ring = r;
+  return r;
+}
+
+static void queue_read(FileReadRing* r, int fd, int index, uint64_t offset) {
+  struct io_uring_sqe* sqe = r->ring.get_sqe();
+  sqe->opcode = IORING_OP_READ_FIXED;
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->addr = reinterpret_cast<uintptr_t>(r->buffers[index]);
+  sqe->len = URING_READ_CHUNK;
+  sqe->buf_index = index;
+  sqe->user_data = index;
+}
+
+int uring_read_file(int fd, chunk_handler_t handler, void* arg) {
+  FileReadRing* r = get_file_read_ring();
+  if (r == NULL) return URING_UNAVAILABLE;
+
+  int results[FILE_BUFFERS];
+  bool done[FILE_BUFFERS];
+  uint64_t next_offset = 0;
+  int in_flight = 0;
+
+  for (int i = 0; i < FILE_BUFFERS; i++) {
+    queue_read(r, fd, i, next_offset);
+    next_offset += URING_READ_CHUNK;
+    done[i] = false;
+    in_flight++;
+  }
+
+  int err = 0;
+  int current = 0;
+  for (;;) {
+    while (!done[current]) {
+      struct io_uring_cqe* cqe = r->ring.wait_cqe();
+      if (cqe == NULL) return -1;
+      results[cqe->user_data] = cqe->res;
+      done[cqe->user_data] = true;
+      in_flight--;
+      r->ring.cqe_seen();
+    }
+    done[current] = false;
+
+    // Reads of a regular file only come up short at the end, so a short
+    // chunk is the last one even though the next read is already queued.
+    int res = results[current];
+    if (res < 0) {
+      err = -1;
+      break;
+    }
+    if (res > 0 && !handler(r->buffers[current], res, arg)) break;
+    if (res < URING_READ_CHUNK) break;
+
+    queue_read(r, fd, current, next_offset);
+    next_offset += URING_READ_CHUNK;
+    in_flight++;
+    current = (current + 1) % FILE_BUFFERS;
+  }
+
+  // Leave the ring empty for the next caller.
+  while (in_flight > 0) {
+    struct io_uring_cqe* cqe = r->ring.wait_cqe();
+    if (cqe == NULL) return -1;
+    in_flight--;
+    r->ring.cqe_seen();
+  }
+  return err;
+}
+
+// Like the file read rings, one per sending thread and never torn down.
+static __thread Uring* send_ring = NULL;
+static __thread bool send_ring_failed = false;
+
+static Uring* get_send_ring() {
+  if (send_ring != NULL || send_ring_failed)
+    return send_ring;
+
+  Uring* ring = new Uring;
+  if (!ring->init(SEND_RING_ENTRIES)) {
+    delete ring;
+    send_ring_failed = true;
+    return NULL;
+  }
+  send_ring = ring;
+  return ring;
+}
+
+int uring_send_resps(int fd, const tagged_resp_t* resps, int n,
+                     const trace_hops_t* traces) {
+  Uring* ring = get_send_ring();
+  if (ring == NULL) return URING_UNAVAILABLE;
+
+  resps_iov_t gathered;
+  gather_resps(resps, n, traces, &gathered);
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = gathered.iov;
+  msg.msg_iovlen = gathered.iovcnt;
+
+  bool sent_any = false;
+  while (msg.msg_iovlen > 0) {
+    struct io_uring_sqe* sqe = ring->get_sqe();
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uintptr_t>(&msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+
+    struct io_uring_cqe* cqe = ring->wait_cqe();
+    if (cqe == NULL) return -1;
+    int res = cqe->res;
+    ring->cqe_seen();
+
+    if (res == -EINTR) {
+      continue;
+    } else if (res < 0) {
+      if (!sent_any && (res == -EINVAL || res == -EOPNOTSUPP))
+        return URING_UNAVAILABLE;
+      return -1;
+    } else if (res == 0) {
+      return -1;
+    }
+    sent_any = true;
+
+    // A short send leaves the rest of the batch to go out next time.
+    size_t sent = res;
+    while (msg.msg_iovlen > 0 && sent >= msg.msg_iov->iov_len) {
+      sent -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + sent;
+      msg.msg_iov->iov_len -= sent;
+    }
+  }
+  return 0;
+}
+
+#else  // !IORING_RECV_MULTISHOT
+
+int uring_recv_message_stream(int, message_handler_t, void*) {
+  return URING_UNAVAILABLE;
+}
+
+int uring_read_file(int, chunk_handler_t, void*) {
+  return URING_UNAVAILABLE;
+}
+
+int uring_send_resps(int, const tagged_resp_t*, int, const trace_hops_t*) {
+  return URING_UNAVAILABLE;
+}
+
+#endif  // IORING_RECV_MULTISHOT
@@ -0,0 +1,43 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef COMM_URING_H_
+#define COMM_URING_H_
+
+#include <stddef.h>
+
+#include "comm/comm.h"
+
+// io_uring-backed I/O for the worker, talking to the kernel directly so
+// there is nothing extra to link against.
+//
+// Receiving uses one multishot recv over a ring of kernel-selected
+// buffers, so a steady stream of work costs no syscalls per message
+// beyond waiting for completions. File reads use two registered buffers
+// per thread, with the next chunk in flight while the current one is
+// being parsed. Batches of responses go out as one SENDMSG each, on a
+// ring of the sending thread's own.
+//
+// All three calls return URING_UNAVAILABLE, before doing any I/O, when
+// the kernel does not support what they need; callers then fall back to
+// plain read/recv/sendmsg.
+
+#define URING_UNAVAILABLE (-2)
+
+// As recv_message_stream(). Returns -1 once the connection closes.
+int uring_recv_message_stream(int fd, message_handler_t handler, void* arg);
+
+// Returns false to stop reading early.
+typedef bool (*chunk_handler_t)(const char* buf, size_t len, void* arg);
+
+// Reads the regular file 'fd' from the start, handing it to 'handler' in
+// order, in chunks of up to URING_READ_CHUNK bytes. Returns 0 at end of
+// file or when the handler stops it, and -1 on a read error.
+int uring_read_file(int fd, chunk_handler_t handler, void* arg);
+
+#define URING_READ_CHUNK (1 << 20)
+
+// As send_resps(), for a socket 'fd'. Returns 0 once all of it is sent.
+int uring_send_resps(int fd, const tagged_resp_t* resps, int n,
+                     const trace_hops_t* traces);
+
+#endif  // COMM_URING_H_
@@ -0,0 +1,518 @@
+// Copyright 2013 15418 Course Staff
+
+// An open-loop load generator for the master, for rates beyond what
+// scripts/workgen.py can drive. Every request has an intended start
+// time fixed before the run begins, and its latency is measured from
+// that time rather than from when it was actually sent. If the
+// generator or the master falls behind, the requests that should have
+// gone out meanwhile are charged for the wait instead of silently
+// disappearing from the distribution (coordinated omission).
+//
+// One thread sends everything on schedule, round-robin over
+// --connections pipelined connections, and one thread per connection
+// reads the responses.
+//
+// The requests come from a trace file or from traffic the master
+// captured with --capture_file (types/capture_file.h). A capture plays
+// back at its recorded arrival times, scaled by --speedup, and its
+// recorded latencies are reported next to the new ones. --speedup=0
+// sends a trace or capture as fast as the master takes it, with at most
+// --max_outstanding requests in flight.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "comm/comm.h"
+#include "comm/connect.h"
+#include "server/messages.h"
+#include "server/stats.h"
+#include "tools/cycle_timer.h"
+#include "tools/hdr_histogram.h"
+#include "types/capture_file.h"
+#include "types/trace_file.h"
+#include "types/types.h"
+#include "types/wire.h"
+
+DEFINE_string(arrivals, "trace",
+              "When requests are sent: 'trace' at the trace's own times, "
+              "'poisson' at --rate, or 'bursty' alternating between --rate "
+              "and --burst_factor times that");
+DEFINE_double(speedup, 1,
+              "Trace arrivals: play the trace this many times faster, or "
+              "0 for as fast as possible");
+DEFINE_int32(max_outstanding, 64,
+             "Trace arrivals at --speedup=0: requests in flight at once");
+DEFINE_double(rate, 100, "Poisson and bursty arrivals: requests per second");
+DEFINE_double(duration_s, 10, "Poisson and bursty arrivals: length of the run");
+DEFINE_double(burst_factor, 10, "Bursty arrivals: rate multiplier in a burst");
+DEFINE_double(burst_s, 1, "Bursty arrivals: mean length of a burst");
+DEFINE_double(gap_s, 4, "Bursty arrivals: mean time between bursts");
+DEFINE_int32(seed, 1, "Seed for arrival times and picking requests");
+DEFINE_int32(connections, 8, "Connections to the master to spread requests over");
+DEFINE_bool(binary_encoding, false, "Ask the master for binary request bodies");
+DEFINE_double(drain_s, 60,
+              "Stop waiting for responses this long after the last send");
+DEFINE_string(hdr_file, "",
+              "Write the latency distribution here, in HdrHistogram's "
+              "percentile format");
+DEFINE_bool(verbose, false, "Print every response");
+
+// A request on the schedule. 'tag' on the wire is its index.
+typedef struct {
+  double intended;  // seconds from the start of the run
+  double sent;      // CycleTimer seconds, once sent
+  const trace_entry_t* entry;
+  int cmd;          // stats_cmd_index()
+  bool counted;     // not lastrequest, which only marks the end
+} pending_t;
+
+typedef struct {
+  int fd;
+  encoding_t encoding;
+  pthread_t reader;
+} connection_t;
+
+static std::vector<trace_entry_t> trace;
+static std::vector<pending_t> schedule;
+static std::vector<connection_t> connections;
+static double start_time;
+
+static HdrHistogram latency[MAX_STATS_CMDS];  // from intended start
+static HdrHistogram all_latency;
+static HdrHistogram service_latency;          // from actual send
+static HdrHistogram send_lag;                 // actual send - intended
+static HdrHistogram captured_latency;         // as recorded in a capture
+
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static int num_answered = 0;
+static int num_wrong = 0;
+static int num_unexpected = 0;
+
+static uint64_t to_us(double seconds) {
+  return seconds > 0 ? static_cast<uint64_t>(1e6 * seconds) : 0;
+}
+
+static double exponential(double mean) {
+  return -mean * log((random() + 1.0) / (RAND_MAX + 2.0));
+}
+
+static void add_request(double intended, const trace_entry_t* entry) {
+  pending_t p;
+  p.intended = intended;
+  p.sent = 0;
+  p.entry = entry;
+  Request_msg req(0, entry->work);
+  std::string cmd = req.get_arg("cmd");
+  p.cmd = stats_cmd_index(cmd);
+  p.counted = (cmd != "lastrequest");
+  schedule.push_back(p);
+}
+
+// Picks a request from the trace for generated arrivals. lastrequest
+// would make the master wrap up, so it is never picked.
+static const trace_entry_t* pick_request(
+    const std::vector<const trace_entry_t*>& mix) {
+  return mix[random() % mix.size()];
+}
+
+static bool arrives_before(const capture_record_t* a,
+                           const capture_record_t* b) {
+  return a->arrival < b->arrival;
+}
+
+// Sending back to back, throttled by what is in flight, rather than on
+// a clock.
+static bool as_fast_as_possible() {
+  return FLAGS_arrivals == "trace" && FLAGS_speedup == 0;
+}
+
+// Turns a capture into a trace, in arrival order. A response that says
+// the request was cut short is no answer to check against.
+static void load_capture(const std::vector<capture_record_t>& records) {
+  std::vector<const capture_record_t*> sorted;
+  for (size_t i = 0; i < records.size(); i++)
+    sorted.push_back(&records[i]);
+  std::stable_sort(sorted.begin(), sorted.end(), arrives_before);
+
+  trace.resize(sorted.size());
+  for (size_t i = 0; i < sorted.size(); i++) {
+    const capture_record_t& r = *sorted[i];
+    trace_entry_t& entry = trace[i];
+    entry.time_ms = 1000 * (r.arrival - sorted[0]->arrival);
+    entry.work = r.work;
+    if (r.resp != CANCELLED_RESPONSE && r.resp != DEADLINE_EXCEEDED_RESPONSE)
+      entry.resp = r.resp;
+    if (Request_msg(0, r.work).get_arg("cmd") != "lastrequest")
+      captured_latency.record(to_us(r.latency_ms / 1000.0));
+  }
+}
+
+static void build_schedule() {
+  if (FLAGS_arrivals == "trace") {
+    CHECK_GE(FLAGS_speedup, 0) << "--speedup must not be negative";
+    if (as_fast_as_possible()) {
+      // Each request's start is set as it goes out.
+      for (size_t i = 0; i < trace.size(); i++)
+        add_request(0, &trace[i]);
+      return;
+    }
+    // Requests go out in file order, as workgen.py sends them, so a
+    // time earlier than the line before it (lastrequest is often
+    // written that way) means "right after".
+    double t = 0;
+    for (size_t i = 0; i < trace.size(); i++) {
+      double at = trace[i].time_ms / 1000.0 / FLAGS_speedup;
+      if (at > t)
+        t = at;
+      add_request(t, &trace[i]);
+    }
+    return;
+  }
+
+  CHECK(FLAGS_arrivals == "poisson" || FLAGS_arrivals == "bursty")
+    << "Unknown --arrivals " << FLAGS_arrivals;
+  CHECK_GT(FLAGS_rate, 0) << "--rate must be positive";
+
+  std::vector<const trace_entry_t*> mix;
+  for (size_t i = 0; i < trace.size(); i++) {
+    if (Request_msg(0, trace[i].work).get_arg("cmd") != "lastrequest")
+      mix.push_back(&trace[i]);
+  }
+  CHECK(!mix.empty()) << "The trace has no requests to send";
+
+  // Bursty arrivals are a two-state Markov-modulated Poisson process:
+  // exponentially distributed bursts and gaps, each with its own rate.
+  // Memorylessness lets the next arrival be redrawn at every switch.
+  bool bursty = (FLAGS_arrivals == "bursty");
+  bool in_burst = false;
+  double switch_at = bursty ? exponential(FLAGS_gap_s) : FLAGS_duration_s;
+  double t = 0;
+  for (;;) {
+    double rate = in_burst ? FLAGS_rate * FLAGS_burst_factor : FLAGS_rate;
+    double next = t + exponential(1.0 / rate);
+    if (next > switch_at && switch_at < FLAGS_duration_s) {
+      t = switch_at;
+      in_burst = !in_burst;
+      switch_at = t + exponential(in_burst ? FLAGS_burst_s : FLAGS_gap_s);
+      continue;
+    }
+    if (next > FLAGS_duration_s)
+      break;
+    t = next;
+    add_request(t, pick_request(mix));
+  }
+}
+
+static void handle_response(message_t message, int tag, const work_t& body,
+                            void* arg) {
+  double now = CycleTimer::currentSeconds();
+  connection_t* conn = reinterpret_cast<connection_t*>(arg);
+  if (message != RESPONSE || tag < 0 ||
+      tag >= static_cast<int>(schedule.size())) {
+    LOG(WARNING) << "Unexpected message (" << message << "," << tag << ")";
+    __atomic_fetch_add(&num_unexpected, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  pending_t& p = schedule[tag];
+  resp_t comm_resp;
+  comm_resp.buf_len = body.buf_len;
+  comm_resp.buf = body.buf;
+  Response_msg resp(tag);
+  CHECK(decode_response(comm_resp, conn->encoding, &resp))
+    << "Malformed response to request " << tag;
+
+  bool wrong = !p.entry->resp.empty() && resp.get_response() != p.entry->resp;
+  if (wrong) {
+    LOG(ERROR) << "Incorrect response to request " << tag << " ("
+               << p.entry->work << "): expected '" << p.entry->resp
+               << "', received '" << resp.get_response() << "'";
+  }
+  if (FLAGS_verbose) {
+    printf("Request %d: req: \"%s\", resp: \"%s\", latency: %.3f ms\n", tag,
+           p.entry->work.c_str(), resp.get_response().c_str(),
+           1000 * (now - start_time - p.intended));
+  }
+
+  if (p.counted) {
+    uint64_t us = to_us(now - start_time - p.intended);
+    latency[p.cmd].record(us);
+    all_latency.record(us);
+    service_latency.record(to_us(now - p.sent));
+  }
+
+  pthread_mutex_lock(&done_lock);
+  num_answered++;
+  if (wrong)
+    num_wrong++;
+  // The sender may be waiting for room under --max_outstanding.
+  pthread_cond_broadcast(&done_cond);
+  pthread_mutex_unlock(&done_lock);
+}
+
+static void* read_responses(void* arg) {
+  connection_t* conn = reinterpret_cast<connection_t*>(arg);
+  recv_message_stream(conn->fd, handle_response, conn);
+  return NULL;
+}
+
+static void wait_until_ready(const char* address) {
+  for (;;) {
+    int fd = connect_to(address);
+    CHECK_GE(fd, 0) << "Could not connect to " << address;
+    message_t message;
+    int tag;
+    resp_t resp;
+    CHECK_EQ(send_message(fd, ISREADY, 0), 0);
+    CHECK_EQ(recv_message(fd, &message, &tag), 0);
+    CHECK_EQ(recv_resp(fd, &resp), 0);
+    close(fd);
+    if (std::string(resp.buf->data(), resp.buf_len) == "ready")
+      return;
+    usleep(500 * 1000);
+  }
+}
+
+static void open_connections(const char* address) {
+  CHECK_GT(FLAGS_connections, 0) << "--connections must be positive";
+  connections.resize(FLAGS_connections);
+  for (size_t i = 0; i < connections.size(); i++) {
+    connection_t& conn = connections[i];
+    conn.fd = connect_to(address);
+    CHECK_GE(conn.fd, 0) << "Could not connect to " << address;
+    conn.encoding = ENCODING_TEXT;
+    if (FLAGS_binary_encoding) {
+      message_t message;
+      int granted;
+      CHECK_EQ(send_message(conn.fd, ENCODING, ENCODING_BINARY), 0);
+      CHECK_EQ(recv_message(conn.fd, &message, &granted), 0);
+      CHECK_EQ(message, ENCODING);
+      conn.encoding = static_cast<encoding_t>(granted);
+    }
+  }
+  for (size_t i = 0; i < connections.size(); i++) {
+    CHECK_EQ(pthread_create(&connections[i].reader, NULL, read_responses,
+                            &connections[i]), 0);
+  }
+}
+
+// Waits for an absolute CycleTimer time: sleeps most of the way, then
+// spins, since a sleep alone can overshoot by tens of microseconds.
+static void wait_until(double when) {
+  for (;;) {
+    double left = when - CycleTimer::currentSeconds();
+    if (left <= 0)
+      return;
+    if (left > 200e-6)
+      usleep(static_cast<useconds_t>((left - 100e-6) * 1e6));
+  }
+}
+
+static void send_schedule() {
+  // The requests for each encoding are built up front, so the send loop
+  // is just a wait and a write.
+  std::vector<work_t> bodies[2];
+  for (size_t i = 0; i < connections.size(); i++) {
+    std::vector<work_t>& b = bodies[connections[i].encoding];
+    if (!b.empty())
+      continue;
+    b.resize(trace.size());
+    for (size_t j = 0; j < trace.size(); j++) {
+      encode_request(Request_msg(0, trace[j].work), connections[i].encoding,
+                     &b[j]);
+    }
+  }
+
+  bool throttled = as_fast_as_possible();
+  if (throttled)
+    CHECK_GT(FLAGS_max_outstanding, 0) << "--max_outstanding must be positive";
+
+  start_time = CycleTimer::currentSeconds();
+  for (size_t i = 0; i < schedule.size(); i++) {
+    pending_t& p = schedule[i];
+    if (throttled) {
+      pthread_mutex_lock(&done_lock);
+      while (static_cast<int>(i) - num_answered >= FLAGS_max_outstanding)
+        pthread_cond_wait(&done_cond, &done_lock);
+      pthread_mutex_unlock(&done_lock);
+      p.intended = CycleTimer::currentSeconds() - start_time;
+    } else {
+      wait_until(start_time + p.intended);
+    }
+    const connection_t& conn = connections[i % connections.size()];
+    p.sent = CycleTimer::currentSeconds();
+    send_lag.record(to_us(p.sent - start_time - p.intended));
+    CHECK_EQ(send_work(conn.fd, bodies[conn.encoding][p.entry - &trace[0]],
+                       static_cast<int>(i)), 0)
+      << "Connection to the master closed";
+  }
+}
+
+static void wait_for_responses() {
+  double give_up = CycleTimer::currentSeconds() + FLAGS_drain_s;
+  pthread_mutex_lock(&done_lock);
+  while (num_answered < static_cast<int>(schedule.size())) {
+    double left = give_up - CycleTimer::currentSeconds();
+    if (left <= 0) {
+      LOG(WARNING) << "Giving up on unanswered requests";
+      break;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    double wake = deadline.tv_sec + deadline.tv_nsec * 1e-9 +
+      (left < 0.1 ? left : 0.1);
+    deadline.tv_sec = static_cast<time_t>(wake);
+    deadline.tv_nsec = static_cast<long>((wake - deadline.tv_sec) * 1e9);
+    pthread_cond_timedwait(&done_cond, &done_lock, &deadline);
+  }
+  pthread_mutex_unlock(&done_lock);
+
+  for (size_t i = 0; i < connections.size(); i++) {
+    shutdown(connections[i].fd, SHUT_RDWR);
+    pthread_join(connections[i].reader, NULL);
+    close(connections[i].fd);
+  }
+}
+
+// The distribution in the text form HdrHistogram's own tools (and its
+// online plotter) read, with values in milliseconds.
+static void write_hdr_file(const std::string& path, const HdrHistogram& h) {
+  FILE* out = fopen(path.c_str(), "w");
+  CHECK(out != NULL) << "Could not open " << path;
+
+  fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile",
+          "TotalCount", "1/(1-Percentile)");
+  uint64_t total = h.count();
+  uint64_t seen = 0;
+  double sum_squares = 0;
+  int used = 0;
+  for (int i = 0; i < HdrHistogram::NUM_BUCKETS; i++) {
+    uint64_t n = h.bucket_count(i);
+    if (n == 0)
+      continue;
+    used++;
+    seen += n;
+    uint64_t top = HdrHistogram::bucket_top(i);
+    double value = (top < h.max() ? top : h.max()) / 1000.0;
+    double mid = (HdrHistogram::bucket_bottom(i) + top) / 2000.0 -
+      h.mean() / 1000.0;
+    sum_squares += n * mid * mid;
+
+    double fraction = static_cast<double>(seen) / total;
+    if (seen < total) {
+      fprintf(out, "%12.3f %14.12f %10llu %14.2f\n", value, fraction,
+              static_cast<unsigned long long>(seen), 1 / (1 - fraction));
+    } else {
+      fprintf(out, "%12.3f %14.12f %10llu\n", value, fraction,
+              static_cast<unsigned long long>(seen));
+    }
+  }
+  fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+          h.mean() / 1000.0, total > 0 ? sqrt(sum_squares / total) : 0);
+  fprintf(out, "#[Max     = %12.3f, Total count    = %12llu]\n",
+          h.max() / 1000.0, static_cast<unsigned long long>(total));
+  fprintf(out, "#[Buckets = %12d, SubBuckets     = %12d]\n", used,
+          static_cast<int>(HdrHistogram::SUB_BUCKETS));
+  fclose(out);
+}
+
+static void print_latency(const char* name, const HdrHistogram& h) {
+  printf("  %-14s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+         static_cast<unsigned long long>(h.count()),
+         h.percentile(50) / 1000.0, h.percentile(90) / 1000.0,
+         h.percentile(99) / 1000.0, h.percentile(99.9) / 1000.0,
+         h.max() / 1000.0);
+}
+
+static void print_report(const std::string& path, double elapsed) {
+  int sent = static_cast<int>(schedule.size());
+  double span = schedule.empty() ? 0 : schedule.back().intended;
+
+  printf("\n");
+  printf("trace           %s, %s arrivals\n", path.c_str(),
+         FLAGS_arrivals.c_str());
+  printf("sent            %d requests over %.2f s (%.1f/s intended), "
+         "%.2f s in all\n", sent, span, span > 0 ? sent / span : 0, elapsed);
+  printf("answered        %d (%d wrong, %d unanswered)\n", num_answered,
+         num_wrong, sent - num_answered);
+  printf("send lag (ms)   p50 %.3f, p99 %.3f, max %.3f\n",
+         send_lag.percentile(50) / 1000.0, send_lag.percentile(99) / 1000.0,
+         send_lag.max() / 1000.0);
+  printf("latency (ms)    %8s %10s %10s %10s %10s %10s\n", "count", "p50",
+         "p90", "p99", "p99.9", "max");
+  print_latency("all", all_latency);
+  for (int cmd = 0; cmd < MAX_STATS_CMDS; cmd++) {
+    if (latency[cmd].count() > 0)
+      print_latency(stats_cmd_name(cmd), latency[cmd]);
+  }
+  print_latency("(from send)", service_latency);
+  if (captured_latency.count() > 0)
+    print_latency("(captured)", captured_latency);
+}
+
+int main(int argc, char** argv) {
+
+  std::string usage("Usage: " + std::string(argv[0]) +
+                    " [options] <host:port> <tracefile|capturefile>\n");
+  usage += "  Sends the trace's requests to the master open-loop and reports "
+    "latency from each request's intended start. A capture file from the "
+    "master's --capture_file replays the captured traffic.";
+  google::SetUsageMessage(usage);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  if (argc != 3) {
+    fprintf(stderr, "Invalid number of arguments provided\n%s\n",
+            google::ProgramUsage());
+    exit(EXIT_FAILURE);
+  }
+
+  std::vector<capture_record_t> captured;
+  int bad_record;
+  int bad_line;
+  if (read_capture_file(argv[2], &captured, &bad_record)) {
+    load_capture(captured);
+  } else if (bad_record != 0) {
+    fprintf(stderr, "%s: capture record %d is corrupt\n", argv[2], bad_record);
+    exit(EXIT_FAILURE);
+  } else if (!read_trace_file(argv[2], &trace, &bad_line)) {
+    if (bad_line == 0)
+      fprintf(stderr, "Could not read %s\n", argv[2]);
+    else
+      fprintf(stderr, "%s:%d: not a trace entry\n", argv[2], bad_line);
+    exit(EXIT_FAILURE);
+  }
+
+  srandom(FLAGS_seed);
+  build_schedule();
+  CHECK(!schedule.empty()) << "Nothing to send";
+
+  printf("Waiting for server to initialize...\n");
+  wait_until_ready(argv[1]);
+  open_connections(argv[1]);
+  printf("Server ready, sending %d requests...\n",
+         static_cast<int>(schedule.size()));
+  fflush(stdout);
+
+  send_schedule();
+  wait_for_responses();
+  print_report(argv[2], CycleTimer::currentSeconds() - start_time);
+
+  if (!FLAGS_hdr_file.empty())
+    write_hdr_file(FLAGS_hdr_file, all_latency);
+
+  return (num_wrong == 0 && num_answered == static_cast<int>(schedule.size()))
+    ? EXIT_SUCCESS : EXIT_FAILURE;
+}
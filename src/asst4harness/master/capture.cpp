@@ -0,0 +1,82 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <boost/unordered_map.hpp>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <string>
+
+#include "master/capture.h"
+#include "tools/cycle_timer.h"
+#include "types/capture_file.h"
+
+DEFINE_string(capture_file, "",
+              "Append every client request, its response and latency to "
+              "this file, for replay with loadgen (empty for none).");
+
+#define CAPTURE_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+  double received;
+  std::string work;
+} request_capture_t;
+
+static FILE* capture_out = NULL;
+
+// Adds to CycleTimer seconds to make Unix time.
+static double unix_offset;
+
+static boost::unordered_map<void*, request_capture_t> requests;
+
+void master_capture_init() {
+  if (FLAGS_capture_file.empty())
+    return;
+
+  capture_out = fopen(FLAGS_capture_file.c_str(), "ab");
+  PCHECK(capture_out != NULL) << "Could not open " << FLAGS_capture_file;
+  setvbuf(capture_out, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+  PCHECK(capture_write_header(capture_out))
+    << "Could not write to " << FLAGS_capture_file;
+  fflush(capture_out);
+
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  unix_offset = now.tv_sec + now.tv_usec * 1e-6 -
+    CycleTimer::currentSeconds();
+}
+
+void master_capture_request(void* client, const Request_msg& req) {
+  if (capture_out == NULL)
+    return;
+
+  request_capture_t& r = requests[client];
+  r.received = CycleTimer::currentSeconds();
+  r.work = req.get_request_string();
+}
+
+void master_capture_answered(void* client, const std::string& response) {
+  if (capture_out == NULL)
+    return;
+
+  boost::unordered_map<void*, request_capture_t>::iterator r =
+    requests.find(client);
+  if (r == requests.end())
+    return;
+
+  capture_record_t record;
+  record.arrival = unix_offset + r->second.received;
+  record.latency_ms = 1000 * (CycleTimer::currentSeconds() - r->second.received);
+  record.work.swap(r->second.work);
+  record.resp = response;
+  requests.erase(r);
+
+  PLOG_IF(ERROR, !capture_write_record(capture_out, record))
+    << "Could not write to " << FLAGS_capture_file;
+}
+
+void master_capture_flush() {
+  if (capture_out != NULL)
+    fflush(capture_out);
+}
@@ -0,0 +1,30 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef MASTER_CAPTURE_H_
+#define MASTER_CAPTURE_H_
+
+#include <string>
+
+#include "server/messages.h"
+
+// Traffic capture for --capture_file: every client request the master
+// answers is appended to the file, with its arrival time, response and
+// latency, in the format of types/capture_file.h. loadgen replays such
+// a file. Records are buffered and written out on every tick, so a
+// request costs a map insert and a buffered write. None of these do
+// anything unless --capture_file is set.
+
+// Opens the capture file, if there is one.
+void master_capture_init();
+
+// A client request has arrived and is about to be handed to student
+// code as 'client'.
+void master_capture_request(void* client, const Request_msg& req);
+
+// Student code answered 'client' with 'response'.
+void master_capture_answered(void* client, const std::string& response);
+
+// Writes buffered records out to the file.
+void master_capture_flush();
+
+#endif  // MASTER_CAPTURE_H_
@@ -18,8 +18,11 @@ void harness_begin_main_loop(struct timeval* tick_period);
 
 int launcher_fd = -1;
 int accept_fd = -1;
+int local_accept_fd = -1;
 
 DEFINE_string(address, "localhost:15418", "What address to listen on.");
+DEFINE_bool(local_transport, true,
+            "Also listen on a Unix-domain socket for co-located workers.");
 DECLARE_bool(log_network);
 DEFINE_int32(max_workers, 3, "Maximum number of workers the master can request");
 
@@ -43,6 +46,15 @@ int main(int argc, char** argv) {
   CHECK_GE(accept_fd, 0) << "Could not listen on " << FLAGS_address;
   DLOG_IF(INFO, FLAGS_log_network) << "Listening on " << FLAGS_address;
 
+  if (FLAGS_local_transport) {
+    char path[108];
+    local_socket_path(FLAGS_address.c_str(), path, sizeof(path));
+    local_accept_fd = listen_to_local(path);
+    LOG_IF(WARNING, local_accept_fd < 0) << "Could not listen on " << path;
+    DLOG_IF(INFO, FLAGS_log_network && local_accept_fd >= 0)
+      << "Listening on " << path;
+  }
+
   launcher_fd = connect_to(argv[1]);
   CHECK_GE(launcher_fd, 0) << "Could not connect to launcher " << argv[1];
   DLOG_IF(INFO, FLAGS_log_network) << "Connected to launcher at " << argv[1];
@@ -2,6 +2,7 @@
 // This was most helpful: http://eradman.com/posts/kqueue-tcp.html
 
 #include <assert.h>
+#include <boost/unordered_map.hpp>
 #include <boost/unordered_set.hpp>
 #include <errno.h>
 #include <event.h>
@@ -9,23 +10,40 @@
 #include <glog/logging.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/select.h>
 #include <unistd.h>
 #include <netinet/in.h>
-#include <boost/make_shared.hpp>
 
 #include "comm/comm.h"
+#include "comm/inproc.h"
+#include "comm/transport.h"
+#include "master/capture.h"
+#include "master/metrics.h"
+#include "master/trace.h"
 #include "types/types.h"
+#include "types/wire.h"
 #include "server/messages.h"
 #include "server/master.h"
+#include "tools/cycle_timer.h"
 
 
 #define MAX_EVENTS 1024
 
 extern int launcher_fd;
 extern int accept_fd;
+extern int local_accept_fd;
 
 DEFINE_bool(log_network, false, "Log network traffic.");
+DEFINE_bool(binary_encoding, true,
+            "Grant binary wire encoding to peers that ask for it.");
+DEFINE_bool(shm_transport, true,
+            "Grant shared-memory transport to local workers that ask for it.");
+DEFINE_int32(stats_period_ms, 1000,
+             "How often to ask workers for load stats (0 for never).");
+DEFINE_int32(request_deadline_ms, 0,
+             "Time a worker may spend on a request before giving up on it "
+             "(0 for no limit).");
 
 #define NETLOG(level) DLOG_IF(level, FLAGS_log_network)
 
@@ -33,10 +51,54 @@ static bool is_server_initialized = false;
 
 boost::unordered_set<void*> workers;
 
+// The server program runs its worker node inside this process, behind
+// the in-memory channel of comm/inproc.h. Its handle is the event that
+// watches the channel, and every send to it goes through the channel
+// instead of a socket.
+static struct event* inproc_event = NULL;
+
+static bool is_inproc_worker(void* worker_handle) {
+  return worker_handle == inproc_event;
+}
+
+static void send_to_inproc_worker(message_t message, int tag,
+                                  const Request_msg* req) {
+  inproc_message_t m;
+  m.message = message;
+  m.tag = tag;
+  m.req = req ? new Request_msg(*req) : NULL;
+  inproc_send_to_node(m);
+}
+
+// Connections that negotiated ENCODING_BINARY; everyone else speaks text.
+static boost::unordered_set<void*> binary_connections;
+
+static encoding_t connection_encoding(void* connection_handle) {
+  return binary_connections.count(connection_handle) ?
+    ENCODING_BINARY : ENCODING_TEXT;
+}
+
+// A client request in flight. Student code gets one of these as the
+// Client_handle for each request, so a client may pipeline any number
+// of requests on one connection and have each response come back, in
+// whatever order it finishes, carrying the tag the client sent with it.
+typedef struct {
+  void* connection;  // NULL once the client has gone away
+  int tag;
+} client_request_t;
+
+static boost::unordered_map<void*, boost::unordered_set<client_request_t*> >
+  client_requests;
+
+// Connections moved to shared memory are driven by their eventfd; this
+// maps each one to the event still watching its socket for hangups.
+static boost::unordered_map<void*, struct event*> transport_watches;
+
 static void close_connection(void* connection_handle) {
   struct event* event = reinterpret_cast<struct event*>(connection_handle);
   CHECK_NE(EVENT_FD(event), accept_fd) << "Critical connection failed\n";
   CHECK_NE(EVENT_FD(event), launcher_fd) << "Critical connection failed\n";
+  CHECK_NE(EVENT_FD(event), local_accept_fd) << "Critical connection failed\n";
 
   // We should never call close_connection() on a worker handle, because
   // kill_worker() first removes the worker from the worker set and then
@@ -45,6 +107,29 @@ static void close_connection(void* connection_handle) {
     << "Unexpected close of worker handle " << EVENT_FD(event);
 
   NETLOG(INFO) << "Connection closed " << EVENT_FD(event);
+  binary_connections.erase(connection_handle);
+
+  // Student code may still answer requests from this connection; those
+  // responses are dropped when they arrive.
+  boost::unordered_map<void*, boost::unordered_set<client_request_t*> >::iterator
+    requests = client_requests.find(connection_handle);
+  if (requests != client_requests.end()) {
+    boost::unordered_set<client_request_t*>::iterator it;
+    for (it = requests->second.begin(); it != requests->second.end(); it++) {
+      (*it)->connection = NULL;
+    }
+    client_requests.erase(requests);
+  }
+
+  boost::unordered_map<void*, struct event*>::iterator watch =
+    transport_watches.find(connection_handle);
+  if (watch != transport_watches.end()) {
+    LOG_IF(ERROR, event_del(watch->second) < 0)
+      << "Error deleting event " << EVENT_FD(watch->second);
+    delete watch->second;
+    transport_watches.erase(watch);
+  }
+  shm_transport_close(EVENT_FD(event));
 
   PLOG_IF(ERROR, close(EVENT_FD(event)))
     << "Error closing fd " << EVENT_FD(event);
@@ -64,6 +149,21 @@ void request_new_worker_node(const Request_msg& req) {
   sprintf(tmp_buffer, "%d", req.get_tag());
   modified.set_arg("tag", tmp_buffer);
 
+  if (inproc_channel_active()) {
+    // There is one node per process: myserver/worker.cpp keeps its
+    // state in globals, as a worker process may.
+    if (pending_worker_requests > 0 ||
+        workers.find(inproc_event) != workers.end()) {
+      LOG(ERROR) << "The in-process worker node is already running; "
+                 << "run with --max_workers=1";
+      return;
+    }
+    DLOG(INFO) << "Starting in-process worker " << req.get_tag();
+    send_to_inproc_worker(NEW_WORKER, req.get_tag(), &modified);
+    pending_worker_requests++;
+    return;
+  }
+
   std::string str = modified.get_request_string();
 
   DLOG(INFO) << "Requesting worker " << str;
@@ -75,46 +175,105 @@ void request_new_worker_node(const Request_msg& req) {
 void kill_worker_node(Worker_handle worker_handle) {
 
   CHECK_EQ(workers.erase(worker_handle), 1U) << "Attempt to kill non worker";
-  close_connection(worker_handle);
+  metrics_worker_gone(worker_handle);
+
+  // The in-process node keeps running, idle, and comes straight back
+  // online if another worker is requested. Whatever it still sends is
+  // dropped, as it would be on a closed connection.
+  if (!is_inproc_worker(worker_handle))
+    close_connection(worker_handle);
 }
 
 void send_request_to_worker(Client_handle worker_handle, const Request_msg& job) {
   work_t comm_work;
 
-  std::string contents = job.get_request_string();
-  int allocation_size = contents.size();
-  comm_work.buf = boost::make_shared<char[]>(allocation_size);
-  comm_work.buf_len = allocation_size;
-  strncpy(comm_work.buf.get(), contents.c_str(), allocation_size);
-
-  // now perform the send
   CHECK(workers.find(worker_handle) != workers.end())
     << "Attempt to send work to invalid worker";
+
+  int copy_of = atoi(job.get_arg("hedge_of").c_str());
+  Request_msg with_deadline(job);
+  if (FLAGS_request_deadline_ms > 0 && job.get_arg("deadline_ms").empty()) {
+    char budget[32];
+    sprintf(budget, "%d", FLAGS_request_deadline_ms);
+    with_deadline.set_arg("deadline_ms", budget);
+  }
+
+  if (is_inproc_worker(worker_handle)) {
+    NETLOG(INFO) << "Sending work " << job.get_tag() << " in-process";
+    metrics_dispatched(worker_handle, job.get_tag(), copy_of);
+    master_trace_dispatched(job.get_tag());
+    send_to_inproc_worker(WORK, job.get_tag(), &with_deadline);
+    return;
+  }
+  encode_request(with_deadline, connection_encoding(worker_handle),
+                 &comm_work);
+
+  // now perform the send
   // TODO(awreece) Lock the worker handle!
   struct event* event = reinterpret_cast<struct event*>(worker_handle);
   NETLOG(INFO) << "Sending work (" << job.get_tag() << "," << comm_work << ") to "
                << EVENT_FD(event);
+  metrics_dispatched(worker_handle, job.get_tag(), copy_of);
+  master_trace_dispatched(job.get_tag());
   CHECK_EQ(send_work(EVENT_FD(event), comm_work, job.get_tag()), 0)
     << "Unexpected connection failure with worker " << EVENT_FD(event);
 }
 
-void send_client_response(Client_handle client_handle, const Response_msg& resp) {
+void cancel_worker_request(Worker_handle worker_handle, int tag) {
+  CHECK(workers.find(worker_handle) != workers.end())
+    << "Attempt to cancel work on invalid worker";
 
-  resp_t comm_resp;
+  if (is_inproc_worker(worker_handle)) {
+    NETLOG(INFO) << "Cancelling " << tag << " in-process";
+    send_to_inproc_worker(CANCEL, tag, NULL);
+    return;
+  }
 
-  std::string resp_str = resp.get_response();
-  int allocation_size = resp_str.size();
-  comm_resp.buf = boost::make_shared<char[]>(allocation_size);
-  comm_resp.buf_len = allocation_size;
-  strncpy(comm_resp.buf.get(), resp_str.c_str(), allocation_size);
+  struct event* event = reinterpret_cast<struct event*>(worker_handle);
+  NETLOG(INFO) << "Cancelling " << tag << " on " << EVENT_FD(event);
+  CHECK_EQ(send_message(EVENT_FD(event), CANCEL, tag), 0)
+    << "Unexpected connection failure with worker " << EVENT_FD(event);
+}
+
+static void send_response_string(void* connection_handle, int tag,
+                                 const std::string& resp_str) {
+  resp_t comm_resp;
+  encode_response(resp_str, connection_encoding(connection_handle),
+                  &comm_resp);
 
   // send to comm layer
-  struct event* event = reinterpret_cast<struct event*>(client_handle);
-  NETLOG(INFO) << "Sending response " << comm_resp << " to " << EVENT_FD(event);
-  CHECK_EQ(send_resp(EVENT_FD(event), comm_resp, 0), 0)
+  struct event* event = reinterpret_cast<struct event*>(connection_handle);
+  NETLOG(INFO) << "Sending response (" << tag << "," << comm_resp << ") to "
+               << EVENT_FD(event);
+  CHECK_EQ(send_resp(EVENT_FD(event), comm_resp, tag), 0)
     << "Unexpected connection failure with client " << EVENT_FD(event);
 }
 
+void send_client_response(Client_handle client_handle, const Response_msg& resp) {
+  client_request_t* request = reinterpret_cast<client_request_t*>(client_handle);
+
+  if (request->connection == NULL) {
+    NETLOG(WARNING) << "Dropping response " << request->tag
+                    << " for closed connection";
+  } else {
+    send_response_string(request->connection, request->tag,
+                         resp.get_response());
+    client_requests[request->connection].erase(request);
+  }
+  metrics_answered(request, resp.get_tag());
+  master_trace_answered(request, resp.get_tag());
+  master_capture_answered(request, resp.get_response());
+  delete request;
+}
+
+bool client_is_connected(Client_handle client_handle) {
+  return reinterpret_cast<client_request_t*>(client_handle)->connection != NULL;
+}
+
+double master_current_time() {
+  return CycleTimer::currentSeconds();
+}
+
 void server_init_complete() {
   is_server_initialized = true;
 }
@@ -125,8 +284,68 @@ static void shutdown() {
 }
 
 bool should_shutdown = false;
-static void handle_read(int fd, int16_t events, void* arg) {
-  assert(events & EV_READ);
+
+static void handle_read(int fd, int16_t events, void* arg);
+
+static void worker_online(void* worker_handle, int tag) {
+  pending_worker_requests--;
+  if (should_shutdown && pending_worker_requests == 0) {
+    shutdown();
+  }
+  workers.insert(worker_handle);
+  metrics_worker_online(worker_handle, tag);
+
+  // Turn on the worker's side of tracing before it gets any work.
+  if (master_tracing()) {
+    if (is_inproc_worker(worker_handle)) {
+      send_to_inproc_worker(TRACE, 0, NULL);
+    } else {
+      int fd = EVENT_FD(reinterpret_cast<struct event*>(worker_handle));
+      trace_hops_t none;
+      memset(&none, 0, sizeof(none));
+      LOG_IF(ERROR, send_trace(fd, none, 0) < 0)
+        << "Error enabling tracing on worker " << fd;
+    }
+  }
+  handle_new_worker_online(worker_handle, tag);
+}
+
+static void worker_responded(void* worker_handle, const Response_msg& resp) {
+  int tag = resp.get_tag();
+  metrics_responded(worker_handle, tag);
+  master_trace_responded(tag);
+  handle_worker_response(worker_handle, resp);
+  metrics_forget(tag);
+  master_trace_forget(tag);
+}
+
+static void handle_transport_hangup(int fd, int16_t events, void* arg) {
+  (void)events;
+  NETLOG(WARNING) << "Connection closed on " << fd;
+  close_connection(arg);
+}
+
+// Switches the connection 'arg' (currently on socket 'fd') over to the
+// shared-memory channel described by 'fds'.
+static void attach_shm_transport(int fd, void* arg,
+                                 const int fds[SHM_CHANNEL_FDS]) {
+  struct event* event = reinterpret_cast<struct event*>(arg);
+  int rx_fd = shm_transport_attach(fd, fds, true);
+  CHECK_GE(rx_fd, 0) << "Could not map shared-memory channel from " << fd;
+
+  LOG_IF(ERROR, event_del(event) < 0) << "Error deleting event " << fd;
+  event_set(event, rx_fd, EV_READ|EV_PERSIST, handle_read, event);
+  event_add(event, NULL);
+
+  struct event* watch = new struct event;
+  event_set(watch, fd, EV_READ, handle_transport_hangup, event);
+  event_add(watch, NULL);
+  transport_watches[arg] = watch;
+
+  NETLOG(INFO) << "Connection " << fd << " moved to shared memory " << rx_fd;
+}
+
+static void handle_message(int fd, void* arg) {
   message_t message;
   int tag;
   int err = recv_message(fd, &message, &tag);
@@ -142,21 +361,61 @@ static void handle_read(int fd, int16_t events, void* arg) {
 
   case ISREADY: {
 
-    resp_t comm_resp;
-    std::string resp_str( is_server_initialized ? "ready" : "not_ready" );
+    send_response_string(arg, tag,
+                         is_server_initialized ? "ready" : "not_ready");
+    close_connection(arg);
+    break;
+  }
 
-    int allocation_size = resp_str.size();
-    comm_resp.buf = boost::make_shared<char[]>(allocation_size);
-    comm_resp.buf_len = allocation_size;
-    strncpy(comm_resp.buf.get(), resp_str.c_str(), allocation_size);
+  case METRICS: {
+    // Unlike ISREADY the connection stays open, so a tool can keep
+    // polling on it.
+    send_response_string(arg, tag, metrics_report());
+    break;
+  }
 
-    // send to comm layer
-    struct event* event = reinterpret_cast<struct event*>(arg);
-    NETLOG(INFO) << "Sending response " << comm_resp << " to " << EVENT_FD(event);
-    CHECK_EQ(send_resp(EVENT_FD(event), comm_resp, 0), 0)
-      << "Unexpected connection failure with client " << EVENT_FD(event);
+  case TRANSPORT: {
+    int fds[SHM_CHANNEL_FDS];
+    if (tag == TRANSPORT_SHM && recv_fds(fd, fds, SHM_CHANNEL_FDS) < 0) {
+      NETLOG(ERROR) << "Could not receive shared-memory channel from " << fd;
+      close_connection(arg);
+      return;
+    }
 
-    close_connection(arg);
+    transport_t granted = (tag == TRANSPORT_SHM && FLAGS_shm_transport) ?
+      TRANSPORT_SHM : TRANSPORT_SOCKET;
+    NETLOG(INFO) << "Using " << granted << " transport on " << fd;
+    if (send_message(fd, TRANSPORT, granted) < 0) {
+      NETLOG(ERROR) << "Unexpected connection close on " << fd;
+      close_connection(arg);
+      return;
+    }
+
+    if (granted == TRANSPORT_SHM) {
+      attach_shm_transport(fd, arg, fds);
+    } else if (tag == TRANSPORT_SHM) {
+      for (int i = 0; i < SHM_CHANNEL_FDS; i++) {
+        close(fds[i]);
+      }
+    }
+    break;
+  }
+
+  case ENCODING: {
+    // Negotiation: the tag is the encoding the peer asks for, and we
+    // answer with the one we will use for the rest of the connection.
+    encoding_t granted = ENCODING_TEXT;
+    if (FLAGS_binary_encoding && tag == ENCODING_BINARY) {
+      granted = ENCODING_BINARY;
+      binary_connections.insert(arg);
+    } else {
+      binary_connections.erase(arg);
+    }
+    NETLOG(INFO) << "Using " << granted << " encoding on " << fd;
+    if (send_message(fd, ENCODING, granted) < 0) {
+      NETLOG(ERROR) << "Unexpected connection close on " << fd;
+      close_connection(arg);
+    }
     break;
   }
     case SHUTDOWN: {
@@ -175,19 +434,25 @@ static void handle_read(int fd, int16_t events, void* arg) {
         close_connection(arg);
         return;
       }
-      NETLOG(INFO) << "Got new work " << work << " from " << fd;
+      NETLOG(INFO) << "Got new work (" << tag << "," << work << ") from "
+                   << fd;
 
-      // HACK(kayvonf): convert a work_t into a Request_msg to pass to student code
-      // Since the content in work_t.buf is not null terminated, this is a big mess
-      int len = work.buf_len;
-      char* tmp_buffer = new char[len+1];
-      strncpy(tmp_buffer, work.buf.get(), len);
-      tmp_buffer[len] = '\0';
+      Request_msg client_req(0);
+      if (!decode_request(work, connection_encoding(arg), &client_req)) {
+        NETLOG(ERROR) << "Malformed work from " << fd;
+        close_connection(arg);
+        return;
+      }
 
-      Request_msg client_req(0, tmp_buffer);
-      delete [] tmp_buffer;
+      client_request_t* request = new client_request_t;
+      request->connection = arg;
+      request->tag = tag;
+      client_requests[arg].insert(request);
+      metrics_request(request, client_req);
+      master_trace_request(request, client_req);
+      master_capture_request(request, client_req);
 
-      handle_client_request(arg, client_req);
+      handle_client_request(request, client_req);
       break;
     }
 
@@ -202,29 +467,47 @@ static void handle_read(int fd, int16_t events, void* arg) {
       NETLOG(INFO) << "Got worker response (" << tag << "," << comm_resp
         << ") from " << fd;
 
-      // HACK(kayvonf): convert a resp_t into a Response_msg to pass to student code
-      // Since the content in resp_t.buf is not null terminated, this is a big mess
-      int len = comm_resp.buf_len;
-      char* tmp_buffer = new char[len+1];
-      strncpy(tmp_buffer, comm_resp.buf.get(), len);
-      tmp_buffer[len] = '\0';
       Response_msg resp(tag);
-      resp.set_response(tmp_buffer);
-      delete [] tmp_buffer;
+      CHECK(decode_response(comm_resp, connection_encoding(arg), &resp))
+        << "Malformed response from worker " << fd;
 
-      handle_worker_response(arg, resp);
+      worker_responded(arg, resp);
       break;
     }
 
-    case NEW_WORKER: {
-      pending_worker_requests--;
-      if (should_shutdown && pending_worker_requests == 0) {
-  shutdown();
+    case TRACE: {
+      // The hops of the response that follows.
+      trace_hops_t hops;
+      if (recv_trace(fd, &hops) < 0) {
+        NETLOG(ERROR) << "Unexpected connection close on " << fd;
+        close_connection(arg);
+        return;
+      }
+      NETLOG(INFO) << "Got " << hops << " from " << fd;
+      master_trace_worker_hops(tag, hops);
+      break;
+    }
+
+    case STATS: {
+      worker_stats_t stats;
+      if (recv_worker_stats(fd, &stats) < 0) {
+        NETLOG(ERROR) << "Unexpected connection close on " << fd;
+        close_connection(arg);
+        return;
+      }
+      NETLOG(INFO) << "Got " << stats << " from " << fd;
+
+      // A worker killed since it was asked may still have answered.
+      if (workers.find(arg) != workers.end()) {
+        handle_worker_stats(arg, stats);
       }
+      break;
+    }
+
+    case NEW_WORKER: {
       // Notification that a worker has booted.
       NETLOG(INFO) << "New worker " << tag << " on " << fd;
-      workers.insert(arg);
-      handle_new_worker_online(arg, tag);
+      worker_online(arg, tag);
       break;
     }
 
@@ -236,13 +519,68 @@ static void handle_read(int fd, int16_t events, void* arg) {
   }
 }
 
+static void handle_read(int fd, int16_t events, void* arg) {
+  assert(events & EV_READ);
+
+  if (!is_shm_transport(fd)) {
+    handle_message(fd, arg);
+    return;
+  }
+
+  // A shared-memory connection wakes us through its eventfd, and one
+  // wakeup can stand for several queued messages. Stop if handling one
+  // of them closed the connection.
+  while (shm_transport_poll(fd)) {
+    handle_message(fd, arg);
+  }
+}
+
+// Everything the in-process worker node has sent since the last wakeup.
+static void handle_inproc_read(int fd, int16_t events, void* arg) {
+  (void)fd;
+  (void)events;
+  (void)arg;
+
+  inproc_message_t m;
+  while (inproc_master_receive(&m)) {
+    switch (m.message) {
+      case NEW_WORKER:
+        NETLOG(INFO) << "New worker " << m.tag << " in-process";
+        worker_online(inproc_event, m.tag);
+        break;
+
+      case TRACE:
+        master_trace_worker_hops(m.tag, m.trace);
+        break;
+
+      case RESPONSE:
+        // Dropped after the node is killed, like a closed connection's.
+        if (workers.find(inproc_event) != workers.end()) {
+          Response_msg resp(m.tag);
+          resp.set_response(m.response);
+          worker_responded(inproc_event, resp);
+        }
+        break;
+
+      case STATS:
+        if (workers.find(inproc_event) != workers.end())
+          handle_worker_stats(inproc_event, m.stats);
+        break;
+
+      default:
+        LOG(FATAL) << "Unexpected message " << m.message
+                   << " from the in-process worker";
+    }
+  }
+}
+
 static void handle_accept(int fd, int16_t events, void* arg) {
   (void)arg;
   assert(events & EV_READ);
 
-  struct sockaddr addr;
+  struct sockaddr_storage addr;
   socklen_t addr_len = sizeof(addr);
-  fd = accept(fd, &addr, &addr_len);
+  fd = accept(fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_len);
 
   PCHECK(fd >= 0) << "Failure accepting new connection!";
   NETLOG(INFO) << "New connection on " << fd;
@@ -265,22 +603,71 @@ static void handle_timer(int fd, int16_t events, void* arg) {
   (void)arg;
 
   NETLOG(INFO) << "Timer tick";
+  master_capture_flush();
   handle_tick();
 }
 
+// Polls every worker for a STATS report; the replies arrive through
+// handle_message() like any other message.
+static void handle_stats_timer(int fd, int16_t events, void* arg) {
+  (void)fd;
+  (void)events;
+  (void)arg;
+
+  static int stats_request_tag = 0;
+  stats_request_tag++;
+
+  boost::unordered_set<void*>::iterator it;
+  for (it = workers.begin(); it != workers.end(); it++) {
+    if (is_inproc_worker(*it)) {
+      send_to_inproc_worker(REQUEST_STATS, stats_request_tag, NULL);
+      continue;
+    }
+    struct event* event = reinterpret_cast<struct event*>(*it);
+    NETLOG(INFO) << "Requesting stats from " << EVENT_FD(event);
+    LOG_IF(ERROR, send_message(EVENT_FD(event), REQUEST_STATS,
+                               stats_request_tag) < 0)
+      << "Error requesting stats from worker " << EVENT_FD(event);
+  }
+}
+
 void harness_begin_main_loop(struct timeval* tick_period) {
   event_init();
-  struct event accept_event, timer_event;
+  master_trace_init();
+  master_capture_init();
+  struct event accept_event, local_accept_event, timer_event, stats_event;
 
   // Set up the accept event.
   event_set(&accept_event, accept_fd, EV_READ|EV_PERSIST,
             handle_accept, &accept_event);
   event_add(&accept_event, NULL);
 
+  // Co-located workers connect on the Unix-domain socket, if we have one.
+  if (local_accept_fd >= 0) {
+    event_set(&local_accept_event, local_accept_fd, EV_READ|EV_PERSIST,
+              handle_accept, &local_accept_event);
+    event_add(&local_accept_event, NULL);
+  }
+
   // Set up the timer event.
   event_set(&timer_event, -1, EV_PERSIST, handle_timer, NULL);
   event_add(&timer_event, tick_period);
 
+  if (FLAGS_stats_period_ms > 0) {
+    struct timeval stats_period;
+    stats_period.tv_sec = FLAGS_stats_period_ms / 1000;
+    stats_period.tv_usec = (FLAGS_stats_period_ms % 1000) * 1000;
+    event_set(&stats_event, -1, EV_PERSIST, handle_stats_timer, NULL);
+    event_add(&stats_event, &stats_period);
+  }
+
+  if (inproc_channel_active()) {
+    inproc_event = new struct event;
+    event_set(inproc_event, inproc_wakeup_fd(), EV_READ|EV_PERSIST,
+              handle_inproc_read, NULL);
+    event_add(inproc_event, NULL);
+  }
+
   NETLOG(INFO) << "Starting event loop";
   event_dispatch();
 }
@@ -0,0 +1,240 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <boost/unordered_map.hpp>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "master/metrics.h"
+#include "server/stats.h"
+#include "tools/cycle_timer.h"
+#include "tools/hdr_histogram.h"
+
+// Throughput is averaged over this many one-second buckets.
+#define RATE_WINDOW_S 10
+
+static const double QUANTILES[] = { 50, 90, 99, 99.9 };
+static const int NUM_QUANTILES = sizeof(QUANTILES) / sizeof(QUANTILES[0]);
+
+typedef struct {
+  double received;
+  int cmd;
+} request_metrics_t;
+
+typedef struct {
+  double dispatched;
+  double first_dispatched;  // of the earliest copy, for queue wait
+  void* worker;
+} dispatch_metrics_t;
+
+typedef struct {
+  int tag;
+  int outstanding;
+  HdrHistogram* latency;
+} worker_metrics_t;
+
+// Answers per second, over the last RATE_WINDOW_S seconds.
+typedef struct {
+  long long second[RATE_WINDOW_S];
+  int answered[RATE_WINDOW_S];
+} rate_window_t;
+
+static double start_time = CycleTimer::currentSeconds();
+
+static HdrHistogram latency[MAX_STATS_CMDS];
+static HdrHistogram queue_wait[MAX_STATS_CMDS];
+static rate_window_t rates[MAX_STATS_CMDS];
+
+static boost::unordered_map<void*, request_metrics_t> requests;
+static boost::unordered_map<int, dispatch_metrics_t> dispatches;
+static boost::unordered_map<void*, worker_metrics_t> workers;
+
+static uint64_t to_us(double seconds) {
+  return seconds > 0 ? (uint64_t)(1e6 * seconds) : 0;
+}
+
+static void count_answer(rate_window_t* rate, double now) {
+  long long second = (long long)now;
+  int slot = second % RATE_WINDOW_S;
+  if (rate->second[slot] != second) {
+    rate->second[slot] = second;
+    rate->answered[slot] = 0;
+  }
+  rate->answered[slot]++;
+}
+
+static double rate_of(const rate_window_t& rate, double now) {
+  long long second = (long long)now;
+  int answered = 0;
+  for (int i = 0; i < RATE_WINDOW_S; i++) {
+    if (rate.second[i] > second - RATE_WINDOW_S)
+      answered += rate.answered[i];
+  }
+  double window = now - start_time;
+  if (window > RATE_WINDOW_S)
+    window = RATE_WINDOW_S;
+  return window > 0 ? answered / window : 0;
+}
+
+void metrics_request(void* client, const Request_msg& req) {
+  request_metrics_t& r = requests[client];
+  r.received = CycleTimer::currentSeconds();
+  r.cmd = stats_cmd_index(req.get_arg("cmd"));
+}
+
+static void count_outstanding(void* worker, int delta) {
+  boost::unordered_map<void*, worker_metrics_t>::iterator w =
+    workers.find(worker);
+  if (w != workers.end())
+    w->second.outstanding += delta;
+}
+
+void metrics_dispatched(void* worker, int tag, int copy_of) {
+  // Work sent again under the same tag replaces the earlier dispatch.
+  boost::unordered_map<int, dispatch_metrics_t>::iterator old =
+    dispatches.find(tag);
+  if (old != dispatches.end())
+    count_outstanding(old->second.worker, -1);
+
+  double now = CycleTimer::currentSeconds();
+  double first = now;
+  boost::unordered_map<int, dispatch_metrics_t>::iterator original =
+    copy_of != 0 ? dispatches.find(copy_of) : dispatches.end();
+  if (original != dispatches.end())
+    first = original->second.first_dispatched;
+
+  dispatch_metrics_t& d = dispatches[tag];
+  d.dispatched = now;
+  d.first_dispatched = first;
+  d.worker = worker;
+  count_outstanding(worker, 1);
+}
+
+void metrics_responded(void* worker, int tag) {
+  boost::unordered_map<int, dispatch_metrics_t>::iterator d =
+    dispatches.find(tag);
+  boost::unordered_map<void*, worker_metrics_t>::iterator w =
+    workers.find(worker);
+  if (d == dispatches.end() || w == workers.end() ||
+      d->second.worker != worker)
+    return;
+
+  w->second.outstanding--;
+  w->second.latency->record(
+    to_us(CycleTimer::currentSeconds() - d->second.dispatched));
+}
+
+void metrics_answered(void* client, int tag) {
+  boost::unordered_map<void*, request_metrics_t>::iterator r =
+    requests.find(client);
+  if (r == requests.end())
+    return;
+
+  double now = CycleTimer::currentSeconds();
+  int cmd = r->second.cmd;
+  latency[cmd].record(to_us(now - r->second.received));
+  count_answer(&rates[cmd], now);
+
+  // Requests answered by the master itself never waited for a worker.
+  boost::unordered_map<int, dispatch_metrics_t>::iterator d =
+    dispatches.find(tag);
+  if (d != dispatches.end())
+    queue_wait[cmd].record(
+      to_us(d->second.first_dispatched - r->second.received));
+
+  requests.erase(r);
+}
+
+void metrics_forget(int tag) {
+  dispatches.erase(tag);
+}
+
+void metrics_worker_online(void* worker, int tag) {
+  worker_metrics_t& w = workers[worker];
+  w.tag = tag;
+  w.outstanding = 0;
+  w.latency = new HdrHistogram;
+}
+
+void metrics_worker_gone(void* worker) {
+  boost::unordered_map<void*, worker_metrics_t>::iterator w =
+    workers.find(worker);
+  if (w == workers.end())
+    return;
+  delete w->second.latency;
+  workers.erase(w);
+
+  boost::unordered_map<int, dispatch_metrics_t>::iterator d =
+    dispatches.begin();
+  while (d != dispatches.end()) {
+    if (d->second.worker == worker)
+      d = dispatches.erase(d);
+    else
+      d++;
+  }
+}
+
+static void append(std::string* out, const char* format, ...)
+  __attribute__((format(printf, 2, 3)));
+
+static void append(std::string* out, const char* format, ...) {
+  char line[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  *out += line;
+}
+
+// 'labels' is the inside of the braces, e.g. cmd="countprimes".
+static void append_histogram(std::string* out, const char* name,
+                             const char* labels, const HdrHistogram& h) {
+  for (int i = 0; i < NUM_QUANTILES; i++) {
+    append(out, "%s{%s,quantile=\"%g\"} %llu\n", name, labels,
+           QUANTILES[i] / 100, (unsigned long long)h.percentile(QUANTILES[i]));
+  }
+  append(out, "%s_max{%s} %llu\n", name, labels,
+         (unsigned long long)h.max());
+  append(out, "%s_count{%s} %llu\n", name, labels,
+         (unsigned long long)h.count());
+}
+
+std::string metrics_report() {
+  double now = CycleTimer::currentSeconds();
+  std::string out;
+
+  double throughput = 0;
+  for (int cmd = 0; cmd < MAX_STATS_CMDS; cmd++) {
+    throughput += rate_of(rates[cmd], now);
+  }
+
+  append(&out, "asst4_uptime_seconds %.3f\n", now - start_time);
+  append(&out, "asst4_requests_in_flight %d\n", (int)requests.size());
+  append(&out, "asst4_workers %d\n", (int)workers.size());
+  append(&out, "asst4_throughput_per_second %.3f\n", throughput);
+
+  for (int cmd = 0; cmd < MAX_STATS_CMDS; cmd++) {
+    if (latency[cmd].count() == 0)
+      continue;
+
+    char labels[64];
+    snprintf(labels, sizeof(labels), "cmd=\"%s\"", stats_cmd_name(cmd));
+    append(&out, "asst4_throughput_per_second{%s} %.3f\n", labels,
+           rate_of(rates[cmd], now));
+    append_histogram(&out, "asst4_latency_us", labels, latency[cmd]);
+    append_histogram(&out, "asst4_queue_wait_us", labels, queue_wait[cmd]);
+  }
+
+  boost::unordered_map<void*, worker_metrics_t>::iterator w;
+  for (w = workers.begin(); w != workers.end(); w++) {
+    char labels[64];
+    snprintf(labels, sizeof(labels), "worker=\"%d\"", w->second.tag);
+    append(&out, "asst4_worker_outstanding{%s} %d\n", labels,
+           w->second.outstanding);
+    append_histogram(&out, "asst4_worker_latency_us", labels,
+                     *w->second.latency);
+  }
+  return out;
+}
@@ -0,0 +1,34 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef MASTER_METRICS_H_
+#define MASTER_METRICS_H_
+
+#include <string>
+
+#include "server/messages.h"
+
+// Always-on latency accounting behind the master's METRICS message.
+// Per command it keeps HDR histograms of end-to-end latency (arrival to
+// answer) and of queue wait (arrival to dispatch), and per worker one
+// of the time from dispatch to response. Requests are keyed by their
+// Client_handle, dispatches by the tag of the work sent.
+
+void metrics_request(void* client, const Request_msg& req);
+
+// A copy_of other than 0 names the tag of an earlier dispatch of the
+// same request; queue wait is counted to that first dispatch.
+void metrics_dispatched(void* worker, int tag, int copy_of);
+void metrics_responded(void* worker, int tag);
+void metrics_answered(void* client, int tag);
+
+// The response tagged 'tag' has been handled.
+void metrics_forget(int tag);
+
+void metrics_worker_online(void* worker, int tag);
+void metrics_worker_gone(void* worker);
+
+// The current numbers in the Prometheus text format: one
+// "name{labels} value" line each.
+std::string metrics_report();
+
+#endif  // MASTER_METRICS_H_
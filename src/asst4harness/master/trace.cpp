@@ -0,0 +1,167 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <boost/unordered_map.hpp>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "master/trace.h"
+#include "tools/cycle_timer.h"
+
+DEFINE_string(trace_file, "",
+              "Write a Chrome trace event file of every request's hops "
+              "(empty for none).");
+
+typedef struct {
+  double received;
+  int id;
+  std::string cmd;
+} request_trace_t;
+
+typedef struct {
+  double dispatched;
+  double responded;
+  trace_hops_t worker;
+} dispatch_trace_t;
+
+static FILE* trace_out = NULL;
+static double origin;
+static int next_id = 0;
+
+static boost::unordered_map<void*, request_trace_t> requests;
+static boost::unordered_map<int, dispatch_trace_t> dispatches;
+
+void master_trace_init() {
+  if (FLAGS_trace_file.empty())
+    return;
+
+  trace_out = fopen(FLAGS_trace_file.c_str(), "w");
+  PCHECK(trace_out != NULL) << "Could not open " << FLAGS_trace_file;
+
+  // The array format lets the closing ']' be left off, so the file can
+  // be loaded whenever the master stops.
+  origin = CycleTimer::currentSeconds();
+  fprintf(trace_out, "[\n");
+  fflush(trace_out);
+}
+
+bool master_tracing() {
+  return trace_out != NULL;
+}
+
+void master_trace_request(void* client, const Request_msg& req) {
+  if (trace_out == NULL)
+    return;
+
+  request_trace_t& r = requests[client];
+  r.received = CycleTimer::currentSeconds();
+  r.id = next_id++;
+  r.cmd = req.get_arg("cmd");
+
+  // It goes into the JSON as is.
+  for (size_t i = 0; i < r.cmd.size(); i++) {
+    if (r.cmd[i] == '"' || r.cmd[i] == '\\' || r.cmd[i] < ' ')
+      r.cmd[i] = '_';
+  }
+}
+
+void master_trace_dispatched(int tag) {
+  if (trace_out == NULL)
+    return;
+
+  dispatch_trace_t& d = dispatches[tag];
+  memset(&d, 0, sizeof(d));
+  d.dispatched = CycleTimer::currentSeconds();
+}
+
+void master_trace_worker_hops(int tag, const trace_hops_t& hops) {
+  if (trace_out == NULL)
+    return;
+
+  boost::unordered_map<int, dispatch_trace_t>::iterator it =
+    dispatches.find(tag);
+  if (it != dispatches.end())
+    it->second.worker = hops;
+}
+
+void master_trace_responded(int tag) {
+  if (trace_out == NULL)
+    return;
+
+  boost::unordered_map<int, dispatch_trace_t>::iterator it =
+    dispatches.find(tag);
+  if (it != dispatches.end())
+    it->second.responded = CycleTimer::currentSeconds();
+}
+
+void master_trace_forget(int tag) {
+  if (trace_out != NULL)
+    dispatches.erase(tag);
+}
+
+// Writes one complete ("X") event on the request's row, skipping hops
+// that were not seen.
+static void emit(const request_trace_t& r, const char* name,
+                 double start, double end) {
+  if (start == 0 || end == 0)
+    return;
+  double dur = end > start ? end - start : 0;
+  fprintf(trace_out,
+          "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,"
+          "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+          name, r.cmd.c_str(), r.id, 1e6 * (start - origin), 1e6 * dur);
+}
+
+void master_trace_answered(void* client, int tag) {
+  if (trace_out == NULL)
+    return;
+
+  boost::unordered_map<void*, request_trace_t>::iterator it =
+    requests.find(client);
+  if (it == requests.end())
+    return;
+  const request_trace_t& r = it->second;
+  double answered = CycleTimer::currentSeconds();
+
+  fprintf(trace_out,
+          "{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":0,"
+          "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"worker_tag\":%d}},\n",
+          r.cmd.c_str(), r.id, 1e6 * (r.received - origin),
+          1e6 * (answered - r.received), tag);
+
+  boost::unordered_map<int, dispatch_trace_t>::iterator d =
+    dispatches.find(tag);
+  if (d != dispatches.end()) {
+    const dispatch_trace_t& t = d->second;
+    trace_hops_t w = t.worker;
+
+    // CycleTimer agrees across processes on one host, so worker times
+    // are used as they are unless they fall outside the round trip that
+    // contains them. Then the worker is on another clock, and we shift
+    // it to split the network time evenly between the two directions.
+    if (w.received != 0 && w.sent != 0 && t.responded != 0 &&
+        (w.received < t.dispatched || w.sent > t.responded)) {
+      double offset = ((t.dispatched + t.responded) -
+                       (w.received + w.sent)) / 2;
+      w.received += offset;
+      w.execute_start += w.execute_start != 0 ? offset : 0;
+      w.execute_end += w.execute_end != 0 ? offset : 0;
+      w.sent += offset;
+    }
+
+    emit(r, "master queue", r.received, t.dispatched);
+    emit(r, "to worker", t.dispatched, w.received);
+    emit(r, "worker queue", w.received, w.execute_start);
+    emit(r, "execute", w.execute_start, w.execute_end);
+    emit(r, "worker send", w.execute_end, w.sent);
+    emit(r, "to master", w.sent, t.responded);
+    emit(r, "master reply", t.responded, answered);
+    dispatches.erase(d);
+  }
+
+  fflush(trace_out);
+  requests.erase(it);
+}
@@ -0,0 +1,41 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef MASTER_TRACE_H_
+#define MASTER_TRACE_H_
+
+#include "server/messages.h"
+#include "types/types.h"
+
+// End-to-end request tracing for --trace_file. The harness stamps each
+// hop a request passes through in the master, workers send the hops
+// they saw in TRACE messages, and every answered request becomes a
+// group of events in the Chrome trace event format (load the file in
+// chrome://tracing or ui.perfetto.dev). Requests are keyed by their
+// Client_handle, dispatches by the tag of the request sent to the
+// worker. None of these do anything unless --trace_file is set.
+
+// Opens the trace file, if there is one.
+void master_trace_init();
+
+bool master_tracing();
+
+// A client request has arrived and is about to be handed to student
+// code as 'client'.
+void master_trace_request(void* client, const Request_msg& req);
+
+// Work tagged 'tag' is being sent to a worker.
+void master_trace_dispatched(int tag);
+
+// A worker's hops for 'tag', and the arrival of its response.
+void master_trace_worker_hops(int tag, const trace_hops_t& hops);
+void master_trace_responded(int tag);
+
+// Student code answered 'client' with the response tagged 'tag': writes
+// out the request's events.
+void master_trace_answered(void* client, int tag);
+
+// The response tagged 'tag' has been handled; drops whatever is left of
+// it, such as the losing copy of a hedged request.
+void master_trace_forget(int tag);
+
+#endif  // MASTER_TRACE_H_
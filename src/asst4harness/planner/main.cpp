@@ -0,0 +1,405 @@
+// Copyright 2013 15418 Course Staff
+
+// Capacity planner: works out how many workers, and how many compute
+// and disk slots on each, a trace needs to stay under a latency target,
+// and writes them as a --flagfile that the master and sim both read.
+//
+// The trace is cut into --window_s windows. In each window the compute
+// and disk classes are modeled as M/G/c queues, with c the slots of all
+// workers, arrivals at the window's rate, and service times from the
+// window's own requests as costed by --profile (bench --format=json
+// output) or the sim's --*_ms flags. A class's latency at the target
+// percentile is its queueing delay, from the Erlang C probability of
+// waiting with an Allen-Cunneen correction for the spread of service
+// times, plus the service time at that percentile. Slots beyond a
+// worker's cores or disks share them and slow every job down in
+// proportion. Short jobs, which the master sends outside the slots, are
+// costed with the rest of their class, compareprimes as one job, and
+// scaling lag is not modeled. Adding the queueing delay and service time
+// percentiles errs on the high side; run the printed sim command to
+// check a plan against the real policy.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "server/messages.h"
+#include "server/stats.h"
+#include "types/trace_file.h"
+
+DEFINE_double(target_ms, 2000, "Latency target for every class");
+DEFINE_double(percentile, 99, "Percentile of latency held to --target_ms");
+DEFINE_double(window_s, 10, "Length of the windows the trace is planned in");
+DEFINE_int32(max_plan_workers, 64, "Give up beyond this many workers");
+DEFINE_string(profile, "",
+              "Measured service times: the output of bench --format=json "
+              "kernels, overriding the --*_ms flags");
+DEFINE_string(output, "", "Write the plan here as a --flagfile");
+
+// Worker shape and costs, as in the simulator's flags of the same names.
+DEFINE_int32(cores, 2, "Cores per worker");
+DEFINE_int32(disk_channels, 1, "mostviewed jobs a worker's disk serves at full speed");
+DEFINE_double(wisdom_ms, 1050, "Service time of 418wisdom on one core");
+DEFINE_double(countprimes_ms_1m, 860,
+              "Service time of countprimes with n=1000000 on one core; other "
+              "n scale as n^1.5/ln(n)");
+DEFINE_double(mostviewed_ms, 1500, "Service time of mostviewed alone on a disk");
+DEFINE_double(highmem_ms, 400, "Service time of highmem on one core");
+DEFINE_double(minicompute_ms, 0, "Service time of minicompute on one core");
+DEFINE_double(cost_scale, 1.0, "Multiplies every service time");
+DEFINE_bool(result_cache, true, "Repeats of a request cost nothing");
+
+// A class's service times within one window.
+typedef struct {
+  std::vector<double> service_s;
+  double mean_s;
+  double scv;          // squared coefficient of variation
+  double percentile_s;
+} class_load_t;
+
+typedef struct {
+  double start_s;
+  class_load_t load[NUM_WORK_CLASSES];
+} window_t;
+
+// Slots per worker for each class, and the latency they give.
+typedef struct {
+  int slots;
+  double worst_s;  // highest latency over the windows
+} class_plan_t;
+
+static const char* const CLASS_NAMES[NUM_WORK_CLASSES] = { "compute", "disk" };
+
+static double countprimes_cost(int n) {
+  if (n < 3)
+    return 0;
+  return (pow(n, 1.5) / log(n)) / (pow(1e6, 1.5) / log(1e6));
+}
+
+static double service_seconds(const Request_msg& req) {
+  std::string cmd = req.get_arg("cmd");
+  double ms = 0;
+  if (cmd == "418wisdom") {
+    ms = FLAGS_wisdom_ms;
+  } else if (cmd == "countprimes") {
+    ms = FLAGS_countprimes_ms_1m * countprimes_cost(atoi(req.get_arg("n").c_str()));
+  } else if (cmd == "compareprimes") {
+    const char* args[] = { "n1", "n2", "n3", "n4" };
+    for (int i = 0; i < 4; i++) {
+      ms += FLAGS_countprimes_ms_1m *
+        countprimes_cost(atoi(req.get_arg(args[i]).c_str()));
+    }
+  } else if (cmd == "mostviewed") {
+    ms = FLAGS_mostviewed_ms;
+  } else if (cmd == "highmem") {
+    ms = FLAGS_highmem_ms;
+  } else if (cmd == "minicompute") {
+    ms = FLAGS_minicompute_ms;
+  }
+  return FLAGS_cost_scale * ms / 1000.0;
+}
+
+// Sets the cost flags from bench's kernel results: the mean of each
+// command's medians, with countprimes scaled to n=1000000.
+static void load_profile(const std::string& path) {
+  std::ifstream in(path.c_str());
+  CHECK(in) << "Could not read " << path;
+
+  std::map<std::string, std::vector<double> > samples;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::map<std::string, std::string> m;
+    if (!parse_json_members(line, &m) || m["unit"] != "ms")
+      continue;
+    double ms = atof(m["median"].c_str());
+    const std::string& cmd = m["benchmark"];
+    if (cmd == "countprimes") {
+      Request_msg req(0, "cmd=countprimes;" + m["params"]);
+      double cost = countprimes_cost(atoi(req.get_arg("n").c_str()));
+      if (cost <= 0)
+        continue;
+      ms /= cost;
+    }
+    samples[cmd].push_back(ms);
+  }
+
+  std::map<std::string, double*> flags;
+  flags["418wisdom"] = &FLAGS_wisdom_ms;
+  flags["countprimes"] = &FLAGS_countprimes_ms_1m;
+  flags["mostviewed"] = &FLAGS_mostviewed_ms;
+  flags["highmem"] = &FLAGS_highmem_ms;
+  flags["minicompute"] = &FLAGS_minicompute_ms;
+  std::map<std::string, double*>::iterator it;
+  for (it = flags.begin(); it != flags.end(); it++) {
+    const std::vector<double>& s = samples[it->first];
+    if (s.empty()) {
+      printf("profile         no %s results, using %.4g ms\n",
+             it->first.c_str(), *it->second);
+      continue;
+    }
+    double sum = 0;
+    for (size_t i = 0; i < s.size(); i++)
+      sum += s[i];
+    *it->second = sum / s.size();
+  }
+}
+
+static void summarize(class_load_t* load) {
+  std::vector<double>& s = load->service_s;
+  if (s.empty()) {
+    load->mean_s = load->scv = load->percentile_s = 0;
+    return;
+  }
+  double sum = 0;
+  double sum_squares = 0;
+  for (size_t i = 0; i < s.size(); i++) {
+    sum += s[i];
+    sum_squares += s[i] * s[i];
+  }
+  load->mean_s = sum / s.size();
+  double variance = sum_squares / s.size() - load->mean_s * load->mean_s;
+  load->scv = load->mean_s > 0 ? std::max(0.0, variance) /
+    (load->mean_s * load->mean_s) : 0;
+
+  std::vector<double> sorted(s);
+  size_t k = static_cast<size_t>(FLAGS_percentile / 100 * (sorted.size() - 1));
+  std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+  load->percentile_s = sorted[k];
+}
+
+static std::vector<window_t> build_windows(
+    const std::vector<trace_entry_t>& trace) {
+  std::vector<window_t> windows;
+  std::set<std::string> seen;
+  for (size_t i = 0; i < trace.size(); i++) {
+    Request_msg req(0, trace[i].work);
+    std::string cmd = req.get_arg("cmd");
+    if (cmd == "lastrequest")
+      continue;
+
+    size_t w = static_cast<size_t>(trace[i].time_ms / 1000.0 / FLAGS_window_s);
+    while (windows.size() <= w) {
+      window_t window;
+      window.start_s = windows.size() * FLAGS_window_s;
+      windows.push_back(window);
+    }
+
+    bool repeat = !seen.insert(trace[i].work).second;
+    double service = (FLAGS_result_cache && repeat) ? 0 : service_seconds(req);
+    int work_class = cmd == "mostviewed" ? WORK_CLASS_DISK : WORK_CLASS_CPU;
+    windows[w].load[work_class].service_s.push_back(service);
+  }
+  for (size_t w = 0; w < windows.size(); w++) {
+    for (int c = 0; c < NUM_WORK_CLASSES; c++)
+      summarize(&windows[w].load[c]);
+  }
+  return windows;
+}
+
+// Probability that an arrival waits in an M/M/c queue with offered load
+// 'a' (in servers), by the stable recursion for Erlang B.
+static double erlang_c(int servers, double a) {
+  double b = 1;
+  for (int k = 1; k <= servers; k++)
+    b = a * b / (k + a * b);
+  double rho = a / servers;
+  return b / (1 - rho * (1 - b));
+}
+
+// The class's latency at --percentile with 'servers' slots in all, each
+// job 'slowdown' times its service time; HUGE_VAL if it cannot keep up.
+static double class_latency(const class_load_t& load, int servers,
+                            double slowdown) {
+  int count = load.service_s.size();
+  if (count == 0)
+    return 0;
+  double lambda = count / FLAGS_window_s;
+  double es = load.mean_s * slowdown;
+  if (es <= 0)
+    return 0;
+  double a = lambda * es;
+  if (a >= servers)
+    return HUGE_VAL;
+
+  double tail = 1 - FLAGS_percentile / 100;
+  double wait_prob = erlang_c(servers, a);
+  double drain_rate = (servers / es - lambda) * 2 / (1 + load.scv);
+  double wait = wait_prob > tail ? log(wait_prob / tail) / drain_rate : 0;
+  return wait + load.percentile_s * slowdown;
+}
+
+// The best slots per worker for 'work_class' on 'workers' workers, each
+// with 'units' cores or disks.
+static class_plan_t plan_class(const std::vector<window_t>& windows,
+                               int work_class, int workers, int units) {
+  class_plan_t best;
+  best.slots = units;
+  best.worst_s = HUGE_VAL;
+  for (int slots = 1; slots <= 2 * units; slots++) {
+    double slowdown = std::max(1.0, static_cast<double>(slots) / units);
+    double worst = 0;
+    for (size_t w = 0; w < windows.size(); w++) {
+      worst = std::max(worst, class_latency(windows[w].load[work_class],
+                                            workers * slots, slowdown));
+    }
+    if (worst < best.worst_s) {
+      best.slots = slots;
+      best.worst_s = worst;
+    }
+  }
+  return best;
+}
+
+static int units_of(int work_class) {
+  return work_class == WORK_CLASS_DISK ? FLAGS_disk_channels : FLAGS_cores;
+}
+
+// The fewest workers that keep 'work_class' under the target, or 0.
+static int workers_for(const std::vector<window_t>& windows, int work_class) {
+  double target = FLAGS_target_ms / 1000.0;
+  for (int workers = 1; workers <= FLAGS_max_plan_workers; workers++) {
+    if (plan_class(windows, work_class, workers,
+                   units_of(work_class)).worst_s <= target)
+      return workers;
+  }
+  return 0;
+}
+
+static void print_windows(const std::vector<window_t>& windows,
+                          const class_plan_t* plan) {
+  printf("\n%9s", "window_s");
+  for (int c = 0; c < NUM_WORK_CLASSES; c++)
+    printf(" %9s_rps %7s_load", CLASS_NAMES[c], CLASS_NAMES[c]);
+  printf(" %8s\n", "workers");
+
+  double target = FLAGS_target_ms / 1000.0;
+  for (size_t w = 0; w < windows.size(); w++) {
+    int needed = 0;
+    printf("%9.0f", windows[w].start_s);
+    for (int c = 0; c < NUM_WORK_CLASSES; c++) {
+      const class_load_t& load = windows[w].load[c];
+      double rate = load.service_s.size() / FLAGS_window_s;
+      double slowdown = std::max(1.0, static_cast<double>(plan[c].slots) /
+                                 units_of(c));
+      // Busy slots, in workers.
+      double busy = rate * load.mean_s * slowdown / plan[c].slots;
+      printf(" %13.2f %12.2f", rate, busy);
+
+      int workers = 1;
+      while (workers < FLAGS_max_plan_workers &&
+             class_latency(load, workers * plan[c].slots, slowdown) > target)
+        workers++;
+      needed = std::max(needed, workers);
+    }
+    printf(" %8d\n", needed);
+  }
+}
+
+static std::string plan_flags(const std::string& trace_path, int workers,
+                              const class_plan_t* plan) {
+  char buf[1024];
+  snprintf(buf, sizeof(buf),
+           "# Capacity plan for %s: p%g under %.0f ms\n"
+           "--max_workers=%d\n"
+           "--worker_limit=%d\n"
+           "--cpu_slots=%d\n"
+           "--disk_slots=%d\n",
+           trace_path.c_str(), FLAGS_percentile, FLAGS_target_ms, workers,
+           workers, plan[WORK_CLASS_CPU].slots, plan[WORK_CLASS_DISK].slots);
+  return buf;
+}
+
+int main(int argc, char** argv) {
+
+  std::string usage("Usage: " + std::string(argv[0]) +
+                    " [options] <tracefile>\n");
+  usage += "  Plans the workers and slots the trace needs to meet a latency "
+    "target, as a --flagfile for the master and sim.";
+  google::SetUsageMessage(usage);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  if (argc != 2) {
+    fprintf(stderr, "Invalid number of arguments provided\n%s\n",
+            google::ProgramUsage());
+    exit(EXIT_FAILURE);
+  }
+  CHECK_GT(FLAGS_window_s, 0) << "--window_s must be positive";
+  CHECK(FLAGS_percentile > 0 && FLAGS_percentile < 100)
+    << "--percentile must be in (0, 100)";
+  CHECK(FLAGS_cores > 0 && FLAGS_disk_channels > 0)
+    << "--cores and --disk_channels must be positive";
+
+  std::vector<trace_entry_t> trace;
+  int bad_line;
+  if (!read_trace_file(argv[1], &trace, &bad_line)) {
+    if (bad_line == 0)
+      fprintf(stderr, "Could not read %s\n", argv[1]);
+    else
+      fprintf(stderr, "%s:%d: not a trace entry\n", argv[1], bad_line);
+    exit(EXIT_FAILURE);
+  }
+
+  if (!FLAGS_profile.empty())
+    load_profile(FLAGS_profile);
+  printf("costs (ms)      418wisdom %.4g, countprimes(1e6) %.4g, mostviewed "
+         "%.4g, highmem %.4g, minicompute %.4g\n", FLAGS_wisdom_ms,
+         FLAGS_countprimes_ms_1m, FLAGS_mostviewed_ms, FLAGS_highmem_ms,
+         FLAGS_minicompute_ms);
+
+  std::vector<window_t> windows = build_windows(trace);
+  CHECK(!windows.empty()) << "No requests in " << argv[1];
+
+  int workers = 1;
+  for (int c = 0; c < NUM_WORK_CLASSES; c++) {
+    int needed = workers_for(windows, c);
+    if (needed == 0) {
+      fprintf(stderr, "The %s class cannot meet p%g under %.0f ms with %d "
+              "workers\n", CLASS_NAMES[c], FLAGS_percentile, FLAGS_target_ms,
+              FLAGS_max_plan_workers);
+      exit(EXIT_FAILURE);
+    }
+    workers = std::max(workers, needed);
+  }
+
+  class_plan_t plan[NUM_WORK_CLASSES];
+  for (int c = 0; c < NUM_WORK_CLASSES; c++)
+    plan[c] = plan_class(windows, c, workers, units_of(c));
+
+  print_windows(windows, plan);
+  printf("\nplan            %d workers, %d compute and %d disk slots each\n",
+         workers, plan[WORK_CLASS_CPU].slots, plan[WORK_CLASS_DISK].slots);
+  for (int c = 0; c < NUM_WORK_CLASSES; c++) {
+    printf("  %-13s worst-window p%g %.0f ms\n", CLASS_NAMES[c],
+           FLAGS_percentile, 1000 * plan[c].worst_s);
+  }
+
+  std::string flags = plan_flags(argv[1], workers, plan);
+  if (FLAGS_output.empty()) {
+    printf("\n%s", flags.c_str());
+  } else {
+    FILE* out = fopen(FLAGS_output.c_str(), "w");
+    PCHECK(out != NULL) << "Could not open " << FLAGS_output;
+    fputs(flags.c_str(), out);
+    PCHECK(fclose(out) == 0) << "Could not write " << FLAGS_output;
+  }
+
+  printf("\nCheck it against the master's scaling policy with:\n"
+         "  ./sim --flagfile=%s --cores=%d --disk_channels=%d "
+         "--wisdom_ms=%.4g --countprimes_ms_1m=%.4g --mostviewed_ms=%.4g "
+         "--highmem_ms=%.4g --cost_scale=%g %s\n",
+         FLAGS_output.empty() ? "<plan>" : FLAGS_output.c_str(), FLAGS_cores,
+         FLAGS_disk_channels, FLAGS_wisdom_ms, FLAGS_countprimes_ms_1m,
+         FLAGS_mostviewed_ms, FLAGS_highmem_ms, FLAGS_cost_scale, argv[1]);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+// Copyright 2013 15418 Course Staff
+
+// The server program: master and worker node in one process, for
+// single-host deployments and benchmarks. The master runs its usual
+// event loop and clients connect to it as always, but the worker node
+// is a group of threads in this process, reached through in-memory
+// queues. There is no launcher, no worker process to boot and no
+// connection between master and worker.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "comm/connect.h"
+#include "comm/inproc.h"
+#include "server/master.h"
+
+void harness_begin_main_loop(struct timeval* tick_period);
+void inproc_node_start();
+
+int launcher_fd = -1;
+int accept_fd = -1;
+int local_accept_fd = -1;
+
+DEFINE_string(address, "localhost:15418", "What address to listen on.");
+DEFINE_bool(local_transport, true,
+            "Also listen on a Unix-domain socket for co-located clients.");
+DECLARE_bool(log_network);
+
+int main(int argc, char** argv) {
+  std::string usage("Usage: " + std::string(argv[0]) + " [options]\n");
+  usage += "  Runs a master and its worker node in one process.";
+  google::SetUsageMessage(usage);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  if (argc != 1) {
+    fprintf(stderr, "Invalid number of aruments provided\n%s\n",
+            google::ProgramUsage());
+    exit(EXIT_FAILURE);
+  }
+
+  accept_fd = listen_to(FLAGS_address.c_str());
+  CHECK_GE(accept_fd, 0) << "Could not listen on " << FLAGS_address;
+  DLOG_IF(INFO, FLAGS_log_network) << "Listening on " << FLAGS_address;
+
+  if (FLAGS_local_transport) {
+    char path[108];
+    local_socket_path(FLAGS_address.c_str(), path, sizeof(path));
+    local_accept_fd = listen_to_local(path);
+    LOG_IF(WARNING, local_accept_fd < 0) << "Could not listen on " << path;
+  }
+
+  inproc_channel_open();
+  inproc_node_start();
+
+  // student code. One process has room for one worker node.
+  int tick_seconds;
+  master_node_init(1, tick_seconds);
+
+  struct timeval tick_period;
+  tick_period.tv_sec = tick_seconds;
+  tick_period.tv_usec = 0;
+
+  harness_begin_main_loop(&tick_period);
+
+  return 0;
+}
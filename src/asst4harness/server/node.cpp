@@ -0,0 +1,120 @@
+// Copyright 2013 15418 Course Staff
+
+// The worker harness of the server program: what worker/main.cpp does
+// for a worker process, for the worker node running inside the
+// master's process. Messages come and go through the in-memory channel
+// of comm/inproc.h instead of a connection, and the node boots at once.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "comm/inproc.h"
+#include "server/messages.h"
+#include "server/worker.h"
+#include "tools/cycle_timer.h"
+#include "worker/cancel.h"
+#include "worker/stats.h"
+#include "worker/trace.h"
+
+extern void init_work_engine(bool forceFileIO, const std::string& assetsDir);
+
+DEFINE_int32(cpu_threads, 0,
+             "Number of compute threads to use (0 for one per core)");
+DEFINE_int32(memory_threads, 2, "Number of threads to use");
+DEFINE_int32(io_threads, 2, "Number of disk threads to use");
+DEFINE_int32(short_job_threads, 0,
+             "Compute threads kept for high-priority (short) requests");
+DEFINE_bool(short_job_threads_steal, false,
+            "Let the short-job threads run other requests when idle");
+DEFINE_bool(force_disk_io, false, "Force diskIO.");
+DEFINE_string(assets_dir, "/afs/cs/academic/class/15418-s13/public/data",
+              "Assets directory");
+
+static bool node_booted = false;
+
+static void node_handle_message(const inproc_message_t& m) {
+  inproc_message_t reply;
+  reply.tag = m.tag;
+  reply.req = NULL;
+
+  switch (m.message) {
+    case NEW_WORKER:
+      // The first start boots the node; after a kill it is still
+      // running, so it is simply back online.
+      if (!node_booted) {
+        init_work_engine(FLAGS_force_disk_io, FLAGS_assets_dir);
+        // student code
+        worker_node_init(*m.req);
+        node_booted = true;
+      }
+      reply.message = NEW_WORKER;
+      inproc_send_to_master(reply);
+      break;
+
+    case WORK:
+      trace_received(m.tag);
+      worker_stats_received(*m.req);
+      cancel_register(*m.req);
+      // student code
+      worker_handle_request(*m.req);
+      break;
+
+    case CANCEL:
+      cancel_request(m.tag);
+      break;
+
+    case TRACE:
+      trace_enable();
+      break;
+
+    case REQUEST_STATS:
+      reply.message = STATS;
+      worker_stats_fill(&reply.stats);
+      inproc_send_to_master(reply);
+      break;
+
+    default:
+      LOG(FATAL) << "Unexpected message " << m.message << " for the worker";
+  }
+}
+
+static void* node_main_loop(void*) {
+  for (;;) {
+    inproc_message_t m = inproc_node_receive();
+    node_handle_message(m);
+    delete m.req;
+  }
+  return NULL;
+}
+
+void inproc_node_start() {
+  if (FLAGS_cpu_threads <= 0) {
+    FLAGS_cpu_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  pthread_t thread;
+  CHECK_EQ(pthread_create(&thread, NULL, node_main_loop, NULL), 0)
+    << "Couldn't start the in-process worker node";
+}
+
+void worker_send_response(const Response_msg& resp) {
+  int tag = resp.get_tag();
+  worker_stats_responded(tag);
+  cancel_release(tag);
+
+  inproc_message_t m;
+  m.tag = tag;
+  m.req = NULL;
+  if (trace_enabled()) {
+    m.message = TRACE;
+    m.trace = trace_take(tag);
+    m.trace.sent = CycleTimer::currentSeconds();
+    inproc_send_to_master(m);
+  }
+  m.message = RESPONSE;
+  m.response = resp.get_response();
+  inproc_send_to_master(m);
+}
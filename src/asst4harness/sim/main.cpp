@@ -0,0 +1,451 @@
+// Copyright 2013 15418 Course Staff
+
+// Runs the student master (myserver/master.cpp) against simulated
+// workers on a virtual clock. This file is the harness side of
+// server/master.h: instead of sockets and worker processes there is a
+// queue of timed events, and the worker nodes are modeled by SimWorker.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <map>
+#include <queue>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "server/master.h"
+#include "server/messages.h"
+#include "server/stats.h"
+#include "sim/worker_model.h"
+#include "tools/cycle_timer.h"
+#include "tools/hdr_histogram.h"
+#include "types/trace_file.h"
+
+DEFINE_int32(max_workers, 3, "Maximum number of workers the master can request");
+DEFINE_double(boot_s, 5, "Time a requested worker takes to come online");
+DEFINE_double(net_ms, 0.1, "One-way delay of master-worker messages");
+DEFINE_int32(stats_period_ms, 1000,
+             "How often workers report load stats (0 for never)");
+DEFINE_int32(request_deadline_ms, 0,
+             "Time a worker may spend on a request before giving up on it "
+             "(0 for no limit)");
+DEFINE_int32(cache_snapshot_period_s, 10,
+             "How often new workers' warm cache is refreshed from the others");
+DEFINE_double(drain_s, 600,
+              "Give up this long after the last arrival if requests are "
+              "still unanswered");
+DEFINE_int32(seed, 1, "Seed for random(), which the master uses for tags");
+
+enum {
+  EVENT_ARRIVAL,     // a trace request reaches the master
+  EVENT_BOOTED,      // a requested worker is online
+  EVENT_WORK,        // WORK reaches a worker
+  EVENT_CANCEL,      // CANCEL reaches a worker
+  EVENT_DEADLINE,    // a request's deadline_ms runs out on its worker
+  EVENT_COMPLETION,  // a worker's next job finishes
+  EVENT_RESPONSE,    // a worker's response reaches the master
+  EVENT_TICK,
+  EVENT_STATS,
+  EVENT_SNAPSHOT     // workers write their result caches
+};
+
+struct sim_node_t;
+
+typedef struct {
+  double time;
+  long long seq;  // breaks ties in the order events were scheduled
+  int type;
+  sim_node_t* node;
+  int tag;        // trace index for arrivals
+  int version;    // completions: the node's version when scheduled
+  Request_msg* req;
+  std::string response;
+} event_t;
+
+struct event_later {
+  bool operator()(const event_t* a, const event_t* b) const {
+    return a->time > b->time || (a->time == b->time && a->seq > b->seq);
+  }
+};
+
+// A worker node, from request_new_worker_node() on. It is the Worker_handle.
+struct sim_node_t {
+  int tag;
+  SimWorker* worker;  // NULL until booted and after it is killed
+  bool killed;
+  int version;        // bumped whenever its next completion moves
+  double requested;
+  double ended;       // when it was killed, or 0
+};
+
+// A trace request. It is the Client_handle.
+typedef struct {
+  int index;
+  double arrived;
+  bool answered;
+} sim_client_t;
+
+static double now = 0;
+static long long next_seq = 0;
+static std::priority_queue<event_t*, std::vector<event_t*>, event_later> events;
+
+static std::vector<sim_node_t*> nodes;
+static std::set<std::string> cache_snapshot;
+static int tick_period;
+
+static std::vector<trace_entry_t> trace;
+static double trace_start = -1;
+static double last_arrival = 0;
+static double last_answer = 0;
+static int num_answered = 0;
+static int num_wrong = 0;
+static int num_stopped = 0;
+static int peak_workers = 0;
+
+static HdrHistogram all_latency;
+static HdrHistogram latency[MAX_STATS_CMDS];
+
+static event_t* schedule(double time, int type, sim_node_t* node = NULL) {
+  event_t* event = new event_t;
+  event->time = time;
+  event->seq = next_seq++;
+  event->type = type;
+  event->node = node;
+  event->tag = 0;
+  event->version = 0;
+  event->req = NULL;
+  events.push(event);
+  return event;
+}
+
+static int live_workers() {
+  int live = 0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (!nodes[i]->killed)
+      live++;
+  }
+  return live;
+}
+
+// Sends what 'node' has finished to the master, and moves its next
+// completion.
+static void deliver(sim_node_t* node, const std::vector<sim_response_t>& done) {
+  for (size_t i = 0; i < done.size(); i++) {
+    event_t* event = schedule(now + FLAGS_net_ms / 1000, EVENT_RESPONSE, node);
+    event->tag = done[i].tag;
+    event->response = done[i].response;
+  }
+
+  node->version++;
+  double next = node->worker->next_completion();
+  if (next >= 0) {
+    event_t* event = schedule(next > now ? next : now, EVENT_COMPLETION, node);
+    event->version = node->version;
+  }
+}
+
+/**
+ * Harness interface (server/master.h)
+ */
+
+void send_client_response(Client_handle client_handle, const Response_msg& resp) {
+  sim_client_t* client = reinterpret_cast<sim_client_t*>(client_handle);
+  CHECK(!client->answered) << "Request " << client->index
+                           << " answered twice";
+  client->answered = true;
+
+  const trace_entry_t& entry = trace[client->index];
+  const std::string& result = resp.get_response();
+  if (result == CANCELLED_RESPONSE || result == DEADLINE_EXCEEDED_RESPONSE) {
+    num_stopped++;
+  } else if (!entry.resp.empty() && result != entry.resp &&
+             Request_msg(0, entry.work).get_arg("cmd") != "mostviewed") {
+    // mostviewed answers depend on the data files, so are not checked.
+    LOG(WARNING) << "Wrong response to " << entry.work << ": " << result
+                 << " (expected " << entry.resp << ")";
+    num_wrong++;
+  }
+
+  uint64_t us = static_cast<uint64_t>(1e6 * (now - client->arrived));
+  all_latency.record(us);
+  latency[stats_cmd_index(Request_msg(0, entry.work).get_arg("cmd"))]
+    .record(us);
+  num_answered++;
+  last_answer = now;
+}
+
+void send_request_to_worker(Worker_handle worker_handle, const Request_msg& job) {
+  sim_node_t* node = reinterpret_cast<sim_node_t*>(worker_handle);
+  CHECK(node->worker != NULL) << "Attempt to send work to invalid worker";
+
+  event_t* event = schedule(now + FLAGS_net_ms / 1000, EVENT_WORK, node);
+  event->req = new Request_msg(job);
+  if (FLAGS_request_deadline_ms > 0 && job.get_arg("deadline_ms").empty()) {
+    char budget[32];
+    sprintf(budget, "%d", FLAGS_request_deadline_ms);
+    event->req->set_arg("deadline_ms", budget);
+  }
+}
+
+void cancel_worker_request(Worker_handle worker_handle, int tag) {
+  sim_node_t* node = reinterpret_cast<sim_node_t*>(worker_handle);
+  CHECK(node->worker != NULL) << "Attempt to cancel work on invalid worker";
+
+  event_t* event = schedule(now + FLAGS_net_ms / 1000, EVENT_CANCEL, node);
+  event->tag = tag;
+}
+
+bool client_is_connected(Client_handle client_handle) {
+  (void)client_handle;
+  return true;
+}
+
+void request_new_worker_node(const Request_msg& req) {
+  sim_node_t* node = new sim_node_t;
+  node->tag = req.get_tag();
+  node->worker = NULL;
+  node->killed = false;
+  node->version = 0;
+  node->requested = now;
+  node->ended = 0;
+  nodes.push_back(node);
+
+  int live = live_workers();
+  if (live > peak_workers)
+    peak_workers = live;
+  schedule(now + FLAGS_boot_s, EVENT_BOOTED, node);
+}
+
+void kill_worker_node(Worker_handle worker_handle) {
+  sim_node_t* node = reinterpret_cast<sim_node_t*>(worker_handle);
+  CHECK(node->worker != NULL) << "Attempt to kill non worker";
+
+  delete node->worker;
+  node->worker = NULL;
+  node->killed = true;
+  node->ended = now;
+}
+
+double master_current_time() {
+  return now;
+}
+
+// Clients start sending, at the trace's times, once the master says it
+// is ready.
+void server_init_complete() {
+  if (trace_start >= 0)
+    return;
+
+  trace_start = now;
+  for (size_t i = 0; i < trace.size(); i++) {
+    double time = now + trace[i].time_ms / 1000;
+    event_t* event = schedule(time, EVENT_ARRIVAL);
+    event->tag = i;
+    if (time > last_arrival)
+      last_arrival = time;
+  }
+}
+
+/**
+ * Event loop
+ */
+
+static void handle_event(event_t* event) {
+  sim_node_t* node = event->node;
+  std::vector<sim_response_t> done;
+
+  switch (event->type) {
+    case EVENT_ARRIVAL: {
+      sim_client_t* client = new sim_client_t;
+      client->index = event->tag;
+      client->arrived = now;
+      client->answered = false;
+      handle_client_request(client, Request_msg(0, trace[event->tag].work));
+      break;
+    }
+
+    case EVENT_BOOTED:
+      if (node->killed)
+        break;
+      node->worker = new SimWorker(node->tag, now, cache_snapshot);
+      handle_new_worker_online(node, node->tag);
+      break;
+
+    case EVENT_WORK: {
+      if (node->worker == NULL)
+        break;
+      node->worker->advance(now, &done);
+      node->worker->receive(now, *event->req);
+
+      std::string budget = event->req->get_arg("deadline_ms");
+      if (!budget.empty()) {
+        event_t* deadline = schedule(now + atof(budget.c_str()) / 1000,
+                                     EVENT_DEADLINE, node);
+        deadline->tag = event->req->get_tag();
+      }
+      deliver(node, done);
+      break;
+    }
+
+    case EVENT_CANCEL:
+    case EVENT_DEADLINE:
+      if (node->worker == NULL)
+        break;
+      node->worker->advance(now, &done);
+      node->worker->stop(now, event->tag,
+                         event->type == EVENT_CANCEL ?
+                         CANCELLED_RESPONSE : DEADLINE_EXCEEDED_RESPONSE,
+                         &done);
+      deliver(node, done);
+      break;
+
+    case EVENT_COMPLETION:
+      if (node->worker == NULL || event->version != node->version)
+        break;
+      node->worker->advance(now, &done);
+      deliver(node, done);
+      break;
+
+    case EVENT_RESPONSE: {
+      // Responses from a worker killed meanwhile are lost with its
+      // connection.
+      if (node->worker == NULL)
+        break;
+      Response_msg resp(event->tag);
+      resp.set_response(event->response);
+      handle_worker_response(node, resp);
+      break;
+    }
+
+    case EVENT_TICK:
+      handle_tick();
+      schedule(now + tick_period, EVENT_TICK);
+      break;
+
+    case EVENT_STATS:
+      for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i]->worker == NULL)
+          continue;
+        Worker_stats stats;
+        nodes[i]->worker->fill_stats(&stats);
+        handle_worker_stats(nodes[i], stats);
+      }
+      schedule(now + FLAGS_stats_period_ms / 1000.0, EVENT_STATS);
+      break;
+
+    case EVENT_SNAPSHOT:
+      for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i]->worker != NULL) {
+          const std::set<std::string>& cache = nodes[i]->worker->cache();
+          cache_snapshot.insert(cache.begin(), cache.end());
+        }
+      }
+      schedule(now + FLAGS_cache_snapshot_period_s, EVENT_SNAPSHOT);
+      break;
+  }
+}
+
+static void print_latency(const char* name, const HdrHistogram& h) {
+  printf("  %-14s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+         static_cast<unsigned long long>(h.count()),
+         h.percentile(50) / 1000.0, h.percentile(90) / 1000.0,
+         h.percentile(99) / 1000.0, h.percentile(99.9) / 1000.0,
+         h.max() / 1000.0);
+}
+
+static void print_report(const std::string& path, double wall_seconds) {
+  double end = last_answer;
+  double worker_seconds = 0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    double until = nodes[i]->killed ? nodes[i]->ended : end;
+    if (until > nodes[i]->requested)
+      worker_seconds += until - nodes[i]->requested;
+  }
+  double simulated = end - (trace_start > 0 ? trace_start : 0);
+
+  printf("\n");
+  printf("trace           %s (%d requests)\n", path.c_str(),
+         static_cast<int>(trace.size()));
+  printf("simulated       %.1f s in %.2f s of real time (%.0fx)\n",
+         simulated, wall_seconds,
+         wall_seconds > 0 ? simulated / wall_seconds : 0);
+  printf("answered        %d (%d wrong, %d cancelled or past deadline, "
+         "%d unanswered)\n", num_answered, num_wrong, num_stopped,
+         static_cast<int>(trace.size()) - num_answered);
+  printf("workers         %d requested, at most %d at once, "
+         "%.1f worker-seconds\n", static_cast<int>(nodes.size()),
+         peak_workers, worker_seconds);
+  printf("latency (ms)    %8s %10s %10s %10s %10s %10s\n", "count", "p50",
+         "p90", "p99", "p99.9", "max");
+  print_latency("all", all_latency);
+  for (int cmd = 0; cmd < MAX_STATS_CMDS; cmd++) {
+    if (latency[cmd].count() > 0)
+      print_latency(stats_cmd_name(cmd), latency[cmd]);
+  }
+}
+
+int main(int argc, char** argv) {
+
+  std::string usage("Usage: " + std::string(argv[0]) +
+                    " [options] <tracefile>\n");
+  usage += "  Replays a trace against myserver/master.cpp with simulated "
+    "workers, in virtual time.";
+  google::SetUsageMessage(usage);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  if (argc != 2) {
+    fprintf(stderr, "Invalid number of arguments provided\n%s\n",
+            google::ProgramUsage());
+    exit(EXIT_FAILURE);
+  }
+
+  int bad_line;
+  if (!read_trace_file(argv[1], &trace, &bad_line)) {
+    if (bad_line == 0)
+      fprintf(stderr, "Could not read %s\n", argv[1]);
+    else
+      fprintf(stderr, "%s:%d: not a trace entry\n", argv[1], bad_line);
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < trace.size(); i++) {
+    if (!trace[i].resp.empty())
+      sim_expect_response(sim_request_key(Request_msg(0, trace[i].work)),
+                          trace[i].resp);
+  }
+
+  srandom(FLAGS_seed);
+  double wall_start = CycleTimer::currentSeconds();
+
+  // student code
+  master_node_init(FLAGS_max_workers, tick_period);
+  CHECK_GT(tick_period, 0) << "Tick period must be positive";
+
+  schedule(tick_period, EVENT_TICK);
+  if (FLAGS_stats_period_ms > 0)
+    schedule(FLAGS_stats_period_ms / 1000.0, EVENT_STATS);
+  if (FLAGS_cache_snapshot_period_s > 0)
+    schedule(FLAGS_cache_snapshot_period_s, EVENT_SNAPSHOT);
+
+  while (!events.empty() &&
+         (trace_start < 0 || num_answered < static_cast<int>(trace.size()))) {
+    event_t* event = events.top();
+    events.pop();
+    now = event->time;
+    if (now > (trace_start >= 0 ? last_arrival : 0) + FLAGS_drain_s) {
+      LOG(WARNING) << (trace_start >= 0 ? "Giving up on unanswered requests"
+                       : "The master never became ready");
+      break;
+    }
+    handle_event(event);
+    delete event->req;
+    delete event;
+  }
+
+  print_report(argv[1], CycleTimer::currentSeconds() - wall_start);
+  return 0;
+}
@@ -0,0 +1,433 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <boost/unordered_map.hpp>
+#include <gflags/gflags.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+
+#include "sim/worker_model.h"
+#include "types/wire.h"
+
+DEFINE_int32(cores, 2, "Cores per simulated worker");
+DEFINE_int32(cpu_threads, 0,
+             "Compute threads per simulated worker (0 for one per core)");
+DEFINE_int32(io_threads, 2, "Disk threads per simulated worker");
+DEFINE_int32(short_job_threads, 0,
+             "Compute threads kept for high-priority (short) requests");
+DEFINE_int32(disk_channels, 1,
+             "mostviewed jobs a simulated worker's disk serves at full speed");
+DEFINE_double(wisdom_ms, 1050, "Service time of 418wisdom on one core");
+DEFINE_double(countprimes_ms_1m, 860,
+              "Service time of countprimes with n=1000000 on one core; other "
+              "n scale as n^1.5/ln(n)");
+DEFINE_double(mostviewed_ms, 1500, "Service time of mostviewed alone on a disk");
+DEFINE_double(highmem_ms, 400, "Service time of highmem on one core");
+DEFINE_double(cost_scale, 1.0, "Multiplies every service time");
+DEFINE_bool(result_cache, true,
+            "Model the worker result cache (repeats cost nothing)");
+
+// Weight of the newest sample in the running averages, as in the real
+// worker's reports.
+static const float STATS_EWMA_WEIGHT = 0.2f;
+
+// Jobs within this much work of done are done.
+static const double EPSILON_S = 1e-9;
+
+static boost::unordered_map<std::string, std::string> expected;
+
+struct SimWorker::Request {
+  int tag;
+  int cmd;
+  std::string key;
+  double received;
+  int pieces_left;
+  int counts[4];  // compareprimes' pieces
+  std::string response;
+};
+
+struct SimWorker::Job {
+  Request* request;
+  int piece;  // -1 for a whole request
+  std::string key;
+  double remaining;  // seconds of work at full speed
+  double started;
+  bool high;
+};
+
+static int cpu_threads() {
+  return FLAGS_cpu_threads > 0 ? FLAGS_cpu_threads : FLAGS_cores;
+}
+
+// Primes below n, as countprimes answers.
+static int count_primes(int n) {
+  static std::vector<bool> composite;
+  static std::map<int, int> counts;
+  if (n <= 2)
+    return 0;
+
+  std::map<int, int>::iterator memo = counts.find(n);
+  if (memo != counts.end())
+    return memo->second;
+
+  if ((int)composite.size() < n) {
+    size_t size = std::max((size_t)n, 2 * composite.size());
+    composite.assign(size, false);
+    for (size_t i = 2; i * i < size; i++) {
+      if (!composite[i]) {
+        for (size_t j = i * i; j < size; j += i)
+          composite[j] = true;
+      }
+    }
+  }
+
+  int count = 0;
+  for (int i = 2; i < n; i++) {
+    if (!composite[i])
+      count++;
+  }
+  counts[n] = count;
+  return count;
+}
+
+static double countprimes_seconds(int n) {
+  if (n < 3)
+    return 0;
+  double scale = pow(1e6, 1.5) / log(1e6);
+  return FLAGS_countprimes_ms_1m / 1000.0 * (pow(n, 1.5) / log(n)) / scale;
+}
+
+static double service_seconds(const Request_msg& req) {
+  std::string cmd = req.get_arg("cmd");
+  double seconds = 0;
+  if (cmd == "418wisdom")
+    seconds = FLAGS_wisdom_ms / 1000.0;
+  else if (cmd == "countprimes")
+    seconds = countprimes_seconds(atoi(req.get_arg("n").c_str()));
+  else if (cmd == "mostviewed")
+    seconds = FLAGS_mostviewed_ms / 1000.0;
+  else if (cmd == "highmem")
+    seconds = FLAGS_highmem_ms / 1000.0;
+  return FLAGS_cost_scale * seconds;
+}
+
+std::string sim_request_key(const Request_msg& req) {
+  static const char* const compareprimes_args[] = { "n1", "n2", "n3", "n4",
+                                                    NULL };
+  static const char* const countprimes_args[] = { "n", NULL };
+  static const char* const mostviewed_args[] = { "start", "end", NULL };
+  static const char* const x_args[] = { "x", NULL };
+  static const char* const no_args[] = { NULL };
+
+  std::string cmd = req.get_arg("cmd");
+  const char* const* args = no_args;
+  if (cmd == "compareprimes")
+    args = compareprimes_args;
+  else if (cmd == "countprimes")
+    args = countprimes_args;
+  else if (cmd == "mostviewed")
+    args = mostviewed_args;
+  else if (cmd == "418wisdom" || cmd == "minicompute")
+    args = x_args;
+
+  std::string key = "cmd=" + cmd;
+  for (int i = 0; args[i] != NULL; i++) {
+    key += std::string(";") + args[i] + "=" + req.get_arg(args[i]);
+  }
+  return key;
+}
+
+void sim_expect_response(const std::string& key, const std::string& response) {
+  expected[key] = response;
+}
+
+// What the real worker would answer, as far as we can tell without
+// doing the work.
+static std::string answer(const Request_msg& req, const std::string& key) {
+  boost::unordered_map<std::string, std::string>::iterator it =
+    expected.find(key);
+  if (it != expected.end())
+    return it->second;
+
+  char tmp_buffer[32];
+  std::string cmd = req.get_arg("cmd");
+  if (cmd == "countprimes") {
+    sprintf(tmp_buffer, "%d", count_primes(atoi(req.get_arg("n").c_str())));
+    return tmp_buffer;
+  } else if (cmd == "minicompute") {
+    int x = atoi(req.get_arg("x").c_str());
+    sprintf(tmp_buffer, "%d", x * x);
+    return tmp_buffer;
+  }
+  return "unknown command";
+}
+
+static void add_sample(float* average, double ms) {
+  if (*average == 0)
+    *average = ms;
+  else
+    *average += STATS_EWMA_WEIGHT * (ms - *average);
+}
+
+SimWorker::SimWorker(int tag, double now,
+                     const std::set<std::string>& warm_cache)
+  : worker_tag(tag), last_advance(now), high_running(0) {
+  if (FLAGS_result_cache)
+    results = warm_cache;
+  memset(completed, 0, sizeof(completed));
+  memset(service_ms, 0, sizeof(service_ms));
+  memset(latency_ms, 0, sizeof(latency_ms));
+}
+
+SimWorker::~SimWorker() {
+  std::vector<Job*> jobs(cpu_running.begin(), cpu_running.end());
+  jobs.insert(jobs.end(), disk_running.begin(), disk_running.end());
+  jobs.insert(jobs.end(), high_queue.begin(), high_queue.end());
+  jobs.insert(jobs.end(), cpu_queue.begin(), cpu_queue.end());
+  jobs.insert(jobs.end(), disk_queue.begin(), disk_queue.end());
+  for (size_t i = 0; i < jobs.size(); i++)
+    delete jobs[i];
+  for (size_t i = 0; i < requests.size(); i++)
+    delete requests[i];
+}
+
+void SimWorker::receive(double now, const Request_msg& req) {
+  Request* request = new Request;
+  request->tag = req.get_tag();
+  request->cmd = stats_cmd_index(req.get_arg("cmd"));
+  request->key = sim_request_key(req);
+  request->received = now;
+  request->response = answer(req, request->key);
+  requests.push_back(request);
+
+  bool disk = request->cmd == WIRE_CMD_MOSTVIEWED;
+  bool high = !disk && req.get_arg("priority") == "0";
+  std::deque<Job*>* queue = disk ? &disk_queue :
+    (high ? &high_queue : &cpu_queue);
+
+  std::vector<Request_msg> pieces;
+  if (req.get_arg("cmd") == "compareprimes") {
+    const char* names[4] = { "n1", "n2", "n3", "n4" };
+    for (int i = 0; i < 4; i++) {
+      Request_msg piece(req.get_tag());
+      piece.set_arg("cmd", "countprimes");
+      piece.set_arg("n", req.get_arg(names[i]));
+      pieces.push_back(piece);
+    }
+  } else {
+    pieces.push_back(req);
+  }
+
+  request->pieces_left = pieces.size();
+  for (size_t i = 0; i < pieces.size(); i++) {
+    Job* job = new Job;
+    job->request = request;
+    job->piece = pieces.size() > 1 ? i : -1;
+    job->key = job->piece < 0 ? request->key : sim_request_key(pieces[i]);
+    job->remaining = service_seconds(pieces[i]);
+    job->started = 0;
+    job->high = high;
+    if (job->piece >= 0)
+      request->counts[i] = count_primes(atoi(pieces[i].get_arg("n").c_str()));
+    queue->push_back(job);
+  }
+  start_jobs(now);
+}
+
+void SimWorker::start_jobs(double now) {
+  int threads = cpu_threads();
+  int general = threads - std::min(FLAGS_short_job_threads, threads - 1);
+
+  // Reserved threads only take high work; the rest take either, high
+  // first.
+  while ((int)cpu_running.size() < threads) {
+    Job* job = NULL;
+    if (!high_queue.empty()) {
+      job = high_queue.front();
+      high_queue.pop_front();
+      high_running++;
+    } else if (!cpu_queue.empty() &&
+               (int)cpu_running.size() - high_running < general) {
+      job = cpu_queue.front();
+      cpu_queue.pop_front();
+    } else {
+      break;
+    }
+    job->started = now;
+    if (FLAGS_result_cache && results.count(job->key))
+      job->remaining = 0;
+    cpu_running.push_back(job);
+  }
+
+  while ((int)disk_running.size() < FLAGS_io_threads && !disk_queue.empty()) {
+    Job* job = disk_queue.front();
+    disk_queue.pop_front();
+    job->started = now;
+    if (FLAGS_result_cache && results.count(job->key))
+      job->remaining = 0;
+    disk_running.push_back(job);
+  }
+}
+
+// Running jobs share the cores (or disks) equally.
+static double share(int capacity, size_t running) {
+  return running <= (size_t)capacity ? 1.0 : (double)capacity / running;
+}
+
+double SimWorker::next_completion() const {
+  double soonest = -1;
+  double cpu_rate = share(FLAGS_cores, cpu_running.size());
+  for (size_t i = 0; i < cpu_running.size(); i++) {
+    double t = cpu_running[i]->remaining / cpu_rate;
+    if (soonest < 0 || t < soonest)
+      soonest = t;
+  }
+  double disk_rate = share(FLAGS_disk_channels, disk_running.size());
+  for (size_t i = 0; i < disk_running.size(); i++) {
+    double t = disk_running[i]->remaining / disk_rate;
+    if (soonest < 0 || t < soonest)
+      soonest = t;
+  }
+  return soonest < 0 ? -1 : last_advance + soonest;
+}
+
+void SimWorker::advance(double now, std::vector<sim_response_t>* out) {
+  for (;;) {
+    double next = next_completion();
+    double until = (next >= 0 && next <= now) ? next : now;
+    double dt = until - last_advance;
+
+    double cpu_rate = share(FLAGS_cores, cpu_running.size());
+    double disk_rate = share(FLAGS_disk_channels, disk_running.size());
+    for (size_t i = 0; i < cpu_running.size(); i++)
+      cpu_running[i]->remaining -= dt * cpu_rate;
+    for (size_t i = 0; i < disk_running.size(); i++)
+      disk_running[i]->remaining -= dt * disk_rate;
+    last_advance = until;
+
+    if (until == now && (next < 0 || next > now))
+      return;
+
+    std::vector<Job*> done;
+    std::vector<Job*>* pools[2] = { &cpu_running, &disk_running };
+    for (int p = 0; p < 2; p++) {
+      std::vector<Job*>& running = *pools[p];
+      for (size_t i = 0; i < running.size(); ) {
+        if (running[i]->remaining <= EPSILON_S) {
+          done.push_back(running[i]);
+          running[i] = running.back();
+          running.pop_back();
+        } else {
+          i++;
+        }
+      }
+    }
+
+    for (size_t i = 0; i < done.size(); i++) {
+      Job* job = done[i];
+      Request* request = job->request;
+      if (job->high)
+        high_running--;
+      add_sample(&service_ms[request->cmd], 1000.0 * (until - job->started));
+      if (FLAGS_result_cache)
+        results.insert(job->key);
+
+      if (--request->pieces_left == 0) {
+        if (job->piece >= 0) {
+          const int* c = request->counts;
+          request->response = (c[1] - c[0] > c[3] - c[2]) ?
+            "There are more primes in first range." :
+            "There are more primes in second range.";
+        }
+        finish(until, request, request->response, out);
+      }
+      delete job;
+    }
+    start_jobs(until);
+  }
+}
+
+bool SimWorker::stop(double now, int tag, const char* response,
+                     std::vector<sim_response_t>* out) {
+  std::vector<Request*>::iterator it = requests.begin();
+  while (it != requests.end() && (*it)->tag != tag)
+    it++;
+  if (it == requests.end())
+    return false;
+  Request* request = *it;
+
+  std::deque<Job*>* queues[3] = { &high_queue, &cpu_queue, &disk_queue };
+  for (int q = 0; q < 3; q++) {
+    std::deque<Job*>& queue = *queues[q];
+    for (size_t i = 0; i < queue.size(); ) {
+      if (queue[i]->request == request) {
+        delete queue[i];
+        queue.erase(queue.begin() + i);
+      } else {
+        i++;
+      }
+    }
+  }
+
+  std::vector<Job*>* pools[2] = { &cpu_running, &disk_running };
+  for (int p = 0; p < 2; p++) {
+    std::vector<Job*>& running = *pools[p];
+    for (size_t i = 0; i < running.size(); ) {
+      if (running[i]->request == request) {
+        if (running[i]->high)
+          high_running--;
+        delete running[i];
+        running[i] = running.back();
+        running.pop_back();
+      } else {
+        i++;
+      }
+    }
+  }
+
+  finish(now, request, response, out);
+  start_jobs(now);
+  return true;
+}
+
+void SimWorker::finish(double now, Request* request,
+                       const std::string& response,
+                       std::vector<sim_response_t>* out) {
+  sim_response_t resp;
+  resp.tag = request->tag;
+  resp.response = response;
+  out->push_back(resp);
+
+  completed[request->cmd]++;
+  add_sample(&latency_ms[request->cmd], 1000.0 * (now - request->received));
+
+  requests.erase(std::find(requests.begin(), requests.end(), request));
+  delete request;
+}
+
+void SimWorker::fill_stats(Worker_stats* stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->cpu_threads = cpu_threads();
+  stats->memory_threads = 2;
+  stats->io_threads = FLAGS_io_threads;
+
+  for (size_t i = 0; i < requests.size(); i++) {
+    int work_class = requests[i]->cmd == WIRE_CMD_MOSTVIEWED ?
+      WORK_CLASS_DISK : WORK_CLASS_CPU;
+    stats->queue_depth[work_class]++;
+  }
+  stats->busy_threads[WORK_CLASS_CPU] = cpu_running.size();
+  stats->busy_threads[WORK_CLASS_DISK] = disk_running.size();
+
+  for (int i = 0; i < MAX_STATS_CMDS; i++) {
+    stats->completed[i] = completed[i];
+    stats->service_ms[i] = service_ms[i];
+    stats->latency_ms[i] = latency_ms[i];
+  }
+  memset(completed, 0, sizeof(completed));
+  stats->load_average = cpu_running.size();
+}
@@ -0,0 +1,96 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef SIM_WORKER_MODEL_H_
+#define SIM_WORKER_MODEL_H_
+
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "server/messages.h"
+#include "server/stats.h"
+
+// A worker node as the scheduler simulator sees it: no threads and no
+// real work, just queues and service times on a virtual clock.
+//
+// Compute jobs run on --cpu_threads threads that share --cores cores
+// equally, and mostviewed jobs on --io_threads threads sharing
+// --disk_channels disks. Requests marked priority=0 jump the compute
+// queue, compareprimes splits into its four countprimes like the
+// starter worker, and results are cached by request as the worker's
+// result cache does. How long each command takes is set by the
+// --*_ms flags.
+
+typedef struct {
+  int tag;
+  std::string response;
+} sim_response_t;
+
+// Canonical form of a request's command and the arguments its answer
+// depends on, e.g. "cmd=countprimes;n=100": the result cache key, and
+// how answers from the trace are looked up.
+std::string sim_request_key(const Request_msg& req);
+
+// Makes 'response' the answer to requests with this key.
+void sim_expect_response(const std::string& key, const std::string& response);
+
+class SimWorker {
+public:
+  SimWorker(int tag, double now, const std::set<std::string>& warm_cache);
+  ~SimWorker();
+
+  int tag() const { return worker_tag; }
+
+  // WORK from the master has arrived.
+  void receive(double now, const Request_msg& req);
+
+  // Stops the request tagged 'tag', if it is still here, answering it
+  // with 'response'. Returns whether it was.
+  bool stop(double now, int tag, const char* response,
+            std::vector<sim_response_t>* out);
+
+  // Runs the worker up to 'now', appending whatever finished.
+  void advance(double now, std::vector<sim_response_t>* out);
+
+  // When the next running job will finish, or a negative number if
+  // nothing is running.
+  double next_completion() const;
+
+  // A report as the real worker would send it. Completion counts
+  // restart from zero afterwards.
+  void fill_stats(Worker_stats* stats);
+
+  const std::set<std::string>& cache() const { return results; }
+
+private:
+  struct Request;
+  struct Job;
+
+  void start_jobs(double now);
+  void finish(double now, Request* request, const std::string& response,
+              std::vector<sim_response_t>* out);
+
+  int worker_tag;
+  double last_advance;
+
+  std::vector<Request*> requests;  // received and not yet answered
+  std::deque<Job*> high_queue;
+  std::deque<Job*> cpu_queue;
+  std::deque<Job*> disk_queue;
+  std::vector<Job*> cpu_running;
+  std::vector<Job*> disk_running;
+  int high_running;
+
+  std::set<std::string> results;
+
+  int completed[MAX_STATS_CMDS];
+  float service_ms[MAX_STATS_CMDS];
+  float latency_ms[MAX_STATS_CMDS];
+
+  // Not copyable.
+  SimWorker(const SimWorker&);
+  SimWorker& operator=(const SimWorker&);
+};
+
+#endif  // SIM_WORKER_MODEL_H_
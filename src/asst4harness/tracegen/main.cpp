@@ -0,0 +1,391 @@
+// Copyright 2013 15418 Course Staff
+
+// Synthesizes traces in the tests/*.txt format at realistic sizes, with
+// the expected answers computed by the worker's own execute_work().
+//
+// Arrivals are a Poisson process whose rate can follow a daily-style
+// ramp (--diurnal_period_s) and jump during flash crowds, when most
+// requests are for one hot item. Each command draws its arguments from
+// a fixed set of --keys items with Zipfian popularity, so a few items
+// account for most requests, as the result cache would see in real
+// traffic. Input sizes are log-uniform, which gives service times a
+// heavy tail.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "server/messages.h"
+#include "server/worker.h"
+
+extern void init_work_engine(bool forceFileIO, const std::string& assetsDir);
+
+DECLARE_string(cache_snapshot);
+
+DEFINE_double(duration_s, 60, "Length of the trace");
+DEFINE_double(rate, 10, "Mean requests per second outside flash crowds");
+DEFINE_double(diurnal_period_s, 0,
+              "Period of the rate's ramp, starting at its trough (0 for a "
+              "flat rate)");
+DEFINE_double(diurnal_amplitude, 0.8,
+              "How far the ramp swings the rate, as a fraction of --rate");
+DEFINE_int32(flash_crowds, 0, "Number of flash crowds at random times");
+DEFINE_double(flash_s, 5, "Length of a flash crowd");
+DEFINE_double(flash_factor, 10, "Rate multiplier during a flash crowd");
+DEFINE_double(flash_hot, 0.8,
+              "Fraction of flash crowd requests that are for its hot item");
+DEFINE_string(mix,
+              "418wisdom:1,countprimes:4,compareprimes:1,minicompute:4,"
+              "mostviewed:1,highmem:0.1",
+              "Commands to generate, as cmd:weight pairs");
+DEFINE_int32(keys, 1000, "Distinct items per command");
+DEFINE_double(zipf_s, 1.0,
+              "Zipf exponent of item popularity (0 for uniform)");
+DEFINE_int32(min_n, 1000, "Smallest countprimes and compareprimes input");
+DEFINE_int32(max_n, 1000000, "Largest countprimes and compareprimes input");
+DEFINE_int32(seed, 1, "Seed for arrival times and items");
+DEFINE_int32(threads, 0,
+             "Threads computing the expected answers (0 for one per core)");
+DEFINE_string(assets_dir, "/afs/cs/academic/class/15418-s13/public/data",
+              "Assets directory holding the mostviewed pageview files");
+
+// worker/stats.cpp reports a worker's thread counts. Here execute_work()
+// runs on tracegen's own threads.
+DEFINE_int32(cpu_threads, 1, "Unused by tracegen");
+DEFINE_int32(memory_threads, 1, "Unused by tracegen");
+DEFINE_int32(io_threads, 1, "Unused by tracegen");
+
+// The pageview files cover the spring 2013 semester.
+#define MOSTVIEWED_FIRST_DAY "2013-01-01"
+#define MOSTVIEWED_START_DAYS 80
+#define MOSTVIEWED_MAX_DAYS 60
+
+typedef struct {
+  std::string cmd;
+  double weight;
+  std::vector<std::string> items;  // request strings, most popular first
+} command_t;
+
+typedef struct {
+  double start;
+  double end;
+  const std::string* hot;
+} flash_crowd_t;
+
+typedef struct {
+  double time_s;
+  const std::string* work;
+} arrival_t;
+
+static std::vector<command_t> commands;
+static std::vector<double> item_cdf;  // Zipf CDF over item ranks
+static std::vector<flash_crowd_t> crowds;
+
+static double uniform() {
+  return (random() + 0.5) / (RAND_MAX + 1.0);
+}
+
+static int log_uniform(int lo, int hi) {
+  return static_cast<int>(exp(log(lo) + uniform() * (log(hi) - log(lo))));
+}
+
+static std::string date_after(const char* first, int days) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  CHECK(strptime(first, "%Y-%m-%d", &tm) != NULL);
+  tm.tm_mday += days;
+  tm.tm_hour = 12;
+  time_t t = timegm(&tm);
+  char buf[16];
+  strftime(buf, sizeof(buf), "%Y-%m-%d", gmtime_r(&t, &tm));
+  return buf;
+}
+
+// A random request for 'cmd', as the clients of tests/*.txt send them.
+static std::string make_item(const std::string& cmd, int key) {
+  char buf[256];
+  if (cmd == "418wisdom" || cmd == "minicompute") {
+    snprintf(buf, sizeof(buf), "cmd=%s;x=%d", cmd.c_str(),
+             1 + static_cast<int>(random() % 10000));
+  } else if (cmd == "countprimes") {
+    snprintf(buf, sizeof(buf), "cmd=countprimes;n=%d",
+             log_uniform(FLAGS_min_n, FLAGS_max_n));
+  } else if (cmd == "compareprimes") {
+    int n[4];
+    for (int i = 0; i < 4; i++)
+      n[i] = log_uniform(FLAGS_min_n, FLAGS_max_n);
+    std::sort(n, n + 2);
+    std::sort(n + 2, n + 4);
+    snprintf(buf, sizeof(buf), "cmd=compareprimes;n1=%d;n2=%d;n3=%d;n4=%d",
+             n[0], n[1], n[2], n[3]);
+  } else if (cmd == "mostviewed") {
+    int start = random() % MOSTVIEWED_START_DAYS;
+    int days = 1 + random() % MOSTVIEWED_MAX_DAYS;
+    snprintf(buf, sizeof(buf), "cmd=mostviewed;start=%s;end=%s",
+             date_after(MOSTVIEWED_FIRST_DAY, start).c_str(),
+             date_after(MOSTVIEWED_FIRST_DAY, start + days).c_str());
+  } else if (cmd == "highmem") {
+    snprintf(buf, sizeof(buf), "cmd=highmem;x=%d", key);
+  } else {
+    LOG(FATAL) << "Unknown command " << cmd << " in --mix";
+  }
+  return buf;
+}
+
+static void parse_mix() {
+  std::string mix = FLAGS_mix + ",";
+  size_t start = 0;
+  for (size_t comma; (comma = mix.find(',', start)) != std::string::npos;
+       start = comma + 1) {
+    std::string pair = mix.substr(start, comma - start);
+    if (pair.empty())
+      continue;
+    size_t colon = pair.find(':');
+    command_t c;
+    c.cmd = pair.substr(0, colon);
+    c.weight = colon == std::string::npos ? 1 : atof(pair.c_str() + colon + 1);
+    CHECK_GE(c.weight, 0) << "Negative weight in --mix for " << c.cmd;
+    if (c.weight > 0)
+      commands.push_back(c);
+  }
+  CHECK(!commands.empty()) << "--mix has no commands";
+}
+
+// highmem's work does not depend on its arguments, and every copy takes
+// 512 MB, so it gets a single item rather than --keys of them.
+static void make_items() {
+  CHECK_GT(FLAGS_keys, 0) << "--keys must be positive";
+  CHECK(FLAGS_min_n >= 2 && FLAGS_min_n <= FLAGS_max_n)
+    << "Need 2 <= --min_n <= --max_n";
+  for (size_t i = 0; i < commands.size(); i++) {
+    int keys = commands[i].cmd == "highmem" ? 1 : FLAGS_keys;
+    for (int key = 0; key < keys; key++)
+      commands[i].items.push_back(make_item(commands[i].cmd, key));
+  }
+
+  double total = 0;
+  for (int rank = 0; rank < FLAGS_keys; rank++) {
+    total += pow(rank + 1, -FLAGS_zipf_s);
+    item_cdf.push_back(total);
+  }
+  for (size_t i = 0; i < item_cdf.size(); i++)
+    item_cdf[i] /= total;
+}
+
+static const std::string* pick_request() {
+  double total = 0;
+  for (size_t i = 0; i < commands.size(); i++)
+    total += commands[i].weight;
+  double r = uniform() * total;
+  size_t c = 0;
+  while (c + 1 < commands.size() && r >= commands[c].weight) {
+    r -= commands[c].weight;
+    c++;
+  }
+
+  const std::vector<std::string>& items = commands[c].items;
+  size_t rank = std::lower_bound(item_cdf.begin(), item_cdf.end(), uniform()) -
+    item_cdf.begin();
+  return &items[std::min(rank, items.size() - 1)];
+}
+
+static const flash_crowd_t* crowd_at(double t) {
+  for (size_t i = 0; i < crowds.size(); i++) {
+    if (t >= crowds[i].start && t < crowds[i].end)
+      return &crowds[i];
+  }
+  return NULL;
+}
+
+static double rate_at(double t) {
+  double rate = FLAGS_rate;
+  if (FLAGS_diurnal_period_s > 0) {
+    rate *= 1 - FLAGS_diurnal_amplitude *
+      cos(2 * M_PI * t / FLAGS_diurnal_period_s);
+  }
+  if (crowd_at(t) != NULL)
+    rate *= FLAGS_flash_factor;
+  return rate;
+}
+
+// Draws arrivals from the time-varying rate by thinning a Poisson
+// process at the highest rate the trace ever reaches.
+static std::vector<arrival_t> make_arrivals() {
+  CHECK_GT(FLAGS_rate, 0) << "--rate must be positive";
+  CHECK(FLAGS_diurnal_amplitude >= 0 && FLAGS_diurnal_amplitude <= 1)
+    << "--diurnal_amplitude must be in [0, 1]";
+  CHECK_GE(FLAGS_flash_factor, 1) << "--flash_factor must be at least 1";
+
+  for (int i = 0; i < FLAGS_flash_crowds; i++) {
+    flash_crowd_t crowd;
+    crowd.start = uniform() * FLAGS_duration_s;
+    crowd.end = crowd.start + FLAGS_flash_s;
+    crowd.hot = pick_request();
+    crowds.push_back(crowd);
+  }
+
+  double max_rate = FLAGS_rate * (1 + FLAGS_diurnal_amplitude) *
+    FLAGS_flash_factor;
+  std::vector<arrival_t> arrivals;
+  for (double t = 0;;) {
+    t += -log(uniform()) / max_rate;
+    if (t >= FLAGS_duration_s)
+      break;
+    if (uniform() * max_rate > rate_at(t))
+      continue;
+
+    arrival_t a;
+    a.time_s = t;
+    const flash_crowd_t* crowd = crowd_at(t);
+    a.work = (crowd != NULL && uniform() < FLAGS_flash_hot) ?
+      crowd->hot : pick_request();
+    arrivals.push_back(a);
+  }
+  return arrivals;
+}
+
+// Expected answers, computed once per distinct request by a few threads.
+static std::map<std::string, std::string> answers;
+static std::vector<std::string> to_compute;
+static int next_to_compute = 0;
+static pthread_mutex_t highmem_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static std::string run(const std::string& work) {
+  Request_msg req(0, work);
+  Response_msg resp(0);
+  execute_work(req, resp);
+  return resp.get_response();
+}
+
+// What a correct worker answers; compareprimes is four countprimes, as
+// in myserver/worker.cpp.
+static std::string compute_answer(const std::string& work) {
+  Request_msg req(0, work);
+  std::string cmd = req.get_arg("cmd");
+  if (cmd == "compareprimes") {
+    int counts[4];
+    for (int i = 0; i < 4; i++) {
+      char arg[4];
+      snprintf(arg, sizeof(arg), "n%d", i + 1);
+      counts[i] = atoi(run("cmd=countprimes;n=" + req.get_arg(arg)).c_str());
+    }
+    return counts[1] - counts[0] > counts[3] - counts[2] ?
+      "There are more primes in first range." :
+      "There are more primes in second range.";
+  }
+  if (cmd == "highmem") {
+    // One 512 MB buffer at a time.
+    pthread_mutex_lock(&highmem_lock);
+    std::string answer = run(work);
+    pthread_mutex_unlock(&highmem_lock);
+    return answer;
+  }
+  return run(work);
+}
+
+static void* compute_answers(void*) {
+  for (;;) {
+    int i = __sync_fetch_and_add(&next_to_compute, 1);
+    if (i >= static_cast<int>(to_compute.size()))
+      return NULL;
+    std::string answer = compute_answer(to_compute[i]);
+    if (answer.find("Could not open") == 0) {
+      LOG(FATAL) << "No pageviews in " << FLAGS_assets_dir
+                 << ": set --assets_dir or leave mostviewed out of --mix";
+    }
+    answers.find(to_compute[i])->second = answer;
+  }
+}
+
+static void fill_answers(const std::vector<arrival_t>& arrivals) {
+  for (size_t i = 0; i < arrivals.size(); i++)
+    answers[*arrivals[i].work];
+
+  // The map is filled in now, so the threads only write existing values.
+  std::map<std::string, std::string>::iterator it;
+  for (it = answers.begin(); it != answers.end(); it++)
+    to_compute.push_back(it->first);
+
+  int threads = FLAGS_threads > 0 ? FLAGS_threads : sysconf(_SC_NPROCESSORS_ONLN);
+  std::vector<pthread_t> pool(threads);
+  for (int i = 0; i < threads; i++)
+    CHECK_EQ(pthread_create(&pool[i], NULL, compute_answers, NULL), 0);
+  for (int i = 0; i < threads; i++)
+    pthread_join(pool[i], NULL);
+}
+
+static std::string json_string(const std::string& s) {
+  std::string out = "\"";
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '"' || s[i] == '\\')
+      out += '\\';
+    out += s[i];
+  }
+  return out + "\"";
+}
+
+static void write_line(FILE* out, long long time_ms, const std::string& work,
+                       const std::string& resp) {
+  fprintf(out, "{\"time\": %lld, \"work\": %s, \"resp\": %s}\n", time_ms,
+          json_string(work).c_str(), json_string(resp).c_str());
+}
+
+int main(int argc, char** argv) {
+
+  std::string usage("Usage: " + std::string(argv[0]) +
+                    " [options] <tracefile>\n");
+  usage += "  Writes a synthetic trace, with expected answers, for "
+    "workgen.py, loadgen and sim.";
+  google::SetUsageMessage(usage);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  if (argc != 2) {
+    fprintf(stderr, "Invalid number of arguments provided\n%s\n",
+            google::ProgramUsage());
+    exit(EXIT_FAILURE);
+  }
+
+  srandom(FLAGS_seed);
+  parse_mix();
+  make_items();
+  std::vector<arrival_t> arrivals = make_arrivals();
+  CHECK(!arrivals.empty()) << "No requests in --duration_s at --rate";
+
+  // The result cache saves recounting compareprimes' ranges, but what
+  // tracegen computes stays out of the workers' shared snapshot.
+  FLAGS_cache_snapshot = "";
+  init_work_engine(false, FLAGS_assets_dir);
+  fill_answers(arrivals);
+
+  FILE* out = fopen(argv[1], "w");
+  PCHECK(out != NULL) << "Could not open " << argv[1];
+  std::map<std::string, int> per_cmd;
+  for (size_t i = 0; i < arrivals.size(); i++) {
+    const std::string& work = *arrivals[i].work;
+    write_line(out, llround(1000 * arrivals[i].time_s), work, answers[work]);
+    per_cmd[Request_msg(0, work).get_arg("cmd")]++;
+  }
+  write_line(out, llround(1000 * FLAGS_duration_s), "cmd=lastrequest", "ack");
+  PCHECK(fclose(out) == 0) << "Could not write " << argv[1];
+
+  printf("%s: %d requests (%d distinct) over %.1f s\n", argv[1],
+         static_cast<int>(arrivals.size()), static_cast<int>(answers.size()),
+         FLAGS_duration_s);
+  std::map<std::string, int>::iterator it;
+  for (it = per_cmd.begin(); it != per_cmd.end(); it++)
+    printf("  %-14s %8d\n", it->first.c_str(), it->second);
+  return EXIT_SUCCESS;
+}
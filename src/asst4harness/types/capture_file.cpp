@@ -0,0 +1,86 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "types/capture_file.h"
+
+typedef struct {
+  double arrival;
+  float latency_ms;
+  uint32_t work_len;
+  uint32_t resp_len;
+} __attribute__((packed)) capture_record_header_t;
+
+static const size_t MAGIC_LEN = sizeof(CAPTURE_MAGIC) - 1;
+
+bool capture_write_header(FILE* out) {
+  // Anything already in the file is an earlier capture to append to.
+  long end = fseek(out, 0, SEEK_END) == 0 ? ftell(out) : 0;
+  if (end > 0)
+    return true;
+  return fwrite(CAPTURE_MAGIC, 1, MAGIC_LEN, out) == MAGIC_LEN;
+}
+
+bool capture_write_record(FILE* out, const capture_record_t& record) {
+  capture_record_header_t header;
+  header.arrival = record.arrival;
+  header.latency_ms = record.latency_ms;
+  header.work_len = record.work.size();
+  header.resp_len = record.resp.size();
+  return fwrite(&header, sizeof(header), 1, out) == 1 &&
+    fwrite(record.work.data(), 1, header.work_len, out) == header.work_len &&
+    fwrite(record.resp.data(), 1, header.resp_len, out) == header.resp_len;
+}
+
+// Requests and responses are a few hundred bytes at most; anything
+// longer means the file is corrupt.
+static const uint32_t MAX_CAPTURE_STRING = 1 << 20;
+
+static bool read_string(FILE* in, uint32_t len, std::string* out) {
+  out->resize(len);
+  return len == 0 || fread(&(*out)[0], 1, len, in) == len;
+}
+
+bool read_capture_file(const std::string& path,
+                       std::vector<capture_record_t>* records,
+                       int* bad_record) {
+  *bad_record = 0;
+  FILE* in = fopen(path.c_str(), "rb");
+  if (in == NULL)
+    return false;
+
+  char magic[MAGIC_LEN];
+  struct stat st;
+  if (fread(magic, 1, MAGIC_LEN, in) != MAGIC_LEN ||
+      memcmp(magic, CAPTURE_MAGIC, MAGIC_LEN) != 0 ||
+      fstat(fileno(in), &st) < 0) {
+    fclose(in);
+    return false;
+  }
+
+  capture_record_header_t header;
+  capture_record_t record;
+  while (fread(&header, sizeof(header), 1, in) == 1) {
+    if (header.work_len > MAX_CAPTURE_STRING ||
+        header.resp_len > MAX_CAPTURE_STRING) {
+      *bad_record = records->size() + 1;
+      fclose(in);
+      return false;
+    }
+    // a record cut short ends the file
+    long left = st.st_size - ftell(in);
+    if (static_cast<long long>(header.work_len) + header.resp_len > left)
+      break;
+    if (!read_string(in, header.work_len, &record.work) ||
+        !read_string(in, header.resp_len, &record.resp))
+      break;
+    record.arrival = header.arrival;
+    record.latency_ms = header.latency_ms;
+    records->push_back(record);
+  }
+  fclose(in);
+  return true;
+}
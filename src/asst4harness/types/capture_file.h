@@ -0,0 +1,48 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef TYPES_CAPTURE_FILE_H_
+#define TYPES_CAPTURE_FILE_H_
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// A capture of real client traffic, as recorded by the master with
+// --capture_file and replayed by loadgen. The file is CAPTURE_MAGIC
+// followed by one record per answered request, appended in the order
+// the requests were answered:
+//
+//   f64 arrival      Unix time the request reached the master, seconds
+//   f32 latency_ms   arrival to answer, as the master measured it
+//   u32 work_len
+//   u32 resp_len
+//   work_len bytes   the request, e.g. "cmd=countprimes;n=100"
+//   resp_len bytes   the response
+//
+// Fields are in host byte order, like the rest of the protocol. Later
+// runs may append to the same file, and a record cut short by a crash
+// ends the file.
+
+#define CAPTURE_MAGIC "asst4capture 1\n"
+
+typedef struct {
+  double arrival;
+  float latency_ms;
+  std::string work;
+  std::string resp;
+} capture_record_t;
+
+// Writes the magic if 'out' is at the start of the file.
+bool capture_write_header(FILE* out);
+
+bool capture_write_record(FILE* out, const capture_record_t& record);
+
+// Reads every complete record. Returns false if the file cannot be read
+// or is not a capture, or, with '*bad_record' set to the 1-based number
+// of the record, if a record is corrupt.
+bool read_capture_file(const std::string& path,
+                       std::vector<capture_record_t>* records,
+                       int* bad_record);
+
+#endif  // TYPES_CAPTURE_FILE_H_
@@ -1,182 +1,257 @@
 // Copyright 2013 15418 Course Staff.
 
-#include <map>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
 #include <string>
-#include <sstream>
+#include <vector>
 
 #include "server/messages.h"
 #include "types/types.h"
 
+static const char* const WHITESPACE = " \t\n";
+
 /*
  * Trim --
  *
- * Returns the input string 'str' after removing leading and trailing
- * whitespace.
+ * Narrows [*begin, *end) to exclude leading and trailing whitespace.
  */
-std::string
-Trim(const std::string& str) {
-  size_t pos1 = str.find_first_not_of(" \t\n");
-  size_t pos2 = str.find_last_not_of(" \t\n");
-
-  if (pos1 == std::string::npos)
-    return "";
-  else if (pos2 == std::string::npos)
-    return str.substr(pos1);
-  else
-    return str.substr(pos1, pos2-pos1+1);
+static void
+Trim(const char** begin, const char** end) {
+  while (*begin < *end && strchr(WHITESPACE, **begin) != NULL)
+    (*begin)++;
+  while (*end > *begin && strchr(WHITESPACE, (*end)[-1]) != NULL)
+    (*end)--;
 }
 
 /*
  * ParseKeyValue --
  *
- * Parse the source string into a key-value pair, where '=' seperates
- * the key from the value.  Returns true if parsing is successful.
- * Return false if the source string 'str' is not a proper key-value
- * pair
+ * Splits the token [begin, end) into a key-value pair, where '='
+ * seperates the key from the value.  The resulting key and value point
+ * into the token.  Returns false if the token is not a proper key-value
+ * pair (no key, no value, or no '=').
  */
-bool
-ParseKeyValue(std::string& key, std::string& value, const std::string& str) {
-  size_t pos = str.find('=');
-
-  // invalid format if there's no key, no value, or no '='
-  if (pos == 0 ||
-      pos + 1 == str.size() ||
-      pos == std::string::npos) {
-    key = "";
-    value = "";
+static bool
+ParseKeyValue(Request_msg::Arg* arg, const char* begin, const char* end) {
+  const char* eq = static_cast<const char*>(memchr(begin, '=', end - begin));
+
+  if (eq == NULL || eq == begin || eq + 1 == end)
     return false;
-  }
 
-  key = Trim(str.substr(0, pos));
-  value = Trim(str.substr(pos+1));
+  const char* key_end = eq;
+  const char* value_begin = eq + 1;
+  Trim(&begin, &key_end);
+  Trim(&value_begin, &end);
+
+  arg->key = begin;
+  arg->key_len = key_end - begin;
+  arg->value = value_begin;
+  arg->value_len = end - value_begin;
+  arg->key_id = 0;
+  arg->int_value = 0;
   return true;
 }
 
-class StringTokenizer {
+static bool
+ArgLess(const Request_msg::Arg* a, const Request_msg::Arg* b) {
+  int n = std::min(a->key_len, b->key_len);
+  int cmp = memcmp(a->key, b->key, n);
+  return cmp < 0 || (cmp == 0 && a->key_len < b->key_len);
+}
 
-  public:
-  StringTokenizer(const std::string& str, const std::string& delimiters);
-  void Reset();
-  bool NoMoreTokens() const;
-  std::string NextToken();
 
-private:
-  std::string sourceStr;
-  std::string delimiters;
-  size_t curTokenStart;
-};
+Request_msg::Request_msg(int argTag)
+  : tag(argTag), args(NULL), num_args(0) {
+}
 
-/*
- * StringTokenizer constructor --
- *
- * Initializes tokenizer with source string 'str'. Valid token
- * delimiters are characters in the 'delimit'.
- */
-StringTokenizer::StringTokenizer(const std::string& str,
-                                 const std::string& delimit) {
-  sourceStr = str;
-  delimiters = delimit;
-  Reset();
+Request_msg::Request_msg(int argTag, const std::string& str)
+  : tag(argTag), args(NULL), num_args(0) {
+  frame_ptr src = alloc_frame(str.size());
+  memcpy(src->data(), str.data(), str.size());
+  parse_text(src, str.size());
 }
 
-/*
- * Reset --
- *
- * Resets the tokenizer.  Next call to NextToken() will return the
- * first token.
- */
-void
-StringTokenizer::Reset() {
-  curTokenStart = sourceStr.find_first_not_of(delimiters, 0);
+Request_msg::Request_msg(int arg_tag, const Request_msg& r)
+  : tag(arg_tag), frame(r.frame), args(r.args), num_args(r.num_args) {
+}
+
+Request_msg::Request_msg(const Request_msg& r)
+  : tag(r.tag), frame(r.frame), args(r.args), num_args(r.num_args) {
 }
 
 /*
- * NoMoreTokens --
+ * reserve_args --
  *
- * Returns true if there are no more tokens in the string.  False
- * otherwise.
+ * Makes '*frame' hold its first 'len' bytes, followed by 'extra' bytes of
+ * scratch space and then room for 'max_args' Args, moving the contents to
+ * a new frame if the current one is too small.  The bytes past 'len' must
+ * not be in use by anyone else.  Returns the (empty) Arg array.
  */
-bool
-StringTokenizer::NoMoreTokens() const {
-  return (curTokenStart == std::string::npos);
+Request_msg::Arg*
+Request_msg::reserve_args(frame_ptr* frame, int len, int extra, int max_args) {
+  const int align = sizeof(void*);
+  int index_offset = (len + extra + align - 1) / align * align;
+  int needed = index_offset + max_args * sizeof(Arg);
+
+  if (!*frame || (*frame)->capacity() < needed) {
+    frame_ptr bigger = alloc_frame(needed);
+    if (*frame) {
+      memcpy(bigger->data(), (*frame)->data(), len);
+    }
+    *frame = bigger;
+  }
+
+  return reinterpret_cast<Arg*>((*frame)->data() + index_offset);
 }
 
 /*
- * NextToken --
+ * parse_text --
  *
- * Returns the next token in the string.  The current implementation
- * skips over empty tokens (adjacent delimiter characters in the
- * string will not cause NextToken to return an empty string as a
- * valid token).
+ * Parses the "key=value;key=value" text in the first 'len' bytes of
+ * 'src' in place: the arguments end up pointing into the frame rather
+ * than being copied out of it.  Later duplicates of a key win.
  */
-std::string
-StringTokenizer::NextToken() {
-  size_t tokenStart = curTokenStart;
-  size_t tokenEnd = sourceStr.find_first_of(delimiters, curTokenStart);
+void
+Request_msg::parse_text(const frame_ptr& src, int len) {
+  frame_ptr dst = src;
+  int max_args = 1 + std::count(src->data(), src->data() + len, ';');
+  Arg* out = reserve_args(&dst, len, 0, max_args);
 
-  curTokenStart = sourceStr.find_first_not_of(delimiters, tokenEnd);
+  const char* p = dst->data();
+  const char* end = p + len;
+  int n = 0;
 
-  if (tokenStart == std::string::npos)
-    return "";
-  else if (tokenEnd == std::string::npos)
-    return sourceStr.substr(tokenStart);
-  else
-    return sourceStr.substr(tokenStart, tokenEnd - tokenStart);
-}
+  while (p < end) {
+    const char* token_end = static_cast<const char*>(memchr(p, ';', end - p));
+    if (token_end == NULL)
+      token_end = end;
 
+    Arg arg;
+    if (token_end != p && ParseKeyValue(&arg, p, token_end) &&
+        arg.key_len != 0) {
+      int i;
+      for (i = 0; i < n; i++) {
+        if (out[i].key_len == arg.key_len &&
+            memcmp(out[i].key, arg.key, arg.key_len) == 0)
+          break;
+      }
+      out[i] = arg;
+      if (i == n)
+        n++;
+    }
 
-Request_msg::Request_msg(int argTag) {
-  tag = argTag;
-}
-
-Request_msg::Request_msg(int argTag, const std::string& str) {
-  tag = argTag;
-  StringTokenizer tok(str, ";");
-  while (!tok.NoMoreTokens()) {
-    std::string str = tok.NextToken();
-    std::string key;
-    std::string value;
-    ParseKeyValue(key, value, str);
-    if (key.size() != 0)
-      dict[key] = value;
+    p = token_end + 1;
   }
-}
 
+  frame = dst;
+  args = out;
+  num_args = n;
+}
 
-Request_msg::Request_msg(int arg_tag, const Request_msg& r) {
-  tag = arg_tag;
-  dict = r.dict;
+/*
+ * format_int --
+ *
+ * Prints the integer value of 'arg' into 'buf', which must hold
+ * INT_TEXT_SIZE bytes, and returns its length.
+ */
+int
+Request_msg::format_int(const Arg& arg, char* buf) {
+  return snprintf(buf, INT_TEXT_SIZE, "%d", arg.int_value);
 }
 
-Request_msg::Request_msg(const Request_msg& r) {
-  tag = r.tag;
-  dict = r.dict;
+const Request_msg::Arg*
+Request_msg::find_arg(const char* name, int name_len) const {
+  for (int i = 0; i < num_args; i++) {
+    if (args[i].key_len == name_len &&
+        memcmp(args[i].key, name, name_len) == 0)
+      return &args[i];
+  }
+  return NULL;
 }
 
 void Request_msg::set_arg(const std::string& key, const std::string& value) {
-  dict[key] = value;
+
+  // Other handles may share our frame, so copy every argument we keep
+  // into a fresh one along with the new pair.
+  const Arg* replaced = find_arg(key.data(), key.size());
+  int bytes = key.size() + value.size();
+  for (int i = 0; i < num_args; i++) {
+    if (&args[i] != replaced)
+      bytes += args[i].key_len + args[i].value_len;
+  }
+
+  frame_ptr dst;
+  Arg* out = reserve_args(&dst, 0, bytes, num_args + 1);
+  char* p = dst->data();
+  int n = 0;
+
+  // Integers stay typed; only text is copied.
+  for (int i = 0; i < num_args; i++) {
+    if (&args[i] == replaced)
+      continue;
+    out[n] = args[i];
+    out[n].key = p;
+    memcpy(p, args[i].key, args[i].key_len);
+    p += args[i].key_len;
+    if (args[i].value != NULL) {
+      out[n].value = p;
+      memcpy(p, args[i].value, args[i].value_len);
+      p += args[i].value_len;
+    }
+    n++;
+  }
+
+  out[n].key = p;
+  out[n].key_len = key.size();
+  memcpy(p, key.data(), key.size());
+  p += key.size();
+  out[n].value = p;
+  out[n].value_len = value.size();
+  memcpy(p, value.data(), value.size());
+  out[n].key_id = 0;
+  out[n].int_value = 0;
+  n++;
+
+  frame = dst;
+  args = out;
+  num_args = n;
 }
 
 std::string Request_msg::get_arg(const std::string& name) const {
-  std::map<std::string, std::string>::const_iterator it = dict.find(name);
-  if (it == dict.end())
+  const Arg* arg = find_arg(name.data(), name.size());
+  if (arg == NULL)
     return "";
-  else
-    return it->second;
+  if (arg->value == NULL) {
+    char buf[INT_TEXT_SIZE];
+    return std::string(buf, format_int(*arg, buf));
+  }
+  return std::string(arg->value, arg->value_len);
 }
 
 std::string Request_msg::get_request_string() const {
 
-  // serialize dict
+  // serialize dict, in key order
+
+  std::vector<const Arg*> sorted(num_args);
+  for (int i = 0; i < num_args; i++)
+    sorted[i] = &args[i];
+  std::sort(sorted.begin(), sorted.end(), ArgLess);
 
-  bool first = true;
-  std::ostringstream oss;
-  for (std::map<std::string, std::string>::const_iterator it = dict.begin(); it != dict.end(); it++) {
-    if (!first)
-      oss << ";";
-    oss << it->first << "=" << it->second;
-    first = false;
+  std::string str;
+  for (int i = 0; i < num_args; i++) {
+    if (i != 0)
+      str += ';';
+    str.append(sorted[i]->key, sorted[i]->key_len);
+    str += '=';
+    if (sorted[i]->value == NULL) {
+      char buf[INT_TEXT_SIZE];
+      str.append(buf, format_int(*sorted[i], buf));
+    } else {
+      str.append(sorted[i]->value, sorted[i]->value_len);
+    }
   }
 
-  return oss.str();
+  return str;
 }
@@ -0,0 +1,192 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+
+#include "types/trace_file.h"
+
+// Just enough JSON for traces and bench results: a flat object of
+// string and number members. Unknown members are skipped.
+
+static void skip_space(const std::string& s, size_t* pos) {
+  while (*pos < s.size() && isspace(static_cast<unsigned char>(s[*pos])))
+    (*pos)++;
+}
+
+static bool parse_string(const std::string& s, size_t* pos, std::string* out) {
+  if (*pos >= s.size() || s[*pos] != '"')
+    return false;
+  out->clear();
+  for (size_t i = *pos + 1; i < s.size(); i++) {
+    char c = s[i];
+    if (c == '"') {
+      *pos = i + 1;
+      return true;
+    }
+    if (c != '\\') {
+      *out += c;
+      continue;
+    }
+    if (++i >= s.size())
+      return false;
+    switch (s[i]) {
+      case 'n': *out += '\n'; break;
+      case 't': *out += '\t'; break;
+      case 'r': *out += '\r'; break;
+      case 'b': *out += '\b'; break;
+      case 'f': *out += '\f'; break;
+      case 'u': {
+        // Traces are ASCII; anything else is kept as UTF-8.
+        if (i + 4 >= s.size())
+          return false;
+        unsigned code = strtoul(s.substr(i + 1, 4).c_str(), NULL, 16);
+        i += 4;
+        if (code < 0x80) {
+          *out += static_cast<char>(code);
+        } else if (code < 0x800) {
+          *out += static_cast<char>(0xc0 | (code >> 6));
+          *out += static_cast<char>(0x80 | (code & 0x3f));
+        } else {
+          *out += static_cast<char>(0xe0 | (code >> 12));
+          *out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+          *out += static_cast<char>(0x80 | (code & 0x3f));
+        }
+        break;
+      }
+      default: *out += s[i]; break;  // '"', '\\' and '/'
+    }
+  }
+  return false;
+}
+
+typedef struct {
+  std::string name;
+  std::string value;  // numbers as written
+  bool is_string;
+} json_member_t;
+
+static bool parse_object(const std::string& line,
+                         std::vector<json_member_t>* members) {
+  size_t pos = 0;
+  skip_space(line, &pos);
+  if (pos >= line.size() || line[pos++] != '{')
+    return false;
+
+  for (;;) {
+    skip_space(line, &pos);
+    if (pos < line.size() && line[pos] == '}')
+      return true;
+
+    json_member_t member;
+    if (!parse_string(line, &pos, &member.name))
+      return false;
+    skip_space(line, &pos);
+    if (pos >= line.size() || line[pos++] != ':')
+      return false;
+    skip_space(line, &pos);
+
+    member.is_string = pos < line.size() && line[pos] == '"';
+    if (member.is_string) {
+      if (!parse_string(line, &pos, &member.value))
+        return false;
+    } else {
+      const char* start = line.c_str() + pos;
+      char* end;
+      strtod(start, &end);
+      if (end == start)
+        return false;
+      member.value.assign(start, end - start);
+      pos += end - start;
+    }
+    members->push_back(member);
+
+    skip_space(line, &pos);
+    if (pos < line.size() && line[pos] == ',')
+      pos++;
+  }
+}
+
+bool parse_json_members(const std::string& line,
+                        std::map<std::string, std::string>* members) {
+  std::vector<json_member_t> parsed;
+  if (!parse_object(line, &parsed))
+    return false;
+  for (size_t i = 0; i < parsed.size(); i++)
+    (*members)[parsed[i].name] = parsed[i].value;
+  return true;
+}
+
+bool parse_trace_line(const std::string& line, trace_entry_t* entry) {
+  bool have_time = false;
+  bool have_work = false;
+  entry->resp.clear();
+
+  std::vector<json_member_t> members;
+  if (!parse_object(line, &members))
+    return false;
+
+  for (size_t i = 0; i < members.size(); i++) {
+    const json_member_t& m = members[i];
+    if (m.is_string && m.name == "work") {
+      entry->work = m.value;
+      have_work = true;
+    } else if (m.is_string && m.name == "resp") {
+      entry->resp = m.value;
+    } else if (!m.is_string && m.name == "time") {
+      entry->time_ms = strtod(m.value.c_str(), NULL);
+      have_time = true;
+    }
+  }
+  return have_time && have_work;
+}
+
+static std::string quote(const std::string& s) {
+  std::string out = "\"";
+  for (size_t i = 0; i < s.size(); i++) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      out += escape;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+std::string format_trace_line(const trace_entry_t& entry) {
+  char time[32];
+  snprintf(time, sizeof(time), "%.15g", entry.time_ms);
+  return std::string("{\"time\": ") + time + ", \"work\": " +
+    quote(entry.work) + ", \"resp\": " + quote(entry.resp) + "}";
+}
+
+bool read_trace_file(const std::string& path,
+                     std::vector<trace_entry_t>* entries, int* bad_line) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    *bad_line = 0;
+    return false;
+  }
+
+  std::string line;
+  for (int number = 1; std::getline(in, line); number++) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+      continue;
+    trace_entry_t entry;
+    if (!parse_trace_line(line, &entry)) {
+      *bad_line = number;
+      return false;
+    }
+    entries->push_back(entry);
+  }
+  return true;
+}
@@ -0,0 +1,38 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef TYPES_TRACE_FILE_H_
+#define TYPES_TRACE_FILE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+// One line of a request trace (tests/*.txt), a JSON object such as
+//   {"time": 500, "work": "cmd=countprimes;n=100012", "resp": "9593"}
+// where 'time' is when to send the request, in milliseconds from the
+// start of the trace, and 'resp' is the correct answer ("" if unknown).
+typedef struct {
+  double time_ms;
+  std::string work;
+  std::string resp;
+} trace_entry_t;
+
+// Returns false if 'line' is not a trace entry.
+bool parse_trace_line(const std::string& line, trace_entry_t* entry);
+
+// Reads any flat JSON object of strings and numbers, such as a line of
+// bench --format=json, into name -> value (numbers as written). Returns
+// false if 'line' is not one.
+bool parse_json_members(const std::string& line,
+                        std::map<std::string, std::string>* members);
+
+// The line for 'entry', without a newline.
+std::string format_trace_line(const trace_entry_t& entry);
+
+// Reads a whole trace, skipping blank lines. On a malformed line,
+// returns false with the line number in 'bad_line'; on an unreadable
+// file, with 'bad_line' set to 0.
+bool read_trace_file(const std::string& path,
+                     std::vector<trace_entry_t>* entries, int* bad_line);
+
+#endif  // TYPES_TRACE_FILE_H_
@@ -37,6 +37,21 @@ std::ostream& operator<< (std::ostream &out, const message_t &message) {
     case SHUTDOWN:
       out << "SHUTDOWN";
       break;
+    case ENCODING:
+      out << "ENCODING";
+      break;
+    case TRANSPORT:
+      out << "TRANSPORT";
+      break;
+    case CANCEL:
+      out << "CANCEL";
+      break;
+    case TRACE:
+      out << "TRACE";
+      break;
+    case METRICS:
+      out << "METRICS";
+      break;
     default:
       LOG(FATAL) << "Invalid message " << std::hex << static_cast<int>(message);
   }
@@ -46,5 +61,46 @@ std::ostream& operator<< (std::ostream &out, const message_t &message) {
 std::ostream& operator<< (std::ostream &out, const worker_stats_t &stats) {
   return out << "Stats(cpu_threads=" << stats.cpu_threads
              << ", memory_threads=" << stats.memory_threads
-             << ", io_threads=" << stats.io_threads << ")";
+             << ", io_threads=" << stats.io_threads
+             << ", queue_depth=" << stats.queue_depth[WORK_CLASS_CPU]
+             << "/" << stats.queue_depth[WORK_CLASS_DISK]
+             << ", busy_threads=" << stats.busy_threads[WORK_CLASS_CPU]
+             << "/" << stats.busy_threads[WORK_CLASS_DISK]
+             << ", rss_kb=" << stats.rss_kb
+             << ", load_average=" << stats.load_average << ")";
+}
+
+std::ostream& operator<< (std::ostream &out, const trace_hops_t &trace) {
+  return out << "Trace(received=" << trace.received
+             << ", execute_start=" << trace.execute_start
+             << ", execute_end=" << trace.execute_end
+             << ", sent=" << trace.sent << ")";
+}
+
+std::ostream& operator<< (std::ostream &out, const encoding_t &encoding) {
+  switch (encoding) {
+    case ENCODING_TEXT:
+      out << "TEXT";
+      break;
+    case ENCODING_BINARY:
+      out << "BINARY";
+      break;
+    default:
+      out << "ENCODING(" << static_cast<int>(encoding) << ")";
+  }
+  return out;
+}
+
+std::ostream& operator<< (std::ostream &out, const transport_t &transport) {
+  switch (transport) {
+    case TRANSPORT_SOCKET:
+      out << "SOCKET";
+      break;
+    case TRANSPORT_SHM:
+      out << "SHM";
+      break;
+    default:
+      out << "TRANSPORT(" << static_cast<int>(transport) << ")";
+  }
+  return out;
 }
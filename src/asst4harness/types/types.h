@@ -3,10 +3,11 @@
 #ifndef TYPES_H_
 #define TYPES_H_
 
-#include <boost/shared_ptr.hpp>
-
 #include <iostream>
 
+#include "server/stats.h"
+#include "tools/frame_pool.h"
+
 typedef enum {
   WORK,
   RESPONSE,
@@ -14,33 +15,67 @@ typedef enum {
   REQUEST_STATS,
   STATS,
   ISREADY,
-  SHUTDOWN
+  SHUTDOWN,
+  ENCODING,
+  TRANSPORT,
+  CANCEL,     // tag: a request the master no longer wants answered
+  TRACE,      // tag: the request whose hops the body times
+  METRICS     // answered with a RESPONSE holding the master's metrics
 } message_t;
 
+// Body encoding of WORK and RESPONSE payloads on a connection. Text is
+// the default; a peer may ask for binary by sending ENCODING with the
+// desired encoding as the tag, and the master answers with ENCODING
+// tagged with the encoding it will actually use.
+typedef enum {
+  ENCODING_TEXT,
+  ENCODING_BINARY
+} encoding_t;
+
+// Byte stream underneath a connection. A worker on a Unix-domain socket
+// may send TRANSPORT tagged TRANSPORT_SHM, followed by the shared-memory
+// channel's descriptors; the master answers with TRANSPORT tagged with the
+// transport both sides switch to.
+typedef enum {
+  TRANSPORT_SOCKET,
+  TRANSPORT_SHM
+} transport_t;
+
 typedef struct {
   message_t message;
   int tag;
 } tagged_message_t;
 
+// Body of a STATS message, which answers REQUEST_STATS with the same tag.
+typedef Worker_stats worker_stats_t;
+
+// Body of a TRACE message: when a worker handled the request with the
+// same tag, in CycleTimer seconds on the worker's clock (0 for hops it
+// did not see). A worker sends one just ahead of each response once the
+// master has sent it a TRACE (with all hops 0) to turn tracing on.
 typedef struct {
-  int cpu_threads;
-  int memory_threads;
-  int io_threads;
-} worker_stats_t;
+  double received;       // WORK arrived
+  double execute_start;  // first execute_work() began
+  double execute_end;    // last execute_work() ended
+  double sent;           // response handed to the socket
+} trace_hops_t;
 
 typedef struct {
   int buf_len;
-  boost::shared_ptr<char[]> buf;
+  frame_ptr buf;
 } work_t;
 
 typedef struct {
   int buf_len;
-  boost::shared_ptr<char[]> buf;
+  frame_ptr buf;
 } resp_t;
 
 std::ostream& operator<< (std::ostream &out, const work_t& work);
 std::ostream& operator<< (std::ostream &out, const resp_t& resp);
 std::ostream& operator<< (std::ostream &out, const message_t& work);
 std::ostream& operator<< (std::ostream &out, const worker_stats_t& stats);
+std::ostream& operator<< (std::ostream &out, const trace_hops_t& trace);
+std::ostream& operator<< (std::ostream &out, const encoding_t& encoding);
+std::ostream& operator<< (std::ostream &out, const transport_t& transport);
 
 #endif  // TYPES_H_
@@ -0,0 +1,362 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <glog/logging.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "types/wire.h"
+
+static const char* const command_names[NUM_WIRE_CMDS] = {
+  NULL,
+  "418wisdom",
+  "countprimes",
+  "compareprimes",
+  "minicompute",
+  "highmem",
+  "mostviewed",
+  "lastrequest"
+};
+
+static const char* const key_names[NUM_WIRE_KEYS] = {
+  NULL,
+  "cmd",
+  "x",
+  "n",
+  "n1",
+  "n2",
+  "n3",
+  "n4",
+  "start",
+  "end",
+  "tag",
+  "name",
+  "deadline_ms",
+  "priority"
+};
+
+static int lookup(const char* const* names, int count,
+                  const char* s, int len) {
+  if (len == 0) return 0;
+  for (int i = 1; i < count; i++) {
+    if (names[i][0] == s[0] && strncmp(names[i], s, len) == 0 &&
+        names[i][len] == '\0') {
+      return i;
+    }
+  }
+  return 0;
+}
+
+// Worker_stats is indexed by wire command.
+typedef char stats_cmds_match_wire_cmds[
+  (MAX_STATS_CMDS == NUM_WIRE_CMDS) ? 1 : -1];
+
+int stats_cmd_index(const std::string& cmd) {
+  return lookup(command_names, NUM_WIRE_CMDS, cmd.data(), cmd.size());
+}
+
+const char* stats_cmd_name(int index) {
+  if (index <= 0 || index >= NUM_WIRE_CMDS)
+    return "other";
+  return command_names[index];
+}
+
+const char* perf_counter_name(int index) {
+  static const char* const names[NUM_PERF_COUNTERS] = {
+    "cycles", "instructions", "cache_misses", "branch_misses", "page_faults"
+  };
+  if (index < 0 || index >= NUM_PERF_COUNTERS)
+    return "unknown";
+  return names[index];
+}
+
+// Returns true iff 's' is exactly what "%d" would print for some int32,
+// so that int-typed values round trip to the same text.
+static bool parse_canonical_int(const char* s, int len, int32_t* value) {
+  int i = (len > 0 && s[0] == '-') ? 1 : 0;
+  int digits = len - i;
+  if (digits == 0 || digits > 10) return false;
+  if (s[i] == '0' && (digits > 1 || i == 1)) return false;
+
+  long long v = 0;  // NOLINT
+  for (; i < len; i++) {
+    if (s[i] < '0' || s[i] > '9') return false;
+    v = v * 10 + (s[i] - '0');
+  }
+  if (s[0] == '-') v = -v;
+  if (v < -2147483648LL || v > 2147483647LL) return false;
+
+  *value = static_cast<int32_t>(v);
+  return true;
+}
+
+// Appends to a buffer sized for the worst case (see max_size()), so
+// that encoding is one pass over the request and a single allocation.
+class WireWriter {
+ public:
+  explicit WireWriter(char* argBuf) : buf(argBuf), len(0) {}
+
+  void put(const void* p, size_t n) {
+    memcpy(buf + len, p, n);
+    len += n;
+  }
+
+  void put_u8(uint8_t v) { put(&v, sizeof(v)); }
+  void put_u16(uint16_t v) { put(&v, sizeof(v)); }
+  void put_u32(uint32_t v) { put(&v, sizeof(v)); }
+  void put_i32(int32_t v) { put(&v, sizeof(v)); }
+
+  size_t size() const { return len; }
+
+ private:
+  char* buf;
+  size_t len;
+};
+
+// Bounds-checked cursor over a received buffer.
+class WireReader {
+ public:
+  WireReader(const char* argBuf, size_t argLen)
+      : buf(argBuf), len(argLen), pos(0) {}
+
+  bool get(void* p, size_t n) {
+    if (len - pos < n) return false;
+    memcpy(p, buf + pos, n);
+    pos += n;
+    return true;
+  }
+
+  bool get_u8(uint8_t* v) { return get(v, sizeof(*v)); }
+  bool get_u16(uint16_t* v) { return get(v, sizeof(*v)); }
+  bool get_u32(uint32_t* v) { return get(v, sizeof(*v)); }
+  bool get_i32(int32_t* v) { return get(v, sizeof(*v)); }
+
+  // Points 'p' at the next 'n' bytes without copying them.
+  bool view(const char** p, size_t n) {
+    if (len - pos < n) return false;
+    *p = buf + pos;
+    pos += n;
+    return true;
+  }
+
+  bool done() const { return pos == len; }
+
+ private:
+  const char* buf;
+  size_t len;
+  size_t pos;
+};
+
+class WireCodec {
+ public:
+  static size_t max_size(const Request_msg& req);
+  static void write(const Request_msg& req, WireWriter* w);
+  static void write_text(const Request_msg& req, WireWriter* w);
+  static bool read(const frame_ptr& src, int len, Request_msg* req);
+  static void read_text(const frame_ptr& src, int len, Request_msg* req) {
+    req->parse_text(src, len);
+  }
+};
+
+// An upper bound on either encoding of 'req': per argument, the key and
+// value (as text, for a typed integer) plus 8 bytes of binary framing.
+size_t WireCodec::max_size(const Request_msg& req) {
+  size_t size = 2;
+  for (int i = 0; i < req.num_args; i++) {
+    const Request_msg::Arg& arg = req.args[i];
+    size += arg.key_len + 8 + (arg.value != NULL ?
+                               arg.value_len : Request_msg::INT_TEXT_SIZE);
+  }
+  return size;
+}
+
+void WireCodec::write(const Request_msg& req, WireWriter* w) {
+  const Request_msg::Arg* cmd_arg = req.find_arg("cmd", 3);
+  int cmd = WIRE_CMD_NONE;
+  if (cmd_arg != NULL) {
+    cmd = lookup(command_names, NUM_WIRE_CMDS,
+                 cmd_arg->value, cmd_arg->value_len);
+  }
+
+  int num_args = req.num_args - (cmd != WIRE_CMD_NONE ? 1 : 0);
+  CHECK_LE(num_args, 255) << "Too many arguments for binary encoding";
+  w->put_u8(cmd);
+  w->put_u8(num_args);
+
+  for (int i = 0; i < req.num_args; i++) {
+    const Request_msg::Arg& arg = req.args[i];
+    if (cmd != WIRE_CMD_NONE && &arg == cmd_arg) continue;
+
+    int key = arg.key_id != WIRE_KEY_OTHER ? arg.key_id :
+      lookup(key_names, NUM_WIRE_KEYS, arg.key, arg.key_len);
+    w->put_u8(key);
+    if (key == WIRE_KEY_OTHER) {
+      CHECK_LE(arg.key_len, 0xffff) << "Argument name too long";
+      w->put_u16(arg.key_len);
+      w->put(arg.key, arg.key_len);
+    }
+
+    int32_t value;
+    if (arg.value == NULL) {
+      w->put_u8(WIRE_INT);
+      w->put_i32(arg.int_value);
+    } else if (parse_canonical_int(arg.value, arg.value_len, &value)) {
+      w->put_u8(WIRE_INT);
+      w->put_i32(value);
+    } else {
+      w->put_u8(WIRE_STR);
+      w->put_u32(arg.value_len);
+      w->put(arg.value, arg.value_len);
+    }
+  }
+}
+
+void WireCodec::write_text(const Request_msg& req, WireWriter* w) {
+  for (int i = 0; i < req.num_args; i++) {
+    if (i != 0) w->put(";", 1);
+    w->put(req.args[i].key, req.args[i].key_len);
+    w->put("=", 1);
+    if (req.args[i].value == NULL) {
+      char buf[Request_msg::INT_TEXT_SIZE];
+      w->put(buf, Request_msg::format_int(req.args[i], buf));
+    } else {
+      w->put(req.args[i].value, req.args[i].value_len);
+    }
+  }
+}
+
+// Decodes in place: string arguments point into the received frame and
+// integers stay typed until someone asks for their text, so nothing is
+// allocated unless the frame is too small to also hold the index.
+bool WireCodec::read(const frame_ptr& src, int len, Request_msg* req) {
+  if (len < 2) return false;
+  int max_args = 1 + static_cast<uint8_t>(src->data()[1]);
+
+  frame_ptr dst = src;
+  Request_msg::Arg* out = Request_msg::reserve_args(&dst, len, 0, max_args);
+  WireReader r(dst->data(), len);
+  int n = 0;
+
+  uint8_t cmd;
+  uint8_t num_args;
+  if (!r.get_u8(&cmd) || !r.get_u8(&num_args)) return false;
+  if (cmd >= NUM_WIRE_CMDS) return false;
+  if (cmd != WIRE_CMD_NONE) {
+    out[n].key = key_names[WIRE_KEY_CMD];
+    out[n].key_len = strlen(out[n].key);
+    out[n].value = command_names[cmd];
+    out[n].value_len = strlen(out[n].value);
+    out[n].key_id = WIRE_KEY_CMD;
+    out[n].int_value = 0;
+    n++;
+  }
+
+  for (int i = 0; i < num_args; i++, n++) {
+    uint8_t key;
+    uint8_t type;
+
+    if (!r.get_u8(&key) || key >= NUM_WIRE_KEYS) return false;
+    out[n].key_id = key;
+    if (key == WIRE_KEY_OTHER) {
+      uint16_t name_len;
+      if (!r.get_u16(&name_len) || !r.view(&out[n].key, name_len))
+        return false;
+      out[n].key_len = name_len;
+    } else {
+      out[n].key = key_names[key];
+      out[n].key_len = strlen(out[n].key);
+    }
+
+    if (!r.get_u8(&type)) return false;
+    if (type == WIRE_INT) {
+      int32_t v;
+      if (!r.get_i32(&v)) return false;
+      out[n].value = NULL;
+      out[n].value_len = 0;
+      out[n].int_value = v;
+    } else if (type == WIRE_STR) {
+      uint32_t value_len;
+      if (!r.get_u32(&value_len) || !r.view(&out[n].value, value_len))
+        return false;
+      out[n].value_len = value_len;
+      out[n].int_value = 0;
+    } else {
+      return false;
+    }
+  }
+  if (!r.done()) return false;
+
+  req->frame = dst;
+  req->args = out;
+  req->num_args = n;
+  return true;
+}
+
+void encode_request(const Request_msg& req, encoding_t encoding,
+                    work_t* work) {
+  void (*write)(const Request_msg&, WireWriter*) =
+    (encoding == ENCODING_BINARY) ? WireCodec::write : WireCodec::write_text;
+
+  work->buf = alloc_frame(WireCodec::max_size(req));
+  WireWriter w(work->buf->data());
+  write(req, &w);
+  work->buf_len = w.size();
+}
+
+bool decode_request(const work_t& work, encoding_t encoding,
+                    Request_msg* req) {
+  if (encoding == ENCODING_BINARY) {
+    return WireCodec::read(work.buf, work.buf_len, req);
+  }
+
+  WireCodec::read_text(work.buf, work.buf_len, req);
+  return true;
+}
+
+void encode_response(const std::string& resp_str, encoding_t encoding,
+                     resp_t* resp) {
+  if (encoding == ENCODING_BINARY) {
+    int32_t value;
+    if (parse_canonical_int(resp_str.data(), resp_str.size(), &value)) {
+      resp->buf_len = 1 + sizeof(value);
+      resp->buf = alloc_frame(resp->buf_len);
+      resp->buf->data()[0] = WIRE_INT;
+      memcpy(resp->buf->data() + 1, &value, sizeof(value));
+    } else {
+      resp->buf_len = 1 + resp_str.size();
+      resp->buf = alloc_frame(resp->buf_len);
+      resp->buf->data()[0] = WIRE_STR;
+      memcpy(resp->buf->data() + 1, resp_str.data(), resp_str.size());
+    }
+  } else {
+    resp->buf_len = resp_str.size();
+    resp->buf = alloc_frame(resp->buf_len);
+    memcpy(resp->buf->data(), resp_str.data(), resp_str.size());
+  }
+}
+
+bool decode_response(const resp_t& resp, encoding_t encoding,
+                     Response_msg* msg) {
+  const char* buf = resp.buf->data();
+  if (encoding == ENCODING_BINARY) {
+    if (resp.buf_len < 1) return false;
+    if (buf[0] == WIRE_INT) {
+      int32_t value;
+      char tmp_buffer[16];
+      if (resp.buf_len != 1 + static_cast<int>(sizeof(value))) return false;
+      memcpy(&value, buf + 1, sizeof(value));
+      snprintf(tmp_buffer, sizeof(tmp_buffer), "%d", value);
+      msg->set_response(tmp_buffer);
+    } else if (buf[0] == WIRE_STR) {
+      msg->set_response(std::string(buf + 1, resp.buf_len - 1));
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  msg->set_response(std::string(buf, resp.buf_len));
+  return true;
+}
@@ -0,0 +1,73 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef TYPES_WIRE_H_
+#define TYPES_WIRE_H_
+
+#include <string>
+
+#include "server/messages.h"
+#include "types/types.h"
+
+// Binary request layout (host byte order, like the rest of the protocol):
+//
+//   u8 command          wire_cmd_t, WIRE_CMD_NONE if there is no known cmd
+//   u8 num_args
+//   num_args times:
+//     u8 key            wire_key_t
+//     [u16 len, bytes]  key name, only when key == WIRE_KEY_OTHER
+//     u8 type           wire_type_t
+//     i32 value         when type == WIRE_INT
+//     [u32 len, bytes]  when type == WIRE_STR
+//
+// Binary response layout is u8 type followed by an i32 (WIRE_INT) or the
+// raw response bytes up to the end of the buffer (WIRE_STR).
+
+typedef enum {
+  WIRE_CMD_NONE,
+  WIRE_CMD_418WISDOM,
+  WIRE_CMD_COUNTPRIMES,
+  WIRE_CMD_COMPAREPRIMES,
+  WIRE_CMD_MINICOMPUTE,
+  WIRE_CMD_HIGHMEM,
+  WIRE_CMD_MOSTVIEWED,
+  WIRE_CMD_LASTREQUEST,
+  NUM_WIRE_CMDS
+} wire_cmd_t;
+
+typedef enum {
+  WIRE_KEY_OTHER,
+  WIRE_KEY_CMD,
+  WIRE_KEY_X,
+  WIRE_KEY_N,
+  WIRE_KEY_N1,
+  WIRE_KEY_N2,
+  WIRE_KEY_N3,
+  WIRE_KEY_N4,
+  WIRE_KEY_START,
+  WIRE_KEY_END,
+  WIRE_KEY_TAG,
+  WIRE_KEY_NAME,
+  WIRE_KEY_DEADLINE_MS,
+  WIRE_KEY_PRIORITY,
+  NUM_WIRE_KEYS
+} wire_key_t;
+
+typedef enum {
+  WIRE_INT,
+  WIRE_STR
+} wire_type_t;
+
+// Serializes the arguments of 'req' (not its tag, which travels in the
+// tagged_message_t header) into 'work'.
+void encode_request(const Request_msg& req, encoding_t encoding, work_t* work);
+
+// Fills 'req' with the arguments carried by 'work'. Returns false if a
+// binary body is malformed.
+bool decode_request(const work_t& work, encoding_t encoding, Request_msg* req);
+
+void encode_response(const std::string& resp_str, encoding_t encoding,
+                     resp_t* resp);
+bool decode_response(const resp_t& resp, encoding_t encoding,
+                     Response_msg* msg);
+
+#endif  // TYPES_WIRE_H_
@@ -0,0 +1,145 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <dirent.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "server/worker.h"
+
+DEFINE_bool(pin_threads, false,
+            "Pin worker threads to cores, spread over NUMA nodes, and "
+            "prefer memory from each thread's own node");
+
+#define NODE_DIR "/sys/devices/system/node"
+
+// The CPUs of each NUMA node that this process may run on.
+static std::vector<std::vector<int> > nodes;
+static std::vector<int> node_ids;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+// Parses a sysfs cpulist such as "0-3,8,10-11".
+static std::vector<int> parse_cpulist(const char* path) {
+  std::vector<int> cpus;
+  FILE* f = fopen(path, "r");
+  if (f == NULL)
+    return cpus;
+
+  int first;
+  int last;
+  char sep;
+  while (fscanf(f, "%d", &first) == 1) {
+    last = first;
+    sep = fgetc(f);
+    if (sep == '-') {
+      if (fscanf(f, "%d", &last) != 1)
+        break;
+      sep = fgetc(f);
+    }
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+    if (sep != ',')
+      break;
+  }
+  fclose(f);
+  return cpus;
+}
+
+static void discover_topology() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+    PLOG(WARNING) << "Could not read CPU affinity";
+    return;
+  }
+
+  DIR* dir = opendir(NODE_DIR);
+  struct dirent* entry;
+  while (dir != NULL && (entry = readdir(dir)) != NULL) {
+    int id;
+    char path[sizeof(NODE_DIR) + sizeof(entry->d_name) + sizeof("/cpulist")];
+    if (sscanf(entry->d_name, "node%d", &id) != 1)
+      continue;
+    snprintf(path, sizeof(path), NODE_DIR "/%s/cpulist", entry->d_name);
+
+    std::vector<int> cpus;
+    std::vector<int> all = parse_cpulist(path);
+    for (size_t i = 0; i < all.size(); i++) {
+      if (all[i] < CPU_SETSIZE && CPU_ISSET(all[i], &allowed))
+        cpus.push_back(all[i]);
+    }
+    if (!cpus.empty()) {
+      nodes.push_back(cpus);
+      node_ids.push_back(id);
+    }
+  }
+  if (dir != NULL)
+    closedir(dir);
+
+  // No NUMA information: one node holding every CPU we may use.
+  if (nodes.empty()) {
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed))
+        cpus.push_back(cpu);
+    }
+    nodes.push_back(cpus);
+    node_ids.push_back(-1);
+  }
+}
+
+static void prefer_node_memory(int node_id) {
+  if (node_id < 0 || nodes.size() < 2)
+    return;
+
+  unsigned long mask[16];
+  memset(mask, 0, sizeof(mask));
+  const int bits = 8 * sizeof(mask[0]);
+  if (node_id >= bits * 16)
+    return;
+  mask[node_id / bits] |= 1UL << (node_id % bits);
+
+  PLOG_IF(WARNING, syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+                           bits * 16) < 0)
+    << "Could not prefer memory from node " << node_id;
+}
+
+void worker_place_thread(int thread_class, int index) {
+  if (!FLAGS_pin_threads)
+    return;
+
+  pthread_once(&topology_once, discover_topology);
+  if (nodes.empty())
+    return;
+
+  // Threads of a class take turns across nodes, so concurrent jobs
+  // split memory bandwidth and last-level cache between sockets.
+  int node = index % nodes.size();
+  const std::vector<int>& cpus = nodes[node];
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (thread_class == THREAD_CLASS_CPU) {
+    // Compute threads get a core each within their node.
+    CPU_SET(cpus[(index / nodes.size()) % cpus.size()], &set);
+  } else {
+    // Disk and sender threads mostly wait, so tying one to a single
+    // core would only make it queue behind a compute thread.
+    for (size_t i = 0; i < cpus.size(); i++)
+      CPU_SET(cpus[i], &set);
+  }
+
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  LOG_IF(WARNING, err != 0) << "Could not pin thread: " << strerror(err);
+
+  prefer_node_memory(node_ids[node]);
+}
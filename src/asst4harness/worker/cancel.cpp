@@ -0,0 +1,104 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <boost/unordered_map.hpp>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "tools/cycle_timer.h"
+#include "worker/cancel.h"
+
+struct cancel_token {
+  int tag;
+  volatile int cancelled;
+  double deadline;  // 0 for none
+  int refs;         // unanswered requests with this tag, plus running jobs
+};
+
+static pthread_mutex_t cancel_lock = PTHREAD_MUTEX_INITIALIZER;
+static boost::unordered_map<int, cancel_token*> tokens;
+
+static __thread cancel_token* current_job = NULL;
+
+// Call with cancel_lock held.
+static void unref(cancel_token* token) {
+  if (--token->refs > 0)
+    return;
+  boost::unordered_map<int, cancel_token*>::iterator it =
+    tokens.find(token->tag);
+  if (it != tokens.end() && it->second == token)
+    tokens.erase(it);
+  delete token;
+}
+
+void cancel_register(const Request_msg& req) {
+  double deadline = 0;
+  std::string budget = req.get_arg("deadline_ms");
+  if (!budget.empty()) {
+    deadline = CycleTimer::currentSeconds() + atof(budget.c_str()) / 1000.0;
+  }
+
+  pthread_mutex_lock(&cancel_lock);
+  cancel_token*& token = tokens[req.get_tag()];
+  if (token == NULL) {
+    token = new cancel_token;
+    token->tag = req.get_tag();
+    token->cancelled = 0;
+    token->deadline = deadline;
+    token->refs = 0;
+  }
+  token->refs++;
+  pthread_mutex_unlock(&cancel_lock);
+}
+
+void cancel_request(int tag) {
+  pthread_mutex_lock(&cancel_lock);
+  boost::unordered_map<int, cancel_token*>::iterator it = tokens.find(tag);
+  if (it != tokens.end())
+    it->second->cancelled = 1;
+  pthread_mutex_unlock(&cancel_lock);
+}
+
+void cancel_release(int tag) {
+  pthread_mutex_lock(&cancel_lock);
+  boost::unordered_map<int, cancel_token*>::iterator it = tokens.find(tag);
+  if (it != tokens.end())
+    unref(it->second);
+  pthread_mutex_unlock(&cancel_lock);
+}
+
+// A running job holds a reference too, in case student code answers a
+// request before every piece of it has finished.
+cancel_token* cancel_begin_job(int tag) {
+  cancel_token* previous = current_job;
+
+  pthread_mutex_lock(&cancel_lock);
+  boost::unordered_map<int, cancel_token*>::iterator it = tokens.find(tag);
+  current_job = (it != tokens.end()) ? it->second : NULL;
+  if (current_job != NULL)
+    current_job->refs++;
+  pthread_mutex_unlock(&cancel_lock);
+
+  return previous;
+}
+
+void cancel_end_job(cancel_token* previous) {
+  if (current_job != NULL) {
+    pthread_mutex_lock(&cancel_lock);
+    unref(current_job);
+    pthread_mutex_unlock(&cancel_lock);
+  }
+  current_job = previous;
+}
+
+int job_status() {
+  cancel_token* token = current_job;
+  if (token == NULL)
+    return JOB_RUNNING;
+  if (token->cancelled)
+    return JOB_CANCELLED;
+  if (token->deadline > 0 && CycleTimer::currentSeconds() > token->deadline)
+    return JOB_DEADLINE_EXCEEDED;
+  return JOB_RUNNING;
+}
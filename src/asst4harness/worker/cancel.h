@@ -0,0 +1,49 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef WORKER_CANCEL_H_
+#define WORKER_CANCEL_H_
+
+#include "server/messages.h"
+
+// Cooperative cancellation of requests the master no longer wants.
+//
+// Every request the worker receives gets a token, keyed by its tag,
+// carrying a cancel flag (set by CANCEL from the master) and an optional
+// deadline (the request's "deadline_ms" argument, counted from
+// receipt). execute_work() makes the token of the request it runs
+// current on its thread, and the kernels poll job_cancelled() at chunk
+// boundaries. Requests that share a tag, such as the pieces a worker
+// splits a request into, share its token. All of these are thread-safe.
+
+// A request from the master has arrived.
+void cancel_register(const Request_msg& req);
+
+// The master sent CANCEL for 'tag'. Unknown tags are ignored, since the
+// response may already be on its way.
+void cancel_request(int tag);
+
+// The response to 'tag' has been handed off; forget its token.
+void cancel_release(int tag);
+
+struct cancel_token;
+
+// Makes the token for 'tag' (if any) current on this thread until the
+// matching cancel_end_job(), and returns the one it displaces (a pool
+// thread may run one job while waiting inside another).
+cancel_token* cancel_begin_job(int tag);
+void cancel_end_job(cancel_token* previous);
+
+enum {
+  JOB_RUNNING,
+  JOB_CANCELLED,
+  JOB_DEADLINE_EXCEEDED
+};
+
+// JOB_RUNNING, or why the current job should stop.
+int job_status();
+
+static inline bool job_cancelled() {
+  return job_status() != JOB_RUNNING;
+}
+
+#endif  // WORKER_CANCEL_H_
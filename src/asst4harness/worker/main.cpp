@@ -8,27 +8,48 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
-#include <boost/make_shared.hpp>
+#include <unistd.h>
 
 #include <string>
 
 #include "comm/connect.h"
 #include "comm/comm.h"
+#include "comm/transport.h"
+#include "comm/uring.h"
+#include "types/wire.h"
 #include "server/messages.h"
 #include "server/worker.h"
+#include "tools/cycle_timer.h"
+#include "tools/work_queue.h"
+#include "worker/cancel.h"
+#include "worker/stats.h"
+#include "worker/trace.h"
 
 extern void init_work_engine(bool forceFileIO, const std::string& assetsDir);
 
 
 static int master_fd = -1;
-DEFINE_int32(cpu_threads, 2, "Number of threads to use");
+static encoding_t master_encoding = ENCODING_TEXT;
+DEFINE_int32(cpu_threads, 0,
+             "Number of compute threads to use (0 for one per core)");
 DEFINE_int32(memory_threads, 2, "Number of threads to use");
-DEFINE_int32(io_threads, 2, "Number of threads to use");
+DEFINE_int32(io_threads, 2, "Number of disk threads to use");
+DEFINE_int32(short_job_threads, 0,
+             "Compute threads kept for high-priority (short) requests");
+DEFINE_bool(short_job_threads_steal, false,
+            "Let the short-job threads run other requests when idle");
 DEFINE_int32(tag, 0, "Tag to send when initially connecting to the master");
 
 DEFINE_bool(log_network, false, "Log network traffic.");
 DEFINE_bool(force_disk_io, false, "Force diskIO.");
 DEFINE_bool(fast_boot, false, "Enable fast booting (don't artificially delay boot time)");
+DEFINE_bool(binary_encoding, false, "Ask the master for binary wire encoding");
+DEFINE_bool(local_transport, true,
+            "Use a Unix-domain socket when the master is on this host");
+DEFINE_bool(shm_transport, false,
+            "Move a local master connection onto shared-memory rings");
+
+DECLARE_bool(io_uring);
 
 DEFINE_string(workerparams, "", "Student specified commandline args");
 DEFINE_string(assets_dir, "/afs/cs/academic/class/15418-s13/public/data", "Assets directory");
@@ -37,6 +58,11 @@ DEFINE_string(assets_dir, "/afs/cs/academic/class/15418-s13/public/data", "Asset
 // You should probably hold onto this when writing to master_fd.
 pthread_mutex_t master_write_lock = PTHREAD_MUTEX_INITIALIZER;
 
+// Finished responses, encoded by the compute threads and written out by
+// harness_response_sender(), so that no compute thread waits on the
+// socket or on master_write_lock.
+static WorkQueue<tagged_resp_t> outgoing_responses;
+
 const int WORKER_BOOT_LATENCY = 5;
 
 void harness_boot_worker(bool fastBoot, bool forceDiskIo, const std::string& assetsDir) {
@@ -50,72 +76,206 @@ void harness_boot_worker(bool fastBoot, bool forceDiskIo, const std::string& ass
   init_work_engine(forceDiskIo, assetsDir);
 }
 
+// Asks a master we reach over a Unix-domain socket to move the
+// connection onto shared memory.
+static void harness_negotiate_shm_transport() {
+  int fds[SHM_CHANNEL_FDS];
+  if (shm_channel_create(fds) < 0) {
+    PLOG(WARNING) << "Could not create shared-memory channel";
+    return;
+  }
+
+  message_t message;
+  int granted;
+  CHECK_GE(send_message(master_fd, TRANSPORT, TRANSPORT_SHM), 0)
+    << "Couldn't negotiate transport with master";
+  CHECK_GE(send_fds(master_fd, fds, SHM_CHANNEL_FDS), 0)
+    << "Couldn't negotiate transport with master";
+  CHECK_GE(recv_message(master_fd, &message, &granted), 0)
+    << "Couldn't negotiate transport with master";
+  CHECK_EQ(message, TRANSPORT) << "Invalid message type " << message;
+
+  if (granted == TRANSPORT_SHM) {
+    master_fd = shm_transport_attach(master_fd, fds, false);
+    CHECK_GE(master_fd, 0) << "Could not map shared-memory channel";
+  } else {
+    for (int i = 0; i < SHM_CHANNEL_FDS; i++) {
+      close(fds[i]);
+    }
+  }
+  DLOG(INFO) << "Using " << static_cast<transport_t>(granted) << " transport";
+}
+
+// Sends everything that is ready each time it wakes up, so a burst of
+// responses costs one write: an io_uring SENDMSG when the master is on a
+// socket and the kernel has it, a plain sendmsg otherwise.
+static void* harness_response_sender(void*) {
+  tagged_resp_t batch[MAX_RESPS_PER_SEND];
+  trace_hops_t traces[MAX_RESPS_PER_SEND];
+  bool use_uring = FLAGS_io_uring && !is_shm_transport(master_fd);
+  worker_place_thread(THREAD_CLASS_SENDER, 0);
+
+  for (;;) {
+    int n = outgoing_responses.get_work(batch, MAX_RESPS_PER_SEND);
+
+    bool traced = trace_enabled();
+    if (traced) {
+      double now = CycleTimer::currentSeconds();
+      for (int i = 0; i < n; i++) {
+        traces[i] = trace_take(batch[i].tag);
+        traces[i].sent = now;
+      }
+    }
+
+    pthread_mutex_lock(&master_write_lock);
+    int err = URING_UNAVAILABLE;
+    if (use_uring)
+      err = uring_send_resps(master_fd, batch, n, traced ? traces : NULL);
+    if (err == URING_UNAVAILABLE) {
+      DLOG_IF(INFO, use_uring) << "io_uring unavailable, using sendmsg";
+      use_uring = false;
+      err = send_resps(master_fd, batch, n, traced ? traces : NULL);
+    }
+    pthread_mutex_unlock(&master_write_lock);
+    CHECK_GE(err, 0) << "Error writing to master!";
+
+    for (int i = 0; i < n; i++) {
+      DLOG_IF(INFO, FLAGS_log_network) << "Sending response ("
+                                       << batch[i].tag << ","
+                                       << batch[i].resp << ") to master";
+      batch[i].resp.buf = NULL;
+    }
+  }
+  return NULL;
+}
+
 void harness_connect_to_master(const std::string& port, int tag) {
 
-  master_fd = connect_to(port.c_str());
-  CHECK_GE(master_fd, 0) << "Worker could not connect to master" << port;
-  DLOG(INFO) << "Connected to master " << port;
+  bool local = false;
+  if (FLAGS_local_transport && is_local_address(port.c_str())) {
+    char path[108];
+    local_socket_path(port.c_str(), path, sizeof(path));
+    master_fd = connect_to_local(path);
+    local = (master_fd >= 0);
+    DLOG_IF(INFO, local) << "Connected to master over " << path;
+  }
+
+  if (!local) {
+    master_fd = connect_to(port.c_str());
+    CHECK_GE(master_fd, 0) << "Worker could not connect to master" << port;
+    DLOG(INFO) << "Connected to master " << port;
+  }
+
+  // Negotiate the encoding before announcing ourselves, so that no work
+  // can be sent to us before we know how it will be encoded.
+  if (FLAGS_binary_encoding) {
+    message_t message;
+    int granted;
+    CHECK_GE(send_message(master_fd, ENCODING, ENCODING_BINARY), 0)
+      << "Couldn't negotiate encoding with master";
+    CHECK_GE(recv_message(master_fd, &message, &granted), 0)
+      << "Couldn't negotiate encoding with master";
+    CHECK_EQ(message, ENCODING) << "Invalid message type " << message;
+    master_encoding = static_cast<encoding_t>(granted);
+    DLOG(INFO) << "Using " << master_encoding << " encoding";
+  }
+
+  if (local && FLAGS_shm_transport) {
+    harness_negotiate_shm_transport();
+  }
 
   CHECK_GE(send_message(master_fd, NEW_WORKER, tag), 0)
     << "Couldn't register with master";
 
+  pthread_t sender;
+  CHECK_EQ(pthread_create(&sender, NULL, harness_response_sender, NULL), 0)
+    << "Couldn't start response sender";
 }
 
-void harness_begin_main_loop() {
+static void harness_handle_message(message_t message, int tag,
+                                   const work_t& work, void*) {
+  if (message == REQUEST_STATS) {
+    worker_stats_t stats;
+    worker_stats_fill(&stats);
+    DLOG_IF(INFO, FLAGS_log_network) << "Sending " << stats << " to master";
+
+    pthread_mutex_lock(&master_write_lock);
+    int err = send_worker_stats(master_fd, stats, tag);
+    pthread_mutex_unlock(&master_write_lock);
+    CHECK_GE(err, 0) << "Error writing to master!";
+    return;
+  }
+  if (message == CANCEL) {
+    DLOG_IF(INFO, FLAGS_log_network) << "Cancelling " << tag;
+    cancel_request(tag);
+    return;
+  }
+  if (message == TRACE) {
+    DLOG_IF(INFO, FLAGS_log_network) << "Tracing requests";
+    trace_enable();
+    return;
+  }
+  CHECK_EQ(message, WORK) << "Invalid message type " << message;
 
-  work_t work;
-  int tag;
-  message_t message;
-  while (recv_message(master_fd, &message, &tag) == 0) {
-    if (message == REQUEST_STATS) {
-      //  DLOG_IF(INFO, FLAGS_log_network) << "Master requested stats";
-      //  CHECK_GE(send_stats(master_fd), 0) << "Error sending to master";
-      continue;
-    }
-    CHECK_EQ(message, WORK) << "Invalid message type " << message;
-    CHECK_GE(recv_work(master_fd, &work), 0) << "Error receiving from master";
+  DLOG_IF(INFO, FLAGS_log_network) << "Got new work (" << tag << "," << work
+                                   << ") from master";
 
-    DLOG_IF(INFO, FLAGS_log_network) << "Got new work (" << tag << "," << work
-                                     << ") from master";
+  // convert a work_t into a Request_msg to pass to student code
+  Request_msg req(tag);
+  CHECK(decode_request(work, master_encoding, &req))
+    << "Malformed work from master";
 
-    // convert a work_t into a Request_msg to pass to student code
-    // Since the content in work_t.buf is not null terminated, this is
-    // a big mess
-    int len = work.buf_len;
-    char* tmp_buffer = new char[len+1];
-    strncpy(tmp_buffer, work.buf.get(), len);
-    tmp_buffer[len] = '\0';
+  trace_received(tag);
+  worker_stats_received(req);
+  cancel_register(req);
 
-    Request_msg req(tag, tmp_buffer);
-    delete [] tmp_buffer;
+  // student code
+  worker_handle_request(req);
+}
 
-    // student code
-    worker_handle_request(req);
+void harness_begin_main_loop() {
+
+  // The shared-memory rings are already read without syscalls.
+  if (is_shm_transport(master_fd)) {
+    work_t work;
+    int tag;
+    message_t message;
+    while (recv_message(master_fd, &message, &tag) == 0) {
+      if (message == WORK) {
+        CHECK_GE(recv_work(master_fd, &work), 0)
+          << "Error receiving from master";
+      } else if (message == TRACE) {
+        trace_hops_t ignored;
+        CHECK_GE(recv_trace(master_fd, &ignored), 0)
+          << "Error receiving from master";
+      }
+      harness_handle_message(message, tag, work, NULL);
+    }
+    return;
   }
+
+  if (FLAGS_io_uring &&
+      uring_recv_message_stream(master_fd, harness_handle_message, NULL)
+        != URING_UNAVAILABLE) {
+    return;
+  }
+  DLOG_IF(INFO, FLAGS_io_uring) << "io_uring unavailable, using recv";
+  recv_message_stream(master_fd, harness_handle_message, NULL);
 }
 
 void worker_send_response(const Response_msg& resp) {
 
-  resp_t comm_resp;
-  int tag = resp.get_tag();
-  int err;
+  tagged_resp_t comm_resp;
+  comm_resp.tag = resp.get_tag();
 
   // convert student-friendly Response_msg object to the comm layer's
   // resp_t
-  std::string resp_str = resp.get_response();
-  int allocation_size = resp_str.size();
-  comm_resp.buf = boost::make_shared<char[]>(allocation_size);
-  comm_resp.buf_len = allocation_size;
-  strncpy(comm_resp.buf.get(), resp_str.c_str(), allocation_size);
-
-  // send the reponse to the master node
-  //DLOG_IF(INFO, FLAGS_log_network) << work << " => " << comm_resp;
-  pthread_mutex_lock(&master_write_lock);
-  err = send_resp(master_fd, comm_resp, tag);
-  pthread_mutex_unlock(&master_write_lock);
-  CHECK_GE(err, 0) << "Error writing to master!";
-  DLOG_IF(INFO, FLAGS_log_network) << tag << "," << comm_resp << ") to master";
+  encode_response(resp.get_response(), master_encoding, &comm_resp.resp);
 
+  // hand the response to the sender thread
+  worker_stats_responded(comm_resp.tag);
+  cancel_release(comm_resp.tag);
+  outgoing_responses.put_work(comm_resp);
 }
 
 int main(int argc, char** argv) {
@@ -136,6 +296,10 @@ int main(int argc, char** argv) {
 
   std::string port = argv[1];
 
+  if (FLAGS_cpu_threads <= 0) {
+    FLAGS_cpu_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+
   harness_boot_worker(FLAGS_fast_boot, FLAGS_force_disk_io, FLAGS_assets_dir);
 
   Request_msg boot_req(0, FLAGS_workerparams);
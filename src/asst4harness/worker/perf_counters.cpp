@@ -0,0 +1,172 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "worker/perf_counters.h"
+
+DEFINE_bool(perf_counters, false,
+            "Count cycles, instructions, cache and branch misses and page "
+            "faults per command with perf_event_open");
+
+typedef struct {
+  uint32_t type;
+  uint64_t config;
+} perf_event_kind_t;
+
+static const perf_event_kind_t event_kinds[NUM_PERF_COUNTERS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+// A thread's counter group. 'slot' is where each counter sits in what
+// the group reads back, -1 if the host would not open it.
+typedef struct {
+  bool opened;
+  int leader;
+  int num_open;
+  int slot[NUM_PERF_COUNTERS];
+} thread_counters_t;
+
+static __thread thread_counters_t thread_counters;
+
+static pthread_mutex_t perf_lock = PTHREAD_MUTEX_INITIALIZER;
+static int perf_calls[MAX_STATS_CMDS];
+static long long perf_totals[MAX_STATS_CMDS][NUM_PERF_COUNTERS];
+
+// Whether some thread has failed to open each counter, and whether a
+// group has been multiplexed, to warn once.
+static int open_failed[NUM_PERF_COUNTERS];
+static int multiplexed;
+
+static int open_event(const perf_event_kind_t& kind, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = kind.type;
+  attr.config = kind.config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+    PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // User space only, which is also all an unprivileged process may count
+  // under the default perf_event_paranoid.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd,
+                 PERF_FLAG_FD_CLOEXEC);
+}
+
+static void open_thread_counters(thread_counters_t* c) {
+  c->opened = true;
+  c->leader = -1;
+  c->num_open = 0;
+  for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+    c->slot[i] = -1;
+    int fd = open_event(event_kinds[i], c->leader);
+    if (fd < 0) {
+      PLOG_IF(WARNING, !__sync_lock_test_and_set(&open_failed[i], 1))
+        << "Could not open the " << perf_counter_name(i) << " counter";
+      continue;
+    }
+    if (c->leader < 0)
+      c->leader = fd;
+    c->slot[i] = c->num_open++;
+  }
+}
+
+// Reads every counter of the calling thread's group, and the group's
+// enabled and running times, into 'sample'.
+static bool read_thread_counters(perf_sample_t* sample) {
+  thread_counters_t* c = &thread_counters;
+  if (!c->opened)
+    open_thread_counters(c);
+  if (c->leader < 0)
+    return false;
+
+  // nr, time_enabled, time_running, then the values
+  uint64_t buf[3 + NUM_PERF_COUNTERS];
+  ssize_t want = (3 + c->num_open) * sizeof(uint64_t);
+  if (read(c->leader, buf, sizeof(buf)) < want)
+    return false;
+  sample->enabled = buf[1];
+  sample->running = buf[2];
+  for (int i = 0; i < NUM_PERF_COUNTERS; i++)
+    sample->value[i] = c->slot[i] < 0 ? 0 : buf[3 + c->slot[i]];
+  return true;
+}
+
+void perf_counters_begin(perf_sample_t* sample) {
+  sample->counting = FLAGS_perf_counters && read_thread_counters(sample);
+}
+
+void perf_counters_end(int cmd, const perf_sample_t& sample) {
+  if (!sample.counting)
+    return;
+  perf_sample_t now;
+  if (!read_thread_counters(&now))
+    return;
+
+  // A group that never got the PMU during the call tells us nothing.
+  uint64_t enabled = now.enabled - sample.enabled;
+  uint64_t running = now.running - sample.running;
+  if (running == 0)
+    return;
+  double scale = 1.0;
+  if (running < enabled) {
+    scale = static_cast<double>(enabled) / running;
+    LOG_IF(WARNING, !__sync_lock_test_and_set(&multiplexed, 1))
+      << "perf counters are multiplexed; counts are scaled estimates";
+  }
+
+  pthread_mutex_lock(&perf_lock);
+  perf_calls[cmd]++;
+  for (int i = 0; i < NUM_PERF_COUNTERS; i++) {
+    perf_totals[cmd][i] +=
+      static_cast<long long>((now.value[i] - sample.value[i]) * scale + 0.5);
+  }
+  pthread_mutex_unlock(&perf_lock);
+}
+
+static double per_call(long long total, int calls) {
+  return static_cast<double>(total) / calls;
+}
+
+static double per_kilo(long long count, long long instructions) {
+  return instructions > 0 ? 1000.0 * count / instructions : 0;
+}
+
+void perf_counters_fill(worker_stats_t* stats) {
+  if (!FLAGS_perf_counters)
+    return;
+
+  pthread_mutex_lock(&perf_lock);
+  memcpy(stats->perf_calls, perf_calls, sizeof(perf_calls));
+  memcpy(stats->perf, perf_totals, sizeof(perf_totals));
+  memset(perf_calls, 0, sizeof(perf_calls));
+  memset(perf_totals, 0, sizeof(perf_totals));
+  pthread_mutex_unlock(&perf_lock);
+
+  for (int cmd = 0; cmd < MAX_STATS_CMDS; cmd++) {
+    int calls = stats->perf_calls[cmd];
+    if (calls == 0)
+      continue;
+    const long long* p = stats->perf[cmd];
+    VLOG(1) << "perf " << stats_cmd_name(cmd) << ": " << calls
+            << " calls, " << per_call(p[PERF_CYCLES], calls)
+            << " cycles/call, IPC "
+            << (p[PERF_CYCLES] > 0 ?
+                static_cast<double>(p[PERF_INSTRUCTIONS]) / p[PERF_CYCLES] : 0)
+            << ", cache misses/kinstr "
+            << per_kilo(p[PERF_CACHE_MISSES], p[PERF_INSTRUCTIONS])
+            << ", branch misses/kinstr "
+            << per_kilo(p[PERF_BRANCH_MISSES], p[PERF_INSTRUCTIONS])
+            << ", page faults/call " << per_call(p[PERF_PAGE_FAULTS], calls);
+  }
+}
@@ -0,0 +1,39 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef WORKER_PERF_COUNTERS_H_
+#define WORKER_PERF_COUNTERS_H_
+
+#include <stdint.h>
+
+#include "server/stats.h"
+#include "types/types.h"
+
+// Hardware counters around execute_work() for --perf_counters. Each
+// thread that runs work opens its own perf_event group the first time,
+// counting only that thread in user space, and the harness reads the
+// group before and after every call. The differences are summed per
+// command, go to the master in STATS replies and are logged by the
+// worker at --v=1. When the PMU has more groups than counters, the
+// kernel time-shares them; a call's counts are then scaled up by the
+// time its group was enabled over the time it ran, with a warning the
+// first time. Without the flag this is a single test per call. All of
+// these are thread-safe.
+
+typedef struct {
+  bool counting;
+  uint64_t value[NUM_PERF_COUNTERS];
+  uint64_t enabled;  // ns the group was enabled, and actually counting
+  uint64_t running;
+} perf_sample_t;
+
+// Reads the calling thread's counters ahead of an execute_work() call.
+void perf_counters_begin(perf_sample_t* sample);
+
+// Adds what the call counted since 'sample' to command 'cmd'.
+void perf_counters_end(int cmd, const perf_sample_t& sample);
+
+// Fills in the perf fields of a report, logs them, and starts counting
+// from zero again.
+void perf_counters_fill(worker_stats_t* stats);
+
+#endif  // WORKER_PERF_COUNTERS_H_
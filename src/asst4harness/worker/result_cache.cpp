@@ -0,0 +1,248 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <fcntl.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <list>
+#include <string>
+#include <utility>
+
+#include "worker/result_cache.h"
+
+DEFINE_int32(cache_mb, 16, "Memory for cached results (0 to disable)");
+DEFINE_string(cache_snapshot, "/tmp/asst4-worker-cache.snap",
+              "Local file shared by workers to warm each other's result "
+              "caches (empty to disable)");
+DEFINE_int32(cache_snapshot_period_s, 10,
+             "How often to rewrite the cache snapshot");
+
+#define SNAPSHOT_MAGIC "asst4cache 1\n"
+
+// Allowance for the list node and hash entry around each result.
+static const size_t ENTRY_OVERHEAD = 64;
+
+typedef std::pair<std::string, std::string> entry_t;
+typedef std::list<entry_t> lru_list_t;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static lru_list_t lru;  // most recently used first
+static boost::unordered_map<std::string, lru_list_t::iterator> by_key;
+static size_t cache_bytes = 0;
+static bool cache_dirty = false;
+static long long hits = 0;
+static long long misses = 0;
+
+static size_t budget() {
+  return static_cast<size_t>(FLAGS_cache_mb) << 20;
+}
+
+static size_t entry_size(const entry_t& entry) {
+  return entry.first.size() + entry.second.size() + ENTRY_OVERHEAD;
+}
+
+// Call with cache_lock held.
+static void insert_locked(const std::string& key, const std::string& result) {
+  boost::unordered_map<std::string, lru_list_t::iterator>::iterator it =
+    by_key.find(key);
+  if (it != by_key.end()) {
+    cache_bytes -= entry_size(*it->second);
+    lru.erase(it->second);
+    by_key.erase(it);
+  }
+
+  lru.push_front(entry_t(key, result));
+  by_key[key] = lru.begin();
+  cache_bytes += entry_size(lru.front());
+  cache_dirty = true;
+
+  while (cache_bytes > budget() && !lru.empty()) {
+    cache_bytes -= entry_size(lru.back());
+    by_key.erase(lru.back().first);
+    lru.pop_back();
+  }
+}
+
+bool result_cache_lookup(const std::string& key, std::string* result) {
+  if (FLAGS_cache_mb <= 0)
+    return false;
+
+  bool found = false;
+  pthread_mutex_lock(&cache_lock);
+  boost::unordered_map<std::string, lru_list_t::iterator>::iterator it =
+    by_key.find(key);
+  if (it != by_key.end()) {
+    lru.splice(lru.begin(), lru, it->second);
+    *result = it->second->second;
+    found = true;
+    hits++;
+  } else {
+    misses++;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return found;
+}
+
+void result_cache_insert(const std::string& key, const std::string& result) {
+  if (FLAGS_cache_mb <= 0)
+    return;
+
+  pthread_mutex_lock(&cache_lock);
+  insert_locked(key, result);
+  pthread_mutex_unlock(&cache_lock);
+}
+
+// Snapshot format: SNAPSHOT_MAGIC, then for each entry, least recently
+// used first, a u32 key length, the key, a u32 result length and the
+// result. A truncated tail is ignored.
+
+static bool write_string(FILE* f, const std::string& str) {
+  uint32_t len = str.size();
+  return fwrite(&len, sizeof(len), 1, f) == 1 &&
+    fwrite(str.data(), 1, len, f) == len;
+}
+
+static bool read_string(FILE* f, std::string* str) {
+  uint32_t len;
+  if (fread(&len, sizeof(len), 1, f) != 1 || len > (1U << 20))
+    return false;
+  str->resize(len);
+  return len == 0 || fread(&(*str)[0], 1, len, f) == len;
+}
+
+// Reads the snapshot's entries, least recently used first. Returns
+// false if there is no snapshot.
+static bool read_snapshot(lru_list_t* entries) {
+  FILE* f = fopen(FLAGS_cache_snapshot.c_str(), "rb");
+  if (f == NULL)
+    return false;
+
+  char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+  if (fread(magic, sizeof(magic), 1, f) == 1 &&
+      std::string(magic, sizeof(magic)) == SNAPSHOT_MAGIC) {
+    entry_t entry;
+    while (read_string(f, &entry.first) && read_string(f, &entry.second)) {
+      entries->push_back(entry);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+static void load_snapshot() {
+  lru_list_t entries;
+  if (!read_snapshot(&entries))
+    return;
+
+  pthread_mutex_lock(&cache_lock);
+  lru_list_t::iterator it;
+  for (it = entries.begin(); it != entries.end(); it++) {
+    insert_locked(it->first, it->second);
+  }
+  cache_dirty = false;
+  pthread_mutex_unlock(&cache_lock);
+  DLOG(INFO) << "Warmed result cache with " << entries.size()
+             << " entries from " << FLAGS_cache_snapshot;
+}
+
+// Every worker on the host writes the same snapshot, so each write is a
+// union: the entries already there that this worker lacks are kept, as
+// older than its own, and the oldest of them are dropped to stay within
+// --cache_mb. Writers take turns through a lock file, so none replaces
+// entries it has not read. The snapshot is written to a private file and
+// renamed into place, so readers only ever see a whole one.
+static void write_snapshot() {
+  lru_list_t entries;
+  pthread_mutex_lock(&cache_lock);
+  if (cache_dirty)
+    entries = lru;
+  cache_dirty = false;
+  long long cache_hits = hits;
+  long long cache_misses = misses;
+  pthread_mutex_unlock(&cache_lock);
+  if (entries.empty())
+    return;
+
+  std::string lock_path = FLAGS_cache_snapshot + ".lock";
+  int lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (lock_fd < 0 || flock(lock_fd, LOCK_EX) < 0)
+    PLOG(WARNING) << "Could not lock " << lock_path;
+
+  boost::unordered_set<std::string> ours;
+  size_t bytes = 0;
+  lru_list_t::iterator it;
+  for (it = entries.begin(); it != entries.end(); it++) {
+    ours.insert(it->first);
+    bytes += entry_size(*it);
+  }
+
+  // peers' entries, most recent first, while they fit
+  lru_list_t peers;
+  size_t num_ours = entries.size();
+  read_snapshot(&peers);
+  lru_list_t::reverse_iterator peer;
+  for (peer = peers.rbegin(); peer != peers.rend(); peer++) {
+    if (ours.count(peer->first))
+      continue;
+    bytes += entry_size(*peer);
+    if (bytes > budget())
+      break;
+    entries.push_back(*peer);
+  }
+
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.%d", FLAGS_cache_snapshot.c_str(), getpid());
+  FILE* f = fopen(tmp, "wb");
+  bool ok = f != NULL;
+  if (ok) {
+    ok = fwrite(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC) - 1, 1, f) == 1;
+    lru_list_t::reverse_iterator entry;
+    for (entry = entries.rbegin(); ok && entry != entries.rend(); entry++) {
+      ok = write_string(f, entry->first) && write_string(f, entry->second);
+    }
+    ok = (fclose(f) == 0) && ok;
+  }
+  ok = ok && rename(tmp, FLAGS_cache_snapshot.c_str()) == 0;
+  if (!ok) {
+    PLOG(WARNING) << "Could not write cache snapshot "
+                  << FLAGS_cache_snapshot;
+    unlink(tmp);
+  }
+
+  if (lock_fd >= 0)
+    close(lock_fd);
+  if (!ok)
+    return;
+  DLOG(INFO) << "Wrote " << num_ours << " cached results and "
+             << entries.size() - num_ours << " of other workers' to "
+             << FLAGS_cache_snapshot << " (" << cache_hits << " hits, "
+             << cache_misses << " misses so far)";
+}
+
+static void* snapshot_writer(void*) {
+  for (;;) {
+    sleep(FLAGS_cache_snapshot_period_s);
+    write_snapshot();
+  }
+  return NULL;
+}
+
+void result_cache_init() {
+  if (FLAGS_cache_mb <= 0 || FLAGS_cache_snapshot.empty())
+    return;
+
+  load_snapshot();
+
+  if (FLAGS_cache_snapshot_period_s > 0) {
+    pthread_t writer;
+    CHECK_EQ(pthread_create(&writer, NULL, snapshot_writer, NULL), 0)
+      << "Couldn't start cache snapshot writer";
+  }
+}
@@ -0,0 +1,26 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef WORKER_RESULT_CACHE_H_
+#define WORKER_RESULT_CACHE_H_
+
+#include <string>
+
+// Answers to expensive requests, kept so that a repeat costs a lookup.
+// Keys name everything a result depends on (see the callers in
+// work_engine.cpp). Entries are dropped least recently used first once
+// the cache passes --cache_mb.
+//
+// The cache is written now and then to a snapshot file on local disk
+// (--cache_snapshot), and a worker starting up loads whatever snapshot
+// is there, so a worker booted into a burst already knows the answers
+// its peers have computed. All of these are thread-safe.
+
+// Loads the snapshot and starts the thread that rewrites it.
+void result_cache_init();
+
+// Returns true, with the result, if 'key' is cached.
+bool result_cache_lookup(const std::string& key, std::string* result);
+
+void result_cache_insert(const std::string& key, const std::string& result);
+
+#endif  // WORKER_RESULT_CACHE_H_
@@ -0,0 +1,129 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <boost/unordered_map.hpp>
+#include <gflags/gflags.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tools/cycle_timer.h"
+#include "types/wire.h"
+#include "worker/perf_counters.h"
+#include "worker/stats.h"
+
+DECLARE_int32(cpu_threads);
+DECLARE_int32(memory_threads);
+DECLARE_int32(io_threads);
+
+// Weight of the newest sample in the running averages.
+static const float STATS_EWMA_WEIGHT = 0.2f;
+
+typedef struct {
+  int cmd;
+  double received;
+} pending_request_t;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Master tags are only meant to be unique among outstanding requests, so
+// allow for repeats.
+static boost::unordered_multimap<int, pending_request_t> pending;
+
+static int queue_depth[NUM_WORK_CLASSES];
+static int busy_threads[NUM_WORK_CLASSES];
+static int completed[MAX_STATS_CMDS];
+static float service_ms[MAX_STATS_CMDS];
+static float latency_ms[MAX_STATS_CMDS];
+
+static void add_sample(float* average, double ms) {
+  if (*average == 0)
+    *average = ms;
+  else
+    *average += STATS_EWMA_WEIGHT * (ms - *average);
+}
+
+int work_class_of(int cmd) {
+  return cmd == WIRE_CMD_MOSTVIEWED ? WORK_CLASS_DISK : WORK_CLASS_CPU;
+}
+
+void worker_stats_received(const Request_msg& req) {
+  pending_request_t request;
+  request.cmd = stats_cmd_index(req.get_arg("cmd"));
+  request.received = CycleTimer::currentSeconds();
+
+  pthread_mutex_lock(&stats_lock);
+  pending.insert(std::make_pair(req.get_tag(), request));
+  queue_depth[work_class_of(request.cmd)]++;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+void worker_stats_responded(int tag) {
+  double now = CycleTimer::currentSeconds();
+
+  pthread_mutex_lock(&stats_lock);
+  boost::unordered_multimap<int, pending_request_t>::iterator it =
+    pending.find(tag);
+  if (it != pending.end()) {
+    int cmd = it->second.cmd;
+    queue_depth[work_class_of(cmd)]--;
+    completed[cmd]++;
+    add_sample(&latency_ms[cmd], 1000.0 * (now - it->second.received));
+    pending.erase(it);
+  }
+  pthread_mutex_unlock(&stats_lock);
+}
+
+double worker_stats_begin_execute(int cmd, int work_class) {
+  (void)cmd;
+  __sync_fetch_and_add(&busy_threads[work_class], 1);
+  return CycleTimer::currentSeconds();
+}
+
+void worker_stats_end_execute(int cmd, int work_class, double start) {
+  double ms = 1000.0 * (CycleTimer::currentSeconds() - start);
+  __sync_fetch_and_sub(&busy_threads[work_class], 1);
+
+  pthread_mutex_lock(&stats_lock);
+  add_sample(&service_ms[cmd], ms);
+  pthread_mutex_unlock(&stats_lock);
+}
+
+static long long read_rss_kb() {
+  long pages = 0;
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (statm != NULL) {
+    if (fscanf(statm, "%*d %ld", &pages) != 1)
+      pages = 0;
+    fclose(statm);
+  }
+  return static_cast<long long>(pages) * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void worker_stats_fill(worker_stats_t* stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->cpu_threads = FLAGS_cpu_threads;
+  stats->memory_threads = FLAGS_memory_threads;
+  stats->io_threads = FLAGS_io_threads;
+  stats->rss_kb = read_rss_kb();
+
+  double load;
+  if (getloadavg(&load, 1) == 1)
+    stats->load_average = load;
+
+  pthread_mutex_lock(&stats_lock);
+  for (int i = 0; i < NUM_WORK_CLASSES; i++) {
+    stats->queue_depth[i] = queue_depth[i];
+    stats->busy_threads[i] = busy_threads[i];
+  }
+  for (int i = 0; i < MAX_STATS_CMDS; i++) {
+    stats->completed[i] = completed[i];
+    stats->service_ms[i] = service_ms[i];
+    stats->latency_ms[i] = latency_ms[i];
+    completed[i] = 0;
+  }
+  pthread_mutex_unlock(&stats_lock);
+
+  perf_counters_fill(stats);
+}
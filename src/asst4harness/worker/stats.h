@@ -0,0 +1,30 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef WORKER_STATS_H_
+#define WORKER_STATS_H_
+
+#include "server/messages.h"
+#include "types/types.h"
+
+// Load accounting behind the worker's STATS replies. The harness calls
+// these around the student's code, so every worker reports the same way
+// however it schedules its work. All of them are thread-safe.
+
+// A request from the master is about to be handed to the student code.
+void worker_stats_received(const Request_msg& req);
+
+// The response to the request tagged 'tag' is on its way to the master.
+void worker_stats_responded(int tag);
+
+// Bracket one call of execute_work(); begin returns the start time to
+// pass to end.
+double worker_stats_begin_execute(int cmd, int work_class);
+void worker_stats_end_execute(int cmd, int work_class, double start);
+
+// Fills in a report. Completion counts restart from zero afterwards.
+void worker_stats_fill(worker_stats_t* stats);
+
+// The class a request is accounted under.
+int work_class_of(int cmd);
+
+#endif  // WORKER_STATS_H_
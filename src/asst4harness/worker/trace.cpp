@@ -0,0 +1,62 @@
+// Copyright 2013 15418 Course Staff.
+
+#include <boost/unordered_map.hpp>
+#include <pthread.h>
+#include <string.h>
+
+#include "tools/cycle_timer.h"
+#include "worker/trace.h"
+
+static volatile int enabled = 0;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static boost::unordered_map<int, trace_hops_t> hops;
+
+void trace_enable() {
+  enabled = 1;
+}
+
+bool trace_enabled() {
+  return enabled;
+}
+
+void trace_received(int tag) {
+  if (!enabled)
+    return;
+
+  double now = CycleTimer::currentSeconds();
+  pthread_mutex_lock(&trace_lock);
+  trace_hops_t& h = hops[tag];
+  if (h.received == 0)
+    h.received = now;
+  pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_executed(int tag, double start, double end) {
+  if (!enabled)
+    return;
+
+  // A request split into pieces runs execute_work() several times;
+  // keep the span that covers all of them.
+  pthread_mutex_lock(&trace_lock);
+  trace_hops_t& h = hops[tag];
+  if (h.execute_start == 0 || start < h.execute_start)
+    h.execute_start = start;
+  if (end > h.execute_end)
+    h.execute_end = end;
+  pthread_mutex_unlock(&trace_lock);
+}
+
+trace_hops_t trace_take(int tag) {
+  trace_hops_t h;
+  memset(&h, 0, sizeof(h));
+
+  pthread_mutex_lock(&trace_lock);
+  boost::unordered_map<int, trace_hops_t>::iterator it = hops.find(tag);
+  if (it != hops.end()) {
+    h = it->second;
+    hops.erase(it);
+  }
+  pthread_mutex_unlock(&trace_lock);
+  return h;
+}
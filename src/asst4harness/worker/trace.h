@@ -0,0 +1,27 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef WORKER_TRACE_H_
+#define WORKER_TRACE_H_
+
+#include "types/types.h"
+
+// Per-request hop timestamps for the master's --trace_file. Nothing is
+// recorded until the master turns tracing on, and after that each
+// response is preceded by a TRACE carrying the hops of its request. All
+// of these are thread-safe.
+
+// The master sent TRACE: start recording.
+void trace_enable();
+
+bool trace_enabled();
+
+// A request tagged 'tag' has arrived.
+void trace_received(int tag);
+
+// An execute_work() call for 'tag' spanned [start, end].
+void trace_executed(int tag, double start, double end);
+
+// Removes and returns the hops recorded for 'tag' (all 0 if none).
+trace_hops_t trace_take(int tag);
+
+#endif  // WORKER_TRACE_H_
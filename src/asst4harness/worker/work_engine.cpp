@@ -1,19 +1,32 @@
 // Copyright 2013 Course Staff.
 
 #include <boost/make_shared.hpp>
+#include <errno.h>
+#include <fcntl.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <string>
-#include <fstream> // NOLINT
 #include <map>
+#include <vector>
 
+#include "comm/uring.h"
 #include "server/messages.h"
 #include "server/worker.h"
+#include "tools/cycle_timer.h"
+#include "worker/cancel.h"
+#include "worker/perf_counters.h"
+#include "worker/result_cache.h"
+#include "worker/stats.h"
+#include "worker/trace.h"
+
+DEFINE_bool(io_uring, true,
+            "Use io_uring for the master connection and pageview reads");
 
 static char* balloon_allocation = NULL;
 
@@ -67,64 +80,150 @@ struct Date {
   }
 };
 
-std::string find_most_popular(const std::string& filename,
-                              const Date& startDate, const Date& endDate) {
-  std::ifstream db;
+// Tallies lecture page views from the pageviews file, which is a
+// sequence of three-line records: timestamp, url, browser. The file is
+// fed through in large chunks and split into lines here, but the
+// records are assembled exactly as the original getline() loop did,
+// including its end-of-file quirks: a last line without a newline still
+// counts, a record cut short reuses the previous record's later fields,
+// and the empty read after a final newline yields one more record made
+// of an empty timestamp and the previous url (with the previous date,
+// since parsing an empty timestamp leaves the date alone).
+class PageViewCounter {
+ public:
+  PageViewCounter(const Date& argStartDate, const Date& argEndDate)
+      : startDate(argStartDate), endDate(argEndDate), field(0) {}
+
+  static bool feed_chunk(const char* buf, size_t len, void* arg) {
+    static_cast<PageViewCounter*>(arg)->feed(buf, len);
+    return !job_cancelled();
+  }
 
-  db.open(filename.c_str());
+  void feed(const char* buf, size_t len) {
+    const char* end = buf + len;
+    while (buf < end) {
+      const char* nl = static_cast<const char*>(memchr(buf, '\n', end - buf));
+      if (nl == NULL) {
+        partial.append(buf, end - buf);
+        return;
+      }
+      if (partial.empty()) {
+        line(buf, nl - buf);
+      } else {
+        partial.append(buf, nl - buf);
+        line(partial.data(), partial.size());
+        partial.clear();
+      }
+      buf = nl + 1;
+    }
+  }
 
-  if (!db.is_open()) {
-    DLOG(ERROR) << "Could not open pageviews file " << filename;
-    return std::string("Could not open pageviews file");
+  // Called once at end of file; fields not reached keep stale values.
+  void finish() {
+    if (field == 0 && partial.empty()) {
+      timestamp.clear();
+    } else if (!partial.empty()) {
+      if (field < 2) field_value()->assign(partial);
+    } else if (field == 1) {
+      page_url.clear();
+    }
+    record();
   }
 
-  std::string timestamp;
-  std::string page_url;
-  std::string browser;
+  std::string most_viewed() const {
+    std::string mostViewed;
+    int mostViewedCount = 0;
 
-  std::map<std::string, int> page_counts;
+    std::map<std::string, int>::const_iterator it;
+    for (it = page_counts.begin(); it != page_counts.end(); it++) {
+      if (it->second > mostViewedCount) {
+        mostViewedCount = it->second;
+        mostViewed = it->first;
+      }
+    }
 
-  Date viewDate;
+    char str[1024];
+    snprintf(str, sizeof(str),
+             "%s -- %d views", mostViewed.c_str(), mostViewedCount);
+    return std::string(str);
+  }
+
+ private:
+  std::string* field_value() {
+    return field == 0 ? &timestamp : &page_url;
+  }
 
-  while (db.good()) {
-    getline(db, timestamp);
-    getline(db, page_url);
-    getline(db, browser);
+  void line(const char* p, size_t len) {
+    // the browser is never looked at
+    if (field < 2) field_value()->assign(p, len);
+    if (++field == 3) {
+      record();
+      field = 0;
+    }
+  }
 
+  void record() {
     // if it is not a lecture, ignore it
     if (page_url.find("lecture/") == std::string::npos)
-      continue;
+      return;
 
     viewDate.parse(timestamp);
 
     // if the item is in the date range, add to counts
-    if (viewDate.within(startDate, endDate)) {
-        if (page_counts.find(page_url) == page_counts.end()) {
-            page_counts[page_url] = 1;
-      } else {
-            page_counts[page_url]++;
-        }
-    }
+    if (viewDate.within(startDate, endDate))
+      page_counts[page_url]++;
+  }
+
+  const Date startDate;
+  const Date endDate;
+  int field;
+  std::string partial;
+  std::string timestamp;
+  std::string page_url;
+  Date viewDate;
+  std::map<std::string, int> page_counts;
+};
+
+static const char NO_PAGEVIEWS_FILE[] = "Could not open pageviews file";
+
+// Returns false, with no result, if the job was cancelled part way.
+bool find_most_popular(const std::string& filename, const Date& startDate,
+                       const Date& endDate, std::string* result) {
+  int fd = open(filename.c_str(), O_RDONLY);
+
+  if (fd < 0) {
+    DLOG(ERROR) << "Could not open pageviews file " << filename;
+    *result = NO_PAGEVIEWS_FILE;
+    return true;
   }
 
-  std::string mostViewed;
-  int mostViewedCount = 0;
+  PageViewCounter counter(startDate, endDate);
 
-  std::map<std::string, int>::iterator it;
-  for (it = page_counts.begin(); it != page_counts.end(); it++) {
-    if (it->second > mostViewedCount) {
-      mostViewedCount = it->second;
-      mostViewed = it->first;
+  int err = URING_UNAVAILABLE;
+  if (FLAGS_io_uring) {
+    err = uring_read_file(fd, PageViewCounter::feed_chunk, &counter);
+  }
+  if (err == URING_UNAVAILABLE) {
+    std::vector<char> buf(URING_READ_CHUNK);
+    ssize_t len;
+    while ((len = read(fd, &buf[0], buf.size())) != 0) {
+      if (len < 0 && errno == EINTR) continue;
+      if (len < 0) break;
+      if (!PageViewCounter::feed_chunk(&buf[0], len, &counter)) break;
     }
   }
+  PLOG_IF(ERROR, err == -1) << "Error reading pageviews file " << filename;
+  close(fd);
+
+  if (job_cancelled())
+    return false;
 
-  char str[1024];
-  snprintf(str, sizeof(str),
-           "%s -- %d views", mostViewed.c_str(), mostViewedCount);
-  return std::string(str);
+  counter.finish();
+  *result = counter.most_viewed();
+  return true;
 }
 
-void find_popular_pages(const Request_msg& req, Response_msg& resp) {
+bool find_popular_pages(const Request_msg& req, Response_msg& resp) {
 
   Date startDate;
   Date endDate;
@@ -145,13 +244,31 @@ void find_popular_pages(const Request_msg& req, Response_msg& resp) {
 
   char tmp_buffer[2048];
   sprintf(tmp_buffer, "%s_%02d.txt", ioJobFilebase.c_str(), fileIndex);
-  std::string result = find_most_popular(std::string(tmp_buffer), startDate, endDate);
 
+  // with --force_disk_io every request has to really read the file
+  std::string key = std::string("mostviewed;file=") + tmp_buffer +
+    ";start=" + startDate.toString() + ";end=" + endDate.toString();
+  std::string result;
+  if (!forceDiskReads && result_cache_lookup(key, &result)) {
+    resp.set_response(result);
+    return true;
+  }
+
+  if (!find_most_popular(std::string(tmp_buffer), startDate, endDate, &result))
+    return false;
+
+  if (result != NO_PAGEVIEWS_FILE)
+    result_cache_insert(key, result);
   resp.set_response(result);
+  return true;
 }
 
+// Long-running kernels look for cancellation about this often (in
+// iterations of their innermost loop), which costs nothing measurable
+// and stops them within a few milliseconds.
+#define CANCEL_CHECK_INTERVAL (1 << 20)
 
-void high_compute_job(const Request_msg& req, Response_msg& resp) {
+bool high_compute_job(const Request_msg& req, Response_msg& resp) {
 
   const char* motivation[16] = {
     "You are going to do a great project",
@@ -175,23 +292,36 @@ void high_compute_job(const Request_msg& req, Response_msg& resp) {
   int iters = 175 * 1000 * 1000;
   unsigned int seed = atoi(req.get_arg("x").c_str());
 
+  char key[64];
+  sprintf(key, "418wisdom;x=%u", seed);
+  std::string result;
+  if (result_cache_lookup(key, &result)) {
+    resp.set_response(result);
+    return true;
+  }
+
   for (int i=0; i<iters; i++) {
+    if (i % CANCEL_CHECK_INTERVAL == 0 && job_cancelled())
+      return false;
     seed = rand_r(&seed);
   }
 
   int idx = seed % 16;
+  result_cache_insert(key, motivation[idx]);
   resp.set_response(motivation[idx]);
+  return true;
 }
 
-void mini_compute_job(const Request_msg& req, Response_msg& resp) {
+bool mini_compute_job(const Request_msg& req, Response_msg& resp) {
   char tmp_buffer[1024];
   int number = atoi(req.get_arg("x").c_str());
   int square = number * number;
   sprintf(tmp_buffer, "%d", square);
   resp.set_response(tmp_buffer);
+  return true;
 }
 
-void high_mem_job(const Request_msg& req, Response_msg& resp) {
+bool high_mem_job(const Request_msg& req, Response_msg& resp) {
 
   // this job will allocate 512 MB of RAM, and then write to it
   // several times
@@ -202,26 +332,45 @@ void high_mem_job(const Request_msg& req, Response_msg& resp) {
     allocation[i] = 0;
 
   for (int iter=0; iter<2; iter++) {
+    if (job_cancelled()) {
+      delete[] allocation;
+      return false;
+    }
     for (int i=0; i<buffer_size; i++) {
       allocation[i] += static_cast<char>(iter);
     }
   }
 
   resp.set_response("my result");
+  return true;
 }
 
-void count_primes_job(const Request_msg& req, Response_msg& resp) {
+bool count_primes_job(const Request_msg& req, Response_msg& resp) {
 
   int N = atoi(req.get_arg("n").c_str());
 
+  char key[64];
+  sprintf(key, "countprimes;n=%d", N);
+  std::string result;
+  if (result_cache_lookup(key, &result)) {
+    resp.set_response(result);
+    return true;
+  }
+
   int NUM_ITER = 10;
   int count;
 
   for (int iter = 0; iter < NUM_ITER; iter++) {
+    if (job_cancelled())
+      return false;
+
     count = (N >= 2) ? 1 : 0; // since 2 is prime
 
     for (int i = 3; i < N; i+=2) {    // For every odd number
 
+      if (i % CANCEL_CHECK_INTERVAL == 1 && job_cancelled())
+        return false;
+
       int prime;
       int div1, div2, rem;
 
@@ -246,33 +395,60 @@ void count_primes_job(const Request_msg& req, Response_msg& resp) {
 
   char tmp_buffer[32];
   sprintf(tmp_buffer, "%d", count);
+  result_cache_insert(key, tmp_buffer);
   resp.set_response(tmp_buffer);
+  return true;
 }
 
 
 
-void execute_work(const Request_msg& req, Response_msg& resp) {
-
-  std::string cmd = req.get_arg("cmd");
+// Returns false if the job gave up because it was cancelled.
+static bool run_work(const std::string& cmd, const Request_msg& req,
+                     Response_msg& resp) {
 
-  if (cmd.compare("mostviewed") == 0) {
-    find_popular_pages(req, resp);
+  if (job_cancelled()) {
+    return false;
+  }
+  else if (cmd.compare("mostviewed") == 0) {
+    return find_popular_pages(req, resp);
   }
   else if (cmd.compare("418wisdom") == 0) {
-    high_compute_job(req, resp);
+    return high_compute_job(req, resp);
   }
   else if (cmd.compare("countprimes") == 0) {
-    count_primes_job(req, resp);
+    return count_primes_job(req, resp);
   }
   else if (cmd.compare("minicompute") == 0) {
-    mini_compute_job(req, resp);
+    return mini_compute_job(req, resp);
   }
   else if (cmd.compare("highmem") == 0) {
-    high_mem_job(req, resp);
+    return high_mem_job(req, resp);
   }
   else {
     resp.set_response("unknown command");
+    return true;
+  }
+}
+
+void execute_work(const Request_msg& req, Response_msg& resp) {
+
+  std::string cmd = req.get_arg("cmd");
+  int stats_cmd = stats_cmd_index(cmd);
+  int work_class = work_class_of(stats_cmd);
+
+  cancel_token* previous = cancel_begin_job(req.get_tag());
+  double start = worker_stats_begin_execute(stats_cmd, work_class);
+  perf_sample_t perf;
+  perf_counters_begin(&perf);
+  if (!run_work(cmd, req, resp)) {
+    resp.set_response(job_status() == JOB_DEADLINE_EXCEEDED ?
+                      DEADLINE_EXCEEDED_RESPONSE : CANCELLED_RESPONSE);
   }
+  perf_counters_end(stats_cmd, perf);
+  worker_stats_end_execute(stats_cmd, work_class, start);
+  if (trace_enabled())
+    trace_executed(req.get_tag(), start, CycleTimer::currentSeconds());
+  cancel_end_job(previous);
 }
 
 
@@ -282,6 +458,8 @@ void init_work_engine(bool forceDiskIO, const std::string& assetsDir) {
 
   forceDiskReads = forceDiskIO;
 
+  result_cache_init();
+
   sprintf(tmp_buffer, "%s/pageviews_med", assetsDir.c_str());
   ioJobFilebase = std::string(tmp_buffer);
 
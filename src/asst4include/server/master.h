@@ -7,6 +7,7 @@
 
 class Response_msg;
 class Request_msg;
+struct Worker_stats;
 
 typedef void* Client_handle;
 typedef void* Worker_handle;
@@ -22,6 +23,10 @@ typedef void* Worker_handle;
 
 /**
  * @brief Sends resp to the client designated by client_handle
+ *
+ * Each client_handle stands for a single request and must be answered
+ * exactly once; it is invalid afterwards. Clients may pipeline requests
+ * on one connection, so responses may be sent in any order.
  */
 void send_client_response(Client_handle client_handle, const Response_msg& resp);
 
@@ -33,9 +38,34 @@ void send_client_response(Client_handle client_handle, const Response_msg& resp)
  * mechanism can be used to identify between responses from a worker
  * if a number are sent to it at the same time). When the response is
  * received, handle_worker_response() will be called.
+ *
+ * A duplicate of work already sent should carry a "hedge_of" argument
+ * holding the earlier copy's tag, so the harness counts the request's
+ * queue wait to its first dispatch.
  */
 void send_request_to_worker(Worker_handle worker_handle, const Request_msg& req);
 
+/**
+ * @brief Ask a worker to abandon the request tagged 'tag'.
+ *
+ * The worker stops the work at its next check and still responds,
+ * with CANCELLED_RESPONSE, unless it had already finished; either way
+ * handle_worker_response() sees exactly one response for the tag.
+ * Requests may also carry a "deadline_ms" argument (see
+ * --request_deadline_ms), after which the worker answers
+ * DEADLINE_EXCEEDED_RESPONSE on its own.
+ */
+void cancel_worker_request(Worker_handle worker_handle, int tag);
+
+/**
+ * @brief Whether the client that sent a request is still there to
+ * receive its response.
+ *
+ * A response to a departed client is dropped, so work still running
+ * for it can be cancelled.
+ */
+bool client_is_connected(Client_handle client_handle);
+
 /**
  * @brief Request a new worker node
  *
@@ -55,6 +85,14 @@ void request_new_worker_node(const Request_msg& req);
  */
 void kill_worker_node(Worker_handle worker_handle);
 
+/**
+ * @brief Seconds on the harness clock.
+ *
+ * Time things with this rather than by reading a clock directly: under
+ * the scheduler simulator (the sim program) the clock is virtual.
+ */
+double master_current_time();
+
 /**
  * @brief Tell the master process the server is ready to accept requests
  *
@@ -85,7 +123,8 @@ void master_node_init(int max_workers, int& tick_period);
 /**
  * @brief Handle new work from a remote client.
  *
- * This work needs to be serviced, presumably by a worker.
+ * This work needs to be serviced, presumably by a worker. client_handle
+ * identifies this request, not just the connection it arrived on.
  */
 void handle_client_request(Client_handle client_handle, const Request_msg& req);
 
@@ -106,6 +145,14 @@ void handle_worker_response(Worker_handle worker_handle, const Response_msg& res
  */
 void handle_new_worker_online(Worker_handle worker_handle, int tag);
 
+/**
+ * @brief Handle a load report from a worker.
+ *
+ * The harness polls every worker periodically (see --stats_period_ms);
+ * each reply arrives here. Include "server/stats.h" for the fields.
+ */
+void handle_worker_stats(Worker_handle worker_handle, const Worker_stats& stats);
+
 /**
  * @brief Handle a timer tick.
  *
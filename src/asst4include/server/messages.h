@@ -1,16 +1,47 @@
 #ifndef __LIBASST4_MESSAGES_H__
 #define __LIBASST4_MESSAGES_H__
 
-#include <map>
 #include <string>
 
+#include "tools/frame_pool.h"
 
+
+// A Request_msg is a small handle onto the frame its arguments were
+// parsed from: copying one shares the frame instead of the strings, and
+// set_arg() copies the arguments into a fresh frame before changing them.
 class Request_msg {
 
+  // The harness wire codec walks the argument dictionary directly.
+  friend class WireCodec;
+
+  public:
+  // One key=value pair. Both point into 'frame' (or, for well-known
+  // keys, into static storage) and are not null terminated. Integers
+  // that arrived in binary stay typed: 'value' is NULL and get_arg()
+  // formats 'int_value' when asked. 'key_id' is the key's number in the
+  // binary encoding, or 0 if it has none or nobody has looked yet.
+  struct Arg {
+    const char* key;
+    const char* value;
+    int key_len;
+    int value_len;
+    int key_id;
+    int int_value;
+  };
+
   private:
-     std::map<std::string, std::string> dict;
-     std::string request_str;
      int tag;
+     frame_ptr frame;
+     const Arg* args;
+     int num_args;
+
+     void parse_text(const frame_ptr& src, int len);
+     static Arg* reserve_args(frame_ptr* frame, int len, int extra,
+                              int max_args);
+     const Arg* find_arg(const char* name, int name_len) const;
+
+     static const int INT_TEXT_SIZE = 12;  // any int, as "%d" prints it
+     static int format_int(const Arg& arg, char* buf);
 
   public:
   Request_msg(int tag);
@@ -26,6 +57,12 @@ class Request_msg {
 };
 
 
+// What execute_work() answers with when a job stops early, either
+// because the master cancelled it or because the request's
+// "deadline_ms" ran out.
+#define CANCELLED_RESPONSE "cancelled"
+#define DEADLINE_EXCEEDED_RESPONSE "deadline exceeded"
+
 class Response_msg {
 
 private:
@@ -0,0 +1,80 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef __ASST4INCLUDE_STATS_H__
+#define __ASST4INCLUDE_STATS_H__
+
+#include <string>
+
+/**
+ ******************************************************************
+ * Worker load reports, delivered to the master through
+ * handle_worker_stats()
+ ******************************************************************
+ */
+
+enum {
+  WORK_CLASS_CPU,   // everything but mostviewed
+  WORK_CLASS_DISK,  // mostviewed
+  NUM_WORK_CLASSES
+};
+
+// Per-command arrays are indexed by stats_cmd_index(); index 0 collects
+// commands the harness does not know.
+#define MAX_STATS_CMDS 8
+
+// Hardware and kernel event counts; see Worker_stats::perf.
+enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_CACHE_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_PAGE_FAULTS,
+  NUM_PERF_COUNTERS
+};
+
+struct Worker_stats {
+  // Threads the worker was started with.
+  int cpu_threads;
+  int memory_threads;
+  int io_threads;
+
+  // Requests received and not yet answered, and threads currently
+  // inside execute_work(), per class.
+  int queue_depth[NUM_WORK_CLASSES];
+  int busy_threads[NUM_WORK_CLASSES];
+
+  // Per command: requests answered since the previous report, and
+  // recent averages of execute_work() time and of the time from receipt
+  // to response, in milliseconds (0 if never seen).
+  int completed[MAX_STATS_CMDS];
+  float service_ms[MAX_STATS_CMDS];
+  float latency_ms[MAX_STATS_CMDS];
+
+  long long rss_kb;
+  float load_average;  // 1-minute system load average
+
+  // Per command, only with the worker's --perf_counters: how many
+  // execute_work() calls were counted since the previous report, and
+  // the events they caused on their own threads, summed. A counter the
+  // host cannot provide stays 0.
+  int perf_calls[MAX_STATS_CMDS];
+  long long perf[MAX_STATS_CMDS][NUM_PERF_COUNTERS];
+};
+
+/**
+ * @brief Maps a request's "cmd" argument to its index in the per
+ * command arrays of Worker_stats.
+ */
+int stats_cmd_index(const std::string& cmd);
+
+/**
+ * @brief Name of the command at 'index', or "other" for index 0.
+ */
+const char* stats_cmd_name(int index);
+
+/**
+ * @brief Name of the counter at 'index' in Worker_stats::perf.
+ */
+const char* perf_counter_name(int index);
+
+#endif  // __ASST4INCLUDE_STATS_H__
@@ -23,9 +23,30 @@ void worker_send_response(const Response_msg& resp);
  * Notes: It can be assumed that is req is a request that can from the
  * client, resp is the correct response expected by the grading
  * harness.
+ *
+ * If the master cancels the request, or its "deadline_ms" runs out,
+ * the work stops early and resp is CANCELLED_RESPONSE or
+ * DEADLINE_EXCEEDED_RESPONSE. Requests you create yourself to split up
+ * a request should carry its tag, so that they stop along with it.
  */
 void execute_work(const Request_msg& req, Response_msg& resp);
 
+enum {
+  THREAD_CLASS_CPU,     // runs compute jobs
+  THREAD_CLASS_DISK,    // runs mostviewed jobs
+  THREAD_CLASS_SENDER   // the harness' response sender
+};
+
+/**
+ * @brief Places the calling thread, the index-th of its class
+ *
+ * Call this at the start of every worker thread. With --pin_threads,
+ * the thread is pinned according to the machine's NUMA layout and its
+ * memory (e.g. a highmem buffer) comes from its own node; otherwise
+ * this does nothing.
+ */
+void worker_place_thread(int thread_class, int index);
+
 
 /**
  ******************************************************************
@@ -0,0 +1,116 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef __TOOLS_FRAME_POOL_H__
+#define __TOOLS_FRAME_POOL_H__
+
+#include <boost/intrusive_ptr.hpp>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <new>
+
+// A Frame is a refcounted byte buffer holding one message as it came off
+// (or is about to go onto) the wire. Frames of up to FRAME_SLAB_SIZE
+// bytes are carved from a process-wide slab free list and recycled when
+// the last reference goes away, so the steady-state message path does
+// not touch the heap. Larger frames are allocated and freed directly.
+//
+// Holders share a frame through frame_ptr; the contents must not be
+// modified once a second reference exists.
+
+class FramePool;
+
+class Frame {
+public:
+  char* data() { return reinterpret_cast<char*>(this + 1); }
+  const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+  int capacity() const { return cap; }
+
+private:
+  friend class FramePool;
+  friend void intrusive_ptr_add_ref(Frame* frame);
+  friend void intrusive_ptr_release(Frame* frame);
+
+  explicit Frame(int arg_cap) : refcount(0), cap(arg_cap), next(NULL) {}
+
+  int refcount;
+  int cap;
+  Frame* next;  // free list link while the frame sits in the pool
+};
+
+typedef boost::intrusive_ptr<Frame> frame_ptr;
+
+class FramePool {
+public:
+  static const int FRAME_SLAB_SIZE = 512;
+  static const int MAX_CACHED_FRAMES = 4096;
+
+  static FramePool& instance() {
+    static FramePool pool;
+    return pool;
+  }
+
+  Frame* alloc(int size) {
+    if (size <= FRAME_SLAB_SIZE) {
+      pthread_mutex_lock(&lock);
+      Frame* frame = free_list;
+      if (frame != NULL) {
+        free_list = frame->next;
+        num_cached--;
+      }
+      pthread_mutex_unlock(&lock);
+      if (frame != NULL) {
+        frame->next = NULL;
+        return frame;
+      }
+      size = FRAME_SLAB_SIZE;
+    }
+
+    void* mem = malloc(sizeof(Frame) + size);
+    if (mem == NULL) throw std::bad_alloc();
+    return new (mem) Frame(size);
+  }
+
+  void release(Frame* frame) {
+    if (frame->cap == FRAME_SLAB_SIZE) {
+      pthread_mutex_lock(&lock);
+      if (num_cached < MAX_CACHED_FRAMES) {
+        frame->next = free_list;
+        free_list = frame;
+        num_cached++;
+        frame = NULL;
+      }
+      pthread_mutex_unlock(&lock);
+    }
+    if (frame != NULL) {
+      frame->~Frame();
+      free(frame);
+    }
+  }
+
+private:
+  FramePool() : free_list(NULL), num_cached(0) {
+    pthread_mutex_init(&lock, NULL);
+  }
+
+  pthread_mutex_t lock;
+  Frame* free_list;
+  int num_cached;
+};
+
+inline void intrusive_ptr_add_ref(Frame* frame) {
+  __sync_fetch_and_add(&frame->refcount, 1);
+}
+
+inline void intrusive_ptr_release(Frame* frame) {
+  if (__sync_sub_and_fetch(&frame->refcount, 1) == 0) {
+    FramePool::instance().release(frame);
+  }
+}
+
+// Returns a frame with room for at least 'size' bytes.
+inline frame_ptr alloc_frame(int size) {
+  return frame_ptr(FramePool::instance().alloc(size));
+}
+
+#endif  // __TOOLS_FRAME_POOL_H__
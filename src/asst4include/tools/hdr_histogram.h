@@ -0,0 +1,151 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef __TOOLS_HDR_HISTOGRAM_H__
+#define __TOOLS_HDR_HISTOGRAM_H__
+
+#include <stdint.h>
+#include <string.h>
+
+// A latency histogram in the style of HdrHistogram: values below
+// 2^SUB_BUCKET_BITS are counted exactly, and above that every power of
+// two is split into 2^(SUB_BUCKET_BITS - 1) equal buckets, so any
+// reported value is within 1% of a recorded one across the whole range.
+// Values are usually microseconds; anything past MAX_VALUE is counted
+// as MAX_VALUE.
+//
+// record() is a handful of relaxed atomic adds, so any number of
+// threads may record into one histogram without locks. Readers see a
+// consistent enough picture for monitoring, but should merge per-thread
+// histograms with add() when they need exact totals.
+
+class HdrHistogram {
+public:
+  enum {
+    SUB_BUCKET_BITS = 8,
+    SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+    HALF_SUB_BUCKETS = SUB_BUCKETS / 2,
+    MAX_VALUE_BITS = 36,  // about 19 hours of microseconds
+    NUM_BUCKETS = SUB_BUCKETS +
+      (MAX_VALUE_BITS - SUB_BUCKET_BITS) * HALF_SUB_BUCKETS
+  };
+
+  static const uint64_t MAX_VALUE = (1ULL << MAX_VALUE_BITS) - 1;
+
+  HdrHistogram() {
+    reset();
+  }
+
+  void record(uint64_t value) {
+    if (value > MAX_VALUE)
+      value = MAX_VALUE;
+    __atomic_fetch_add(&counts[bucket_of(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sum, value, __ATOMIC_RELAXED);
+
+    uint64_t seen = __atomic_load_n(&largest, __ATOMIC_RELAXED);
+    while (value > seen &&
+           !__atomic_compare_exchange_n(&largest, &seen, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+  }
+
+  // Adds everything recorded in 'other' to this histogram.
+  void add(const HdrHistogram& other) {
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+      uint64_t n = __atomic_load_n(&other.counts[i], __ATOMIC_RELAXED);
+      if (n > 0)
+        __atomic_fetch_add(&counts[i], n, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&total, other.count(), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sum, __atomic_load_n(&other.sum, __ATOMIC_RELAXED),
+                       __ATOMIC_RELAXED);
+    uint64_t other_max = other.max();
+    if (other_max > max())
+      __atomic_store_n(&largest, other_max, __ATOMIC_RELAXED);
+  }
+
+  // Not safe against concurrent record().
+  void reset() {
+    memset(counts, 0, sizeof(counts));
+    total = 0;
+    sum = 0;
+    largest = 0;
+  }
+
+  uint64_t count() const {
+    return __atomic_load_n(&total, __ATOMIC_RELAXED);
+  }
+
+  uint64_t max() const {
+    return __atomic_load_n(&largest, __ATOMIC_RELAXED);
+  }
+
+  double mean() const {
+    uint64_t n = count();
+    return n == 0 ? 0 : (double)__atomic_load_n(&sum, __ATOMIC_RELAXED) / n;
+  }
+
+  // The value at or below which 'percent' of the recorded values fall,
+  // rounded up to the top of its bucket (but never past max()); 0 for
+  // an empty histogram.
+  uint64_t percentile(double percent) const {
+    uint64_t n = count();
+    if (n == 0)
+      return 0;
+
+    uint64_t rank = (uint64_t)(percent / 100.0 * n + 0.5);
+    if (rank < 1)
+      rank = 1;
+    if (rank > n)
+      rank = n;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+      seen += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+      if (seen >= rank) {
+        uint64_t top = bucket_top(i);
+        return top < max() ? top : max();
+      }
+    }
+    return max();
+  }
+
+  // Raw buckets, for writing the histogram out: bucket i counts the
+  // values in [bucket_bottom(i), bucket_top(i)].
+  uint64_t bucket_count(int i) const {
+    return __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+  }
+
+  static uint64_t bucket_bottom(int i) {
+    if (i < SUB_BUCKETS)
+      return i;
+    int k = i - SUB_BUCKETS;
+    int shift = k / HALF_SUB_BUCKETS + 1;
+    return (uint64_t)(HALF_SUB_BUCKETS + k % HALF_SUB_BUCKETS) << shift;
+  }
+
+  static uint64_t bucket_top(int i) {
+    if (i < SUB_BUCKETS)
+      return i;
+    int shift = (i - SUB_BUCKETS) / HALF_SUB_BUCKETS + 1;
+    return bucket_bottom(i) + (1ULL << shift) - 1;
+  }
+
+  static int bucket_of(uint64_t value) {
+    if (value < SUB_BUCKETS)
+      return (int)value;
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - (SUB_BUCKET_BITS - 1);
+    int mantissa = (int)(value >> shift);  // in [HALF_SUB_BUCKETS, SUB_BUCKETS)
+    return SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS +
+      (mantissa - HALF_SUB_BUCKETS);
+  }
+
+private:
+  uint64_t counts[NUM_BUCKETS];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t largest;
+};
+
+#endif  // __TOOLS_HDR_HISTOGRAM_H__
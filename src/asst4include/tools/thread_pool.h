@@ -0,0 +1,357 @@
+// Copyright 2013 15418 Course Staff.
+
+#ifndef __TOOLS_THREAD_POOL_H__
+#define __TOOLS_THREAD_POOL_H__
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+
+#include <deque>
+#include <vector>
+
+#include "tools/work_queue.h"
+
+// A fixed set of threads that balance tasks among themselves by
+// stealing.
+//
+// Every pool thread owns a deque. Tasks it spawns go on the back, and it
+// takes its own work from the back too, so a task's children run on the
+// thread that spawned them while their data is still in cache. A thread
+// that runs dry steals from the front of the others' deques, which is
+// where the oldest and usually largest pieces of work sit. Tasks
+// submitted from outside the pool go through a shared injection queue.
+//
+// Tasks here are whole requests or large slices of one, so each deque
+// is a plain locked std::deque; the lock is never held while a task
+// runs and is almost never contended.
+//
+// A TaskGroup lets a task fork sub-tasks and wait for them. The waiting
+// thread keeps running tasks (its own children first) instead of
+// blocking, so nested waits cannot starve the pool.
+//
+// Tasks submitted from outside come in two lanes. Every thread looks at
+// the high lane before anything else, so a short job never queues
+// behind long ones that have not started yet. The pool can also set
+// aside threads that run only high-lane work (plus their own
+// children), so that a short job finds a free core even when every
+// other thread is in the middle of a long one.
+
+class ThreadPool;
+
+class TaskGroup {
+public:
+  TaskGroup() : pending(0) {}
+
+private:
+  friend class ThreadPool;
+  int pending;
+};
+
+class ThreadPool {
+public:
+  typedef void (*task_fn_t)(void* arg);
+
+  enum {
+    LANE_HIGH,
+    LANE_NORMAL,
+    NUM_LANES
+  };
+
+  // Each pool thread calls thread_init(index, init_arg), if given,
+  // before it runs any task.
+  typedef void (*thread_init_fn_t)(int index, void* arg);
+
+  // The first 'reserved_threads' threads are kept for the high lane.
+  // With 'steal_when_idle' they also take normal work when there is no
+  // high work, at the risk of being busy when a short job arrives. At
+  // least one thread stays unreserved.
+  ThreadPool(int num_threads, thread_init_fn_t arg_thread_init = NULL,
+             void* arg_init_arg = NULL, int reserved_threads = 0,
+             bool steal_when_idle = false)
+    : num_reserved(clamp_reserved(reserved_threads,
+                                  num_threads < 1 ? 1 : num_threads)),
+      reserved_steal(steal_when_idle),
+      thread_init(arg_thread_init), init_arg(arg_init_arg),
+      stopping(false), deques(num_threads < 1 ? 1 : num_threads) {
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+      queued[lane] = 0;
+    }
+    sleepers[0] = sleepers[1] = 0;
+    pthread_mutex_init(&park_lock, NULL);
+    pthread_cond_init(&park_cond[0], NULL);
+    pthread_cond_init(&park_cond[1], NULL);
+
+    // Every deque exists before any thread can try to steal from it.
+    for (size_t i = 0; i < deques.size(); i++) {
+      deques[i] = new LocalDeque;
+    }
+    threads.resize(deques.size());
+    for (size_t i = 0; i < deques.size(); i++) {
+      ThreadStart* start = new ThreadStart;
+      start->pool = this;
+      start->index = i;
+      pthread_create(&threads[i], NULL, thread_main, start);
+    }
+  }
+
+  // Lets the threads finish every task already queued, then joins
+  // them. Must not be called from a pool thread, and nothing may be
+  // submitted once it has begun.
+  ~ThreadPool() {
+    pthread_mutex_lock(&park_lock);
+    stopping = true;
+    pthread_cond_broadcast(&park_cond[GROUP_GENERAL]);
+    pthread_cond_broadcast(&park_cond[GROUP_RESERVED]);
+    pthread_mutex_unlock(&park_lock);
+
+    for (size_t i = 0; i < threads.size(); i++) {
+      pthread_join(threads[i], NULL);
+    }
+    for (size_t i = 0; i < deques.size(); i++) {
+      pthread_mutex_destroy(&deques[i]->lock);
+      delete deques[i];
+    }
+    pthread_cond_destroy(&park_cond[0]);
+    pthread_cond_destroy(&park_cond[1]);
+    pthread_mutex_destroy(&park_lock);
+  }
+
+  int num_threads() const {
+    return threads.size();
+  }
+
+  // Queues fn(arg) in 'lane'. From a pool thread normal work goes on its
+  // own deque.
+  void submit(task_fn_t fn, void* arg, int lane = LANE_NORMAL) {
+    push(make_task(fn, arg, NULL), lane);
+  }
+
+  // Queues fn(arg) as part of 'group'; see wait().
+  void spawn(TaskGroup* group, task_fn_t fn, void* arg) {
+    __atomic_fetch_add(&group->pending, 1, __ATOMIC_SEQ_CST);
+    push(make_task(fn, arg, group), LANE_NORMAL);
+  }
+
+  // Returns once every task spawned in 'group' has finished, running
+  // queued tasks in the meantime.
+  void wait(TaskGroup* group) {
+    int index = current_pool() == this ? current_index() : -1;
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+      Task task;
+      if (find_task(index, &task)) {
+        run(task);
+      } else {
+        sched_yield();
+      }
+    }
+  }
+
+private:
+  struct Task {
+    task_fn_t fn;
+    void* arg;
+    TaskGroup* group;
+  };
+
+  struct LocalDeque {
+    LocalDeque() { pthread_mutex_init(&lock, NULL); }
+
+    pthread_mutex_t lock;
+    std::deque<Task> tasks;
+  };
+
+  struct ThreadStart {
+    ThreadPool* pool;
+    int index;
+  };
+
+  // Not copyable.
+  ThreadPool(const ThreadPool&);
+  ThreadPool& operator=(const ThreadPool&);
+
+  // Which pool, and which deque in it, belongs to the calling thread.
+  static ThreadPool*& current_pool() {
+    static __thread ThreadPool* pool = NULL;
+    return pool;
+  }
+
+  static int& current_index() {
+    static __thread int index = -1;
+    return index;
+  }
+
+  static Task make_task(task_fn_t fn, void* arg, TaskGroup* group) {
+    Task task;
+    task.fn = fn;
+    task.arg = arg;
+    task.group = group;
+    return task;
+  }
+
+  static int clamp_reserved(int reserved, int n) {
+    return reserved < 0 ? 0 : (reserved < n ? reserved : n - 1);
+  }
+
+  // Threads fall into two groups, each parked on its own condvar.
+  enum {
+    GROUP_GENERAL,
+    GROUP_RESERVED
+  };
+
+  bool is_reserved(int index) const {
+    return index >= 0 && index < num_reserved;
+  }
+
+  // Whether a thread of 'group' may run work from 'lane'.
+  bool group_takes(int group, int lane) const {
+    return group == GROUP_GENERAL || lane == LANE_HIGH || reserved_steal;
+  }
+
+  void push(const Task& task, int lane) {
+    if (current_pool() == this && lane == LANE_NORMAL) {
+      LocalDeque* own = deques[current_index()];
+      pthread_mutex_lock(&own->lock);
+      own->tasks.push_back(task);
+      pthread_mutex_unlock(&own->lock);
+    } else {
+      injected[lane].put_work(task);
+    }
+
+    // Wake one thread that can run it, preferring a reserved one for
+    // high work so the general threads stay free for normal work.
+    __atomic_fetch_add(&queued[lane], 1, __ATOMIC_SEQ_CST);
+    int first = lane == LANE_HIGH ? GROUP_RESERVED : GROUP_GENERAL;
+    for (int i = 0; i < 2; i++) {
+      int group = first ^ i;
+      if (group_takes(group, lane) &&
+          __atomic_load_n(&sleepers[group], __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&park_lock);
+        pthread_cond_signal(&park_cond[group]);
+        pthread_mutex_unlock(&park_lock);
+        break;
+      }
+    }
+  }
+
+  bool pop_back(LocalDeque* d, Task* task) {
+    bool found = false;
+    pthread_mutex_lock(&d->lock);
+    if (!d->tasks.empty()) {
+      *task = d->tasks.back();
+      d->tasks.pop_back();
+      found = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+  }
+
+  bool pop_front(LocalDeque* d, Task* task) {
+    bool found = false;
+    pthread_mutex_lock(&d->lock);
+    if (!d->tasks.empty()) {
+      *task = d->tasks.front();
+      d->tasks.pop_front();
+      found = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+  }
+
+  // High lane first, then our own deque, then the normal lane, then
+  // steal, starting just past ourselves so thieves spread out over the
+  // victims. Reserved threads stop after their own deque unless they
+  // may steal.
+  bool find_task(int index, Task* task) {
+    if (injected[LANE_HIGH].try_get_work(task)) {
+      __atomic_fetch_sub(&queued[LANE_HIGH], 1, __ATOMIC_SEQ_CST);
+      return true;
+    }
+
+    bool found = index >= 0 && pop_back(deques[index], task);
+    if (!found && (!is_reserved(index) || reserved_steal)) {
+      found = injected[LANE_NORMAL].try_get_work(task);
+
+      int n = deques.size();
+      for (int i = 1; !found && i <= n; i++) {
+        int victim = (index + i) % n;
+        if (victim != index)
+          found = pop_front(deques[victim], task);
+      }
+    }
+
+    if (found)
+      __atomic_fetch_sub(&queued[LANE_NORMAL], 1, __ATOMIC_SEQ_CST);
+    return found;
+  }
+
+  // Whether there is anything a thread of 'group' could run.
+  bool work_for(int group) {
+    return __atomic_load_n(&queued[LANE_HIGH], __ATOMIC_SEQ_CST) > 0 ||
+      (group_takes(group, LANE_NORMAL) &&
+       __atomic_load_n(&queued[LANE_NORMAL], __ATOMIC_SEQ_CST) > 0);
+  }
+
+  void run(const Task& task) {
+    task.fn(task.arg);
+    if (task.group != NULL)
+      __atomic_fetch_sub(&task.group->pending, 1, __ATOMIC_RELEASE);
+  }
+
+  static void* thread_main(void* arg) {
+    ThreadStart* start = reinterpret_cast<ThreadStart*>(arg);
+    ThreadPool* pool = start->pool;
+    int index = start->index;
+    delete start;
+
+    current_pool() = pool;
+    current_index() = index;
+    if (pool->thread_init != NULL)
+      pool->thread_init(index, pool->init_arg);
+    pool->work_loop(index);
+    return NULL;
+  }
+
+  void work_loop(int index) {
+    for (;;) {
+      Task task;
+      if (find_task(index, &task)) {
+        run(task);
+        continue;
+      }
+
+      // Nothing we can run: sleep until a push. 'queued' goes up before
+      // a pusher looks for sleepers, so one of us always sees the other.
+      // A reserved thread's own children count as normal work, but it
+      // always finds those before getting here. Once the pool is
+      // stopping, running dry means we are done.
+      int group = is_reserved(index) ? GROUP_RESERVED : GROUP_GENERAL;
+      pthread_mutex_lock(&park_lock);
+      if (stopping) {
+        pthread_mutex_unlock(&park_lock);
+        return;
+      }
+      __atomic_fetch_add(&sleepers[group], 1, __ATOMIC_SEQ_CST);
+      if (!work_for(group))
+        pthread_cond_wait(&park_cond[group], &park_lock);
+      __atomic_fetch_sub(&sleepers[group], 1, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&park_lock);
+    }
+  }
+
+  WorkQueue<Task> injected[NUM_LANES];
+  int queued[NUM_LANES];  // tasks sitting in any queue; deques count as normal
+  int sleepers[2];        // threads of each group parked in work_loop()
+  pthread_mutex_t park_lock;
+  pthread_cond_t park_cond[2];
+  const int num_reserved;
+  const bool reserved_steal;
+  thread_init_fn_t thread_init;
+  void* init_arg;
+  bool stopping;          // set under park_lock by the destructor
+
+  std::vector<LocalDeque*> deques;
+  std::vector<pthread_t> threads;
+};
+
+#endif  // __TOOLS_THREAD_POOL_H__
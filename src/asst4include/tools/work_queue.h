@@ -3,43 +3,300 @@
 #ifndef __WORKER_WORK_QUEUE_H__
 #define __WORKER_WORK_QUEUE_H__
 
+#include <limits.h>
+#include <linux/futex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
-#include <vector>
+#include <new>
 
+#if __cplusplus >= 201103L
+#include <utility>
+#define WORK_QUEUE_MOVE(x) std::move(x)
+#else
+#define WORK_QUEUE_MOVE(x) (x)
+#endif
+
+// A bounded multi-producer, multi-consumer queue.
+//
+// Items live in a power-of-two ring of slots, each stamped with a
+// sequence number that says whose turn it is (Vyukov's scheme), so
+// producers and consumers only contend on the one counter they advance
+// and never on a lock. Items are constructed in place and moved out, so
+// T need not be default constructible, and may be move-only in C++11.
+//
+// get_work() parks on a futex once the queue has been empty for a short
+// spin, and put_work() does the same while it is full. Wakeups go
+// through an event counter per side, so a push or pop costs one extra
+// atomic load when nobody is asleep.
+
+#define WORK_QUEUE_DEFAULT_CAPACITY 4096
+#define WORK_QUEUE_SPINS 64
+#define WORK_QUEUE_CACHE_LINE 64
 
 template <class T>
 class WorkQueue {
 private:
-  std::vector<T> storage;
-  pthread_mutex_t queue_lock;
-  pthread_cond_t queue_cond;
+  struct Slot {
+    size_t seq;
+    char storage[sizeof(T)] __attribute__((aligned(__alignof__(T))));
 
-public:
+    T* item() { return reinterpret_cast<T*>(storage); }
+  };
+
+  // Threads sleeping on one side of the queue, and a counter bumped by
+  // the other side whenever it might have made progress possible.
+  struct EventCount {
+    int epoch;
+    int sleepers;
+    char pad[WORK_QUEUE_CACHE_LINE - 2 * sizeof(int)];
+  };
 
-  WorkQueue() {
-    pthread_cond_init(&queue_cond, NULL);
-    pthread_mutex_init(&queue_lock, NULL);
+  Slot* slots;
+  size_t mask;
+  char pad0[WORK_QUEUE_CACHE_LINE];
+  size_t enqueue_pos;
+  char pad1[WORK_QUEUE_CACHE_LINE - sizeof(size_t)];
+  size_t dequeue_pos;
+  char pad2[WORK_QUEUE_CACHE_LINE - sizeof(size_t)];
+  EventCount not_empty;
+  EventCount not_full;
+
+  // Not copyable.
+  WorkQueue(const WorkQueue&);
+  WorkQueue& operator=(const WorkQueue&);
+
+  static void futex_wait(int* addr, int value) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
   }
 
-  T get_work() {
-    pthread_mutex_lock(&queue_lock);
-    while (storage.size() == 0) {
-      pthread_cond_wait(&queue_cond, &queue_lock);
+  static void futex_wake(int* addr, int count) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+  }
+
+  // Called after making progress; wakes up to 'count' waiters, if any.
+  static void notify(EventCount* ec, int count) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ec->sleepers, __ATOMIC_RELAXED) > 0) {
+      __atomic_fetch_add(&ec->epoch, 1, __ATOMIC_SEQ_CST);
+      futex_wake(&ec->epoch, count);
+    }
+  }
+
+  typedef bool (WorkQueue::*Predicate)();
+
+  // Sleeps until 'ec' is notified, unless ready() turns true first.
+  void wait(EventCount* ec, Predicate ready) {
+    int epoch = __atomic_load_n(&ec->epoch, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&ec->sleepers, 1, __ATOMIC_SEQ_CST);
+    if (!(this->*ready)()) {
+      futex_wait(&ec->epoch, epoch);
+    }
+    __atomic_fetch_sub(&ec->sleepers, 1, __ATOMIC_SEQ_CST);
+  }
+
+  bool has_items() {
+    size_t pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+    Slot* slot = &slots[pos & mask];
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == pos + 1;
+  }
+
+  bool has_room() {
+    size_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    Slot* slot = &slots[pos & mask];
+    return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == pos;
+  }
+
+  // Claims the next free slot, or returns NULL if the queue is full.
+  // The caller constructs the item and then calls publish().
+  Slot* claim_enqueue(size_t* pos_out) {
+    size_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+      Slot* slot = &slots[pos & mask];
+      size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+          *pos_out = pos;
+          return slot;
+        }
+      } else if (diff < 0) {
+        return NULL;
+      } else {
+        pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+  void publish(Slot* slot, size_t pos) {
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+  }
+
+  // Claims the oldest item, or returns NULL if the queue is empty. The
+  // caller moves the item out and then calls release().
+  Slot* claim_dequeue(size_t* pos_out) {
+    size_t pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+      Slot* slot = &slots[pos & mask];
+      size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+      intptr_t diff = static_cast<intptr_t>(seq) -
+        static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (__atomic_compare_exchange_n(&dequeue_pos, &pos, pos + 1, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+          *pos_out = pos;
+          return slot;
+        }
+      } else if (diff < 0) {
+        return NULL;
+      } else {
+        pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+      }
     }
+  }
 
-    T item = storage.front();
-    //storage.pop_front();
-    storage.erase(storage.begin());
+  void release(Slot* slot, size_t pos) {
+    slot->item()->~T();
+    __atomic_store_n(&slot->seq, pos + mask + 1, __ATOMIC_RELEASE);
+  }
 
-    pthread_mutex_unlock(&queue_lock);
+  Slot* claim_enqueue_blocking(size_t* pos) {
+    Slot* slot;
+    for (int spins = 0; (slot = claim_enqueue(pos)) == NULL; spins++) {
+      if (spins >= WORK_QUEUE_SPINS)
+        wait(&not_full, &WorkQueue::has_room);
+    }
+    return slot;
+  }
+
+  Slot* claim_dequeue_blocking(size_t* pos) {
+    Slot* slot;
+    for (int spins = 0; (slot = claim_dequeue(pos)) == NULL; spins++) {
+      if (spins >= WORK_QUEUE_SPINS)
+        wait(&not_empty, &WorkQueue::has_items);
+    }
+    return slot;
+  }
+
+public:
+
+  // 'capacity' is rounded up to a power of two.
+  explicit WorkQueue(size_t capacity = WORK_QUEUE_DEFAULT_CAPACITY)
+    : enqueue_pos(0), dequeue_pos(0) {
+    size_t size = 2;
+    while (size < capacity)
+      size <<= 1;
+    mask = size - 1;
+    slots = new Slot[size];
+    for (size_t i = 0; i < size; i++)
+      slots[i].seq = i;
+    not_empty.epoch = not_empty.sleepers = 0;
+    not_full.epoch = not_full.sleepers = 0;
+  }
+
+  ~WorkQueue() {
+    size_t pos;
+    Slot* slot;
+    while ((slot = claim_dequeue(&pos)) != NULL)
+      release(slot, pos);
+    delete[] slots;
+  }
+
+  T get_work() {
+    size_t pos;
+    Slot* slot = claim_dequeue_blocking(&pos);
+    T item(WORK_QUEUE_MOVE(*slot->item()));
+    release(slot, pos);
+    notify(&not_full, 1);
     return item;
   }
 
+  // Blocks until at least one item is available, then takes up to 'max'
+  // of them. Returns the number taken.
+  size_t get_work(T* items, size_t max) {
+    size_t n = 0;
+    size_t pos;
+    Slot* slot = claim_dequeue_blocking(&pos);
+    do {
+      items[n++] = WORK_QUEUE_MOVE(*slot->item());
+      release(slot, pos);
+    } while (n < max && (slot = claim_dequeue(&pos)) != NULL);
+    notify(&not_full, n > INT_MAX ? INT_MAX : static_cast<int>(n));
+    return n;
+  }
+
+  bool try_get_work(T* item) {
+    size_t pos;
+    Slot* slot = claim_dequeue(&pos);
+    if (slot == NULL)
+      return false;
+    *item = WORK_QUEUE_MOVE(*slot->item());
+    release(slot, pos);
+    notify(&not_full, 1);
+    return true;
+  }
+
+  // Blocks while the queue is full.
   void put_work(const T& item) {
-    pthread_mutex_lock(&queue_lock);
-    storage.push_back(item);
-    pthread_mutex_unlock(&queue_lock);
-    pthread_cond_signal(&queue_cond);
+    size_t pos;
+    Slot* slot = claim_enqueue_blocking(&pos);
+    new (slot->item()) T(item);
+    publish(slot, pos);
+    notify(&not_empty, 1);
+  }
+
+#if __cplusplus >= 201103L
+  void put_work(T&& item) {
+    size_t pos;
+    Slot* slot = claim_enqueue_blocking(&pos);
+    new (slot->item()) T(std::move(item));
+    publish(slot, pos);
+    notify(&not_empty, 1);
+  }
+#endif
+
+  // Moves [first, last) into the queue in order, blocking whenever it
+  // is full, and wakes consumers once for the whole batch where
+  // possible. The items are left moved-from.
+  template <class Iterator>
+  void put_work(Iterator first, Iterator last) {
+    size_t n = 0;
+    for (; first != last; ++first, n++) {
+      size_t pos;
+      Slot* slot = claim_enqueue(&pos);
+      if (slot == NULL) {
+        notify(&not_empty, INT_MAX);
+        slot = claim_enqueue_blocking(&pos);
+      }
+      new (slot->item()) T(WORK_QUEUE_MOVE(*first));
+      publish(slot, pos);
+    }
+    notify(&not_empty, n > INT_MAX ? INT_MAX : static_cast<int>(n));
+  }
+
+  bool try_put_work(const T& item) {
+    size_t pos;
+    Slot* slot = claim_enqueue(&pos);
+    if (slot == NULL)
+      return false;
+    new (slot->item()) T(item);
+    publish(slot, pos);
+    notify(&not_empty, 1);
+    return true;
+  }
+
+  // A snapshot only; other threads may change it at any time.
+  size_t size() const {
+    size_t tail = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+    return tail > head ? tail - head : 0;
+  }
+
+  size_t capacity() const {
+    return mask + 1;
   }
 };
 
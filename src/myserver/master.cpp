@@ -1,20 +1,112 @@
 // Copyright 2013 Harry Q. Bovik (hbovik)
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 #include <map>
+#include <set>
+#include <string>
 #include <vector>
 
 #include "server/messages.h"
 #include "server/master.h"
+#include "server/stats.h"
 #include "tools/work_queue.h"
 #include <iostream>
 
+DEFINE_int32(standby_workers, 1,
+             "Booted workers to keep idle, out of dispatch, for instant "
+             "scale-up");
+
+// Pool shape; the capacity planner writes these, with --max_workers, as
+// a --flagfile for the master and the simulator.
+DEFINE_int32(worker_limit, 2,
+             "Most workers to run at once, within the harness's --max_workers");
+DEFINE_int32(cpu_slots, 0,
+             "Compute requests each worker runs at once (0 for one per "
+             "compute thread it reports)");
+DEFINE_int32(disk_slots, 1, "mostviewed requests each worker runs at once");
+
+// A client request. It may be running as two copies (see
+// hedge_stragglers), each under its own tag in requestsMap.
 typedef struct request_Info {
     Request_msg* req;
     Client_handle client;
+    Worker_handle worker;  // NULL until dispatched
+    double dispatched;
+    bool short_job;        // sent outside the slots, in the high lane
+    bool cancelled;
+    bool answered;
+    int copies;            // copies still out at workers
+    int hedge_tag;         // 0 if not hedged
+    Worker_handle hedge_worker;
+    double hedge_dispatched;
 } reqInfo;
 
+// A request still unanswered after this fraction of recent requests of
+// its command have finished gets a duplicate on another worker.
+#define HEDGE_PERCENTILE 0.95
+#define LATENCY_WINDOW 256      // recent samples kept per command
+#define LATENCY_MIN_SAMPLES 20  // don't hedge before we know the command
+
+// Requests this quick skip the compute slots and go to the workers'
+// high-priority lane, so they never wait behind long jobs: minicompute,
+// countprimes up to SHORT_COUNTPRIMES_N (about a third of a 418wisdom),
+// and any other command whose median is under SHORT_JOB_SECONDS.
+#define SHORT_JOB_SECONDS 0.05
+#define SHORT_COUNTPRIMES_N 500000
+
+// Worker scaling (see scale_workers). Arrival rate and its trend are
+// smoothed once a tick, and the rate expected a boot's time from now
+// decides how many workers should be active.
+#define RATE_SMOOTHING 0.5
+#define TREND_SMOOTHING 0.3
+#define BOOT_AHEAD_SECONDS 7.0    // worker boot plus engine init
+#define TARGET_UTILIZATION 0.8    // of the active compute slots
+#define BACKLOG_DRAIN_SECONDS 7.0 // to clear queued work with new slots
+#define SERVICE_SMOOTHING 0.2     // per report, of worker service times
+#define SCALE_DOWN_TICKS 10       // ticks of surplus before shrinking
+#define STATS_PRINT_TICKS 5
+
+// Recent dispatch-to-response times (seconds) of one command.
+struct Latency_window {
+  std::vector<double> samples;
+  int next;
+  int since_update;
+  double p50;
+  double p95;
+
+  Latency_window() : next(0), since_update(0), p50(0), p95(0) {}
+
+  void add(double seconds) {
+    if (samples.size() < LATENCY_WINDOW) {
+      samples.push_back(seconds);
+    } else {
+      samples[next] = seconds;
+      next = (next + 1) % LATENCY_WINDOW;
+    }
+    // percentiles are refreshed every few samples, not per response
+    if (++since_update >= 16 || samples.size() == LATENCY_MIN_SAMPLES) {
+      since_update = 0;
+      p50 = percentile(0.5);
+      p95 = percentile(HEDGE_PERCENTILE);
+    }
+  }
+
+  double percentile(double p) const {
+    std::vector<double> sorted(samples);
+    size_t k = static_cast<size_t>(p * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+  }
+
+  // 0 until there are enough samples to go by
+  double hedge_threshold() const {
+    return samples.size() >= LATENCY_MIN_SAMPLES ? p95 : 0;
+  }
+};
+
 static struct Master_state {
 
   // The mstate struct collects all the master node state into one
@@ -33,22 +125,356 @@ static struct Master_state {
   std::vector<Request_msg>disk_waiting_queue;
   std:: map<int, reqInfo*> requestsMap;
 
+  // latest load report from each worker, and how many entries each
+  // worker has in cpu_workers_queue (one per compute thread we use)
+  std::map<Worker_handle, Worker_stats> worker_stats;
+  std::map<Worker_handle, int> cpu_slots;
+
+  std::map<std::string, Latency_window> latencies;
+
+  // short jobs outstanding at each worker
+  std::map<Worker_handle, int> short_outstanding;
+  int num_hedged;
+  int num_hedges_won;
+
+  // Workers receiving requests, and booted ones held back from
+  // dispatch until promote_standby(); the standbys' slots are in no
+  // queue.
+  std::set<Worker_handle> active_workers;
+  std::vector<Worker_handle> standby_workers;
+  int num_booting;
+
+  int arrivals;            // since the last tick
+  double last_tick;
+  double arrival_rate;     // requests/s, smoothed
+  double arrival_trend;    // change in arrival_rate per second
+  double work_per_request; // seconds a request holds a slot, smoothed
+  double service_time;     // seconds in execute_work, as workers report
+  int surplus_ticks;
+  int ticks;
+
   Worker_handle my_worker;
   Client_handle waiting_client;
 
 } mstate;
 
+// Sends a request to a worker, remembering where it went so that it can
+// be cancelled later.
+static void dispatch_request(Worker_handle worker, const Request_msg& req) {
+  reqInfo* info = mstate.requestsMap[req.get_tag()];
+  info->worker = worker;
+  info->dispatched = master_current_time();
+  info->copies = 1;
+  send_request_to_worker(worker, req);
+}
+
+// Gives a compute slot of 'worker' to the oldest waiting request, or
+// back to the pool of free slots.
+static void add_cpu_slot(Worker_handle worker) {
+  mstate.num_idle_workers++;
+  if (mstate.cpu_waiting_queue.size() == 0) {
+    mstate.cpu_workers_queue.push_back( worker );
+  } else {
+    mstate.num_pending_client_requests++;
+    Request_msg thisRequest = mstate.cpu_waiting_queue.front();
+    dispatch_request( worker, thisRequest);
+    mstate.cpu_waiting_queue.erase(mstate.cpu_waiting_queue.begin());
+    mstate.num_idle_workers--;
+  }
+}
+
+static void add_disk_slot(Worker_handle worker) {
+  if (mstate.disk_waiting_queue.size() == 0) {
+    mstate.disk_workers_queue.push_back( worker );
+  } else {
+    Request_msg thisRequest = mstate.disk_waiting_queue.front();
+    dispatch_request( worker, thisRequest);
+    mstate.disk_waiting_queue.erase(mstate.disk_waiting_queue.begin());
+  }
+}
+
+static void boot_worker() {
+  int tag = random();
+  Request_msg req(tag);
+  char name[32];
+  sprintf(name, "my worker %d", tag);
+  req.set_arg("name", name);
+  request_new_worker_node(req);
+  mstate.num_booting++;
+}
+
+// Puts a standby worker's slots into dispatch. Takes one round trip to
+// the first request instead of a boot.
+static void promote_standby() {
+  Worker_handle worker = mstate.standby_workers.back();
+  mstate.standby_workers.pop_back();
+  mstate.active_workers.insert(worker);
+  mstate.short_outstanding[worker] = 0;
+  for (int i = 0; i < mstate.cpu_slots[worker]; i++)
+    add_cpu_slot(worker);
+  for (int i = 0; i < FLAGS_disk_slots; i++)
+    add_disk_slot(worker);
+}
+
+// Takes an active worker out of dispatch if nothing is running on it.
+static bool demote_if_idle(Worker_handle worker) {
+  int free_cpu = std::count(mstate.cpu_workers_queue.begin(),
+                            mstate.cpu_workers_queue.end(), worker);
+  int free_disk = std::count(mstate.disk_workers_queue.begin(),
+                             mstate.disk_workers_queue.end(), worker);
+  if (free_cpu < mstate.cpu_slots[worker] || free_disk < FLAGS_disk_slots ||
+      mstate.short_outstanding[worker] > 0)
+    return false;
+
+  mstate.cpu_workers_queue.erase(
+    std::remove(mstate.cpu_workers_queue.begin(),
+                mstate.cpu_workers_queue.end(), worker),
+    mstate.cpu_workers_queue.end());
+  mstate.disk_workers_queue.erase(
+    std::remove(mstate.disk_workers_queue.begin(),
+                mstate.disk_workers_queue.end(), worker),
+    mstate.disk_workers_queue.end());
+  mstate.num_idle_workers -= free_cpu;
+  mstate.short_outstanding.erase(worker);
+  mstate.active_workers.erase(worker);
+  mstate.standby_workers.push_back(worker);
+  return true;
+}
+
+// Compute slots a new worker starts with. Without --cpu_slots, assume
+// two compute threads until the worker reports how many it has.
+static int initial_cpu_slots() {
+  return FLAGS_cpu_slots > 0 ? FLAGS_cpu_slots : 2;
+}
+
+// Compute requests received by active workers that no thread has
+// started yet, as of their last reports.
+static int worker_backlog() {
+  int backlog = 0;
+  std::set<Worker_handle>::iterator it;
+  for (it = mstate.active_workers.begin(); it != mstate.active_workers.end(); it++) {
+    std::map<Worker_handle, Worker_stats>::iterator stats =
+      mstate.worker_stats.find(*it);
+    if (stats == mstate.worker_stats.end())
+      continue;
+    backlog += std::max(0, stats->second.queue_depth[WORK_CLASS_CPU] -
+                        stats->second.busy_threads[WORK_CLASS_CPU]);
+  }
+  return backlog;
+}
+
+// Sizes the worker pool ahead of demand. By Little's law the compute
+// slots busy at the predicted arrival rate are rate * service time,
+// taken from the workers' reports once there are any, and from
+// dispatch-to-response times before. Requests already queued, at the
+// master or inside workers, need more slots on top to be cleared within
+// BACKLOG_DRAIN_SECONDS. Enough workers to keep all that under
+// TARGET_UTILIZATION should be active, with --standby_workers more
+// booted behind them. Standbys are promoted at once and new ones booted
+// to replace them; surplus workers drain back to standby, and surplus
+// standbys are shut down.
+static void scale_workers() {
+  double now = master_current_time();
+  double elapsed = now - mstate.last_tick;
+  if (elapsed <= 0)
+    return;
+  mstate.last_tick = now;
+
+  double rate = mstate.arrivals / elapsed;
+  mstate.arrivals = 0;
+  double previous = mstate.arrival_rate;
+  mstate.arrival_rate = RATE_SMOOTHING * rate +
+    (1 - RATE_SMOOTHING) * (previous + mstate.arrival_trend * elapsed);
+  mstate.arrival_trend = TREND_SMOOTHING *
+    (mstate.arrival_rate - previous) / elapsed +
+    (1 - TREND_SMOOTHING) * mstate.arrival_trend;
+  if (mstate.arrival_rate < 0)
+    mstate.arrival_rate = 0;
+
+  double predicted = mstate.arrival_rate +
+    mstate.arrival_trend * BOOT_AHEAD_SECONDS;
+  if (predicted < mstate.arrival_rate)
+    predicted = mstate.arrival_rate;  // shrink on what we see, not guess
+
+  int slots = 0;
+  std::set<Worker_handle>::iterator it;
+  for (it = mstate.active_workers.begin(); it != mstate.active_workers.end(); it++)
+    slots += mstate.cpu_slots[*it];
+  double slots_per_worker = mstate.active_workers.empty() ?
+    initial_cpu_slots() :
+    static_cast<double>(slots) / mstate.active_workers.size();
+
+  double service = mstate.service_time > 0 ?
+    mstate.service_time : mstate.work_per_request;
+  int backlog = mstate.cpu_waiting_queue.size() + worker_backlog();
+  double busy_slots = (predicted * service +
+                       backlog * service / BACKLOG_DRAIN_SECONDS) /
+    TARGET_UTILIZATION;
+  int needed = static_cast<int>(busy_slots / slots_per_worker + 0.999);
+  if (needed < 1)
+    needed = 1;
+  if (needed > mstate.max_num_workers)
+    needed = mstate.max_num_workers;
+
+  int active = mstate.active_workers.size();
+  while (active < needed && !mstate.standby_workers.empty()) {
+    promote_standby();
+    active++;
+  }
+
+  if (active > needed) {
+    mstate.surplus_ticks++;
+  } else {
+    mstate.surplus_ticks = 0;
+  }
+  if (mstate.surplus_ticks >= SCALE_DOWN_TICKS) {
+    for (it = mstate.active_workers.begin(); it != mstate.active_workers.end(); it++) {
+      if (demote_if_idle(*it)) {
+        active--;
+        break;
+      }
+    }
+    mstate.surplus_ticks = 0;
+  }
+
+  int wanted = std::min(needed + FLAGS_standby_workers, mstate.max_num_workers);
+  int have = active + mstate.standby_workers.size() + mstate.num_booting;
+  for (; have < wanted; have++)
+    boot_worker();
+
+  while (have > wanted && !mstate.standby_workers.empty()) {
+    Worker_handle worker = mstate.standby_workers.back();
+    mstate.standby_workers.pop_back();
+    mstate.worker_stats.erase(worker);
+    mstate.cpu_slots.erase(worker);
+    kill_worker_node(worker);
+    have--;
+  }
+}
+
+static bool is_disk_request(const Request_msg& req) {
+  return req.get_arg("cmd").compare("mostviewed") == 0;
+}
+
+static bool is_short_job(const Request_msg& req) {
+  std::string cmd = req.get_arg("cmd");
+  if (cmd == "minicompute")
+    return true;
+  if (cmd == "countprimes")
+    return atoi(req.get_arg("n").c_str()) <= SHORT_COUNTPRIMES_N;
+  if (cmd == "mostviewed" || cmd == "compareprimes")
+    return false;
+  const Latency_window& window = mstate.latencies[cmd];
+  return window.samples.size() >= LATENCY_MIN_SAMPLES &&
+    window.p50 < SHORT_JOB_SECONDS;
+}
+
+// The worker with the fewest short jobs out plus requests waiting for
+// a thread, as it last reported them; a short job jumps the latter but
+// still waits while they hold every thread.
+static Worker_handle least_busy_short_worker() {
+  std::map<Worker_handle, int>::iterator it = mstate.short_outstanding.begin();
+  Worker_handle best = it->first;
+  int best_load = -1;
+  for (; it != mstate.short_outstanding.end(); it++) {
+    int load = it->second;
+    std::map<Worker_handle, Worker_stats>::iterator stats =
+      mstate.worker_stats.find(it->first);
+    if (stats != mstate.worker_stats.end()) {
+      load += std::max(0, stats->second.queue_depth[WORK_CLASS_CPU] -
+                       stats->second.busy_threads[WORK_CLASS_CPU]);
+    }
+    if (best_load < 0 || load < best_load) {
+      best = it->first;
+      best_load = load;
+    }
+  }
+  return best;
+}
+
+// Duplicates requests that have run longer than HEDGE_PERCENTILE of
+// their command onto an idle slot of a different worker; whichever copy
+// answers first with a result wins and the other is cancelled. Only spare capacity is
+// used: nothing is hedged while requests of the same kind are queued.
+static void hedge_stragglers() {
+  double now = master_current_time();
+
+  std::map<int, reqInfo*>::iterator it;
+  for (it = mstate.requestsMap.begin(); it != mstate.requestsMap.end(); it++) {
+    reqInfo* info = it->second;
+    if (info->worker == NULL || info->short_job || info->hedge_tag != 0 ||
+        info->answered || info->cancelled)
+      continue;
+
+    double threshold =
+      mstate.latencies[info->req->get_arg("cmd")].hedge_threshold();
+    if (threshold == 0 || now - info->dispatched <= threshold)
+      continue;
+
+    bool disk = is_disk_request(*info->req);
+    std::vector<Worker_handle>& slots =
+      disk ? mstate.disk_workers_queue : mstate.cpu_workers_queue;
+    if (!(disk ? mstate.disk_waiting_queue : mstate.cpu_waiting_queue).empty())
+      continue;
+
+    std::vector<Worker_handle>::iterator slot = slots.begin();
+    while (slot != slots.end() && *slot == info->worker)
+      slot++;
+    if (slot == slots.end())
+      continue;
+
+    int tag;
+    do {
+      tag = random();
+    } while (tag == 0 || mstate.requestsMap.count(tag));
+
+    // hedge_of tells the harness to count queue wait from the first copy
+    char primary[16];
+    sprintf(primary, "%d", info->req->get_tag());
+    Request_msg hedge_req(tag, *info->req);
+    hedge_req.set_arg("hedge_of", primary);
+    info->hedge_tag = tag;
+    info->hedge_worker = *slot;
+    info->hedge_dispatched = now;
+    info->copies++;
+    mstate.requestsMap[tag] = info;
+    mstate.num_hedged++;
+
+    slots.erase(slot);
+    if (!disk) {
+      mstate.num_idle_workers--;
+      mstate.num_pending_client_requests++;
+    }
+    send_request_to_worker(info->hedge_worker, hedge_req);
+  }
+}
+
 void master_node_init(int max_workers, int& tick_period) {
 
-  // set up tick handler to fire every 5 seconds. (feel free to
-  // configure as you please)
-  tick_period = 5;
+  // set up tick handler to fire every second, which is how often the
+  // worker pool is resized. (feel free to configure as you please)
+  tick_period = 1;
   //printf("The maximum number of workers %d\n", max_workers);
   // HOW TO SET THIS NUMBER ?
-  //mstate.max_num_workers = max_workers;
-  mstate.max_num_workers = 2; 
+  // From --worker_limit, which the capacity planner works out
+  // from a trace, but never more than the harness allows: the
+  // single-process server has room for one.
+  CHECK_GT(FLAGS_worker_limit, 0) << "--worker_limit must be positive";
+  CHECK_GT(FLAGS_disk_slots, 0) << "--disk_slots must be positive";
+  mstate.max_num_workers = std::min(FLAGS_worker_limit, max_workers);
 
   mstate.num_pending_client_requests = 0;
+  mstate.num_hedged = 0;
+  mstate.num_hedges_won = 0;
+  mstate.num_booting = 0;
+  mstate.arrivals = 0;
+  mstate.last_tick = master_current_time();
+  mstate.arrival_rate = 0;
+  mstate.arrival_trend = 0;
+  mstate.work_per_request = 0;
+  mstate.service_time = 0;
+  mstate.surplus_ticks = 0;
+  mstate.ticks = 0;
   // used for debug
   mstate.num_idle_workers = 0;
   
@@ -57,29 +483,26 @@ void master_node_init(int max_workers, int& tick_period) {
   // when 'master_node_init' returnes
   mstate.server_ready = false;
 
-  // here we temporally request 3 worker nodes
-  for(int i = 0 ; i < 1; i++) {
-      int tag = random();
-      Request_msg req(tag);
-      char name[20];
-      sprintf(name, "my worker %d", i);
-      req.set_arg("name", name);
-      request_new_worker_node(req);
+  // one worker to serve with, plus the standbys behind it
+  int initial = std::min(1 + FLAGS_standby_workers, mstate.max_num_workers);
+  for(int i = 0 ; i < initial; i++) {
+      boot_worker();
   }
 }
 
 void handle_new_worker_online(Worker_handle worker_handle, int tag) {
 
   // 'tag' allows you to identify which worker request this response
-  // corresponds to.  Since the starter code only sends off one new
-  // worker request, we don't use it here.
+  // corresponds to.  All workers are alike here, so we don't use it.
 
-  mstate.cpu_workers_queue.push_back( worker_handle );
-  mstate.cpu_workers_queue.push_back( worker_handle );
-  mstate.disk_workers_queue.push_back( worker_handle );
-  
-  mstate.num_idle_workers += 2;
-  //printf("Number of idle workers: %d\n",mstate.num_idle_workers);
+  mstate.cpu_slots[worker_handle] = initial_cpu_slots();
+  mstate.num_booting--;
+
+  // new workers start as standbys; the first one goes straight to work
+  mstate.standby_workers.push_back( worker_handle );
+  if (mstate.active_workers.empty()) {
+    promote_standby();
+  }
   // Now that a worker is booted, let the system know the server is
   // ready to begin handling client requests.  The test harness will
   // now start its timers and start hitting your server with requests.
@@ -90,40 +513,59 @@ void handle_new_worker_online(Worker_handle worker_handle, int tag) {
 }
 
 void handle_worker_response(Worker_handle worker_handle, const Response_msg& resp) {
-  bool isDiskRequestDone = false;
   std::map<int,reqInfo*>::iterator it = mstate.requestsMap.find(resp.get_tag());
-  // send the message back to the client
-  send_client_response((it->second)->client, resp);
-  //cout<<(*((it->second)->req)).get_arg("cmd")<<"###\n";
-  if( (*((it->second)->req)).get_arg("cmd").compare("mostviewed") == 0) {
-        isDiskRequestDone = true;
-  }
-  delete( (it->second)->req );
-  delete( it->second );
-  mstate.requestsMap.erase(it);
-  if( isDiskRequestDone ) {
-    if(mstate.disk_waiting_queue.size() == 0) {
-        mstate.disk_workers_queue.push_back( worker_handle);
-    }else {
-        Request_msg thisRequest = mstate.disk_waiting_queue.front();
-        send_request_to_worker( worker_handle, thisRequest);
-        mstate.disk_waiting_queue.erase(mstate.disk_waiting_queue.begin());
+  reqInfo* info = it->second;
+  bool is_hedge = (resp.get_tag() == info->hedge_tag);
+  bool isDiskRequestDone = is_disk_request(*info->req);
+  bool isShortJob = info->short_job;
+
+  // a stopped copy says nothing about how long the command takes
+  const std::string& result = resp.get_response();
+  bool stopped = (result == CANCELLED_RESPONSE ||
+                  result == DEADLINE_EXCEEDED_RESPONSE);
+  if (!stopped) {
+    double dispatched = is_hedge ? info->hedge_dispatched : info->dispatched;
+    double seconds = master_current_time() - dispatched;
+    mstate.latencies[info->req->get_arg("cmd")].add(seconds);
+    if (mstate.work_per_request == 0)
+      mstate.work_per_request = seconds;
+    else
+      mstate.work_per_request += 0.1 * (seconds - mstate.work_per_request);
+  }
+
+  // send the first real answer back to the client, and stop the other
+  // copy; a stopped copy is only passed on once no other is left
+  if (!info->answered && (!stopped || info->copies == 1)) {
+    send_client_response(info->client, resp);
+    info->answered = true;
+    if (is_hedge)
+      mstate.num_hedges_won++;
+    if (info->copies > 1) {
+      if (is_hedge)
+        cancel_worker_request(info->worker, info->req->get_tag());
+      else
+        cancel_worker_request(info->hedge_worker, info->hedge_tag);
     }
+  }
+  mstate.requestsMap.erase(it);
+  if (--info->copies == 0) {
+    delete info->req;
+    delete info;
+  }
+
+  // short jobs never held a slot
+  if( isShortJob ) {
+    mstate.short_outstanding[worker_handle]--;
     return;
   }
 
-  mstate.num_pending_client_requests--;
-  // here means we do not have more work right now
-  if( mstate.cpu_waiting_queue.size() == 0) {
-    mstate.cpu_workers_queue.push_back( worker_handle );
-    mstate.num_idle_workers++;
-    //printf("Number of idle workers: %d\n",mstate.num_idle_workers);
-  }else {
-    mstate.num_pending_client_requests++;
-    Request_msg thisRequest = mstate.cpu_waiting_queue.front();
-    send_request_to_worker( worker_handle, thisRequest);
-    mstate.cpu_waiting_queue.erase(mstate.cpu_waiting_queue.begin());
+  if( isDiskRequestDone ) {
+    add_disk_slot( worker_handle );
+  } else {
+    mstate.num_pending_client_requests--;
+    add_cpu_slot( worker_handle );
   }
+  hedge_stragglers();
 }
 
 void handle_client_request(Client_handle client_handle, const Request_msg& client_req) {
@@ -138,48 +580,183 @@ void handle_client_request(Client_handle client_handle, const Request_msg& clien
     return;
   }
 
+  mstate.arrivals++;
+
   int tag = random();
+  bool short_job = is_short_job(client_req) &&
+    !mstate.short_outstanding.empty();
   Request_msg worker_req(tag, client_req);
+  if (short_job)
+    worker_req.set_arg("priority", "0");
   // store the waiting client into the map
   reqInfo* thisInfo = new reqInfo();
   thisInfo->req = new Request_msg(worker_req);
 
   thisInfo->client = client_handle;
+  thisInfo->worker = NULL;
+  thisInfo->dispatched = 0;
+  thisInfo->short_job = short_job;
+  thisInfo->cancelled = false;
+  thisInfo->answered = false;
+  thisInfo->copies = 0;
+  thisInfo->hedge_tag = 0;
+  thisInfo->hedge_worker = NULL;
+  thisInfo->hedge_dispatched = 0;
   //mstate.requestsMap[tag] = client_handle;
   mstate.requestsMap[tag] = thisInfo;
   
   // we have disk intensive work
   if(worker_req.get_arg("cmd").compare("mostviewed") == 0) {
+      // rather than queue, bring in a standby if there is one
+      if( mstate.disk_workers_queue.empty() && !mstate.standby_workers.empty() ) {
+        promote_standby();
+      }
       // we have worker for it
       if( mstate.disk_workers_queue.size() != 0) {
         Worker_handle thisWorker = mstate.disk_workers_queue.front();
-        send_request_to_worker(thisWorker, worker_req);
+        dispatch_request(thisWorker, worker_req);
         mstate.disk_workers_queue.erase(mstate.disk_workers_queue.begin());
       }else {
         mstate.disk_waiting_queue.push_back(worker_req);
       }
     return;
   }
+  // short jobs go straight to a worker, which runs them ahead of
+  // anything long it has queued
+  if( short_job ) {
+    Worker_handle thisWorker = least_busy_short_worker();
+    mstate.short_outstanding[thisWorker]++;
+    dispatch_request(thisWorker, worker_req);
+    return;
+  }
+  if( mstate.cpu_workers_queue.empty() && !mstate.standby_workers.empty() ) {
+    promote_standby();
+  }
   // we run out of workers for cpu intensive work
-  if( mstate.num_pending_client_requests == mstate.max_num_workers) {
+  if( mstate.cpu_workers_queue.empty() ) {
     mstate.cpu_waiting_queue.push_back(worker_req);
     return;
   }
   mstate.num_pending_client_requests++;
   Worker_handle thisWorker = mstate.cpu_workers_queue.front();
   mstate.num_idle_workers--;
-  send_request_to_worker(thisWorker, worker_req);
+  dispatch_request(thisWorker, worker_req);
   mstate.cpu_workers_queue.erase(mstate.cpu_workers_queue.begin());
 }
 
 
+void handle_worker_stats(Worker_handle worker_handle, const Worker_stats& stats) {
+
+  mstate.worker_stats[worker_handle] = stats;
+
+  // fold the compute commands this worker finished since its last
+  // report into the service time that scale_workers() plans with
+  int completed = 0;
+  double service_ms = 0;
+  int disk_cmd = stats_cmd_index("mostviewed");
+  for (int cmd = 0; cmd < MAX_STATS_CMDS; cmd++) {
+    if (cmd == disk_cmd || stats.completed[cmd] == 0)
+      continue;
+    completed += stats.completed[cmd];
+    service_ms += stats.completed[cmd] * stats.service_ms[cmd];
+  }
+  if (completed > 0) {
+    double seconds = service_ms / completed / 1000.0;
+    if (mstate.service_time == 0)
+      mstate.service_time = seconds;
+    else
+      mstate.service_time += SERVICE_SMOOTHING * (seconds - mstate.service_time);
+  }
+
+  // a worker with more compute threads than we assumed can take more
+  // requests at once; hand its extra slots out right away (a standby's
+  // wait for its promotion). A fixed --cpu_slots stays as it is.
+  bool active = mstate.active_workers.count(worker_handle) > 0;
+  int& slots = mstate.cpu_slots[worker_handle];
+  while (FLAGS_cpu_slots == 0 && slots < stats.cpu_threads) {
+    slots++;
+    if (active)
+      add_cpu_slot( worker_handle );
+  }
+
+  // stats arrive every second or so, which is when we look for
+  // stragglers even if nothing else is happening
+  hedge_stragglers();
+}
+
+// Drops the requests in 'queue' whose client has gone away. They were
+// never dispatched, so only requestsMap refers to their reqInfo; the
+// harness still needs an answer to release the client handle.
+static void drop_abandoned(std::vector<Request_msg>& queue) {
+  std::vector<Request_msg>::iterator req = queue.begin();
+  while (req != queue.end()) {
+    std::map<int, reqInfo*>::iterator it =
+      mstate.requestsMap.find(req->get_tag());
+    reqInfo* info = it->second;
+    if (client_is_connected(info->client)) {
+      req++;
+      continue;
+    }
+    Response_msg resp(req->get_tag());
+    resp.set_response(CANCELLED_RESPONSE);
+    send_client_response(info->client, resp);
+    mstate.requestsMap.erase(it);
+    delete info->req;
+    delete info;
+    req = queue.erase(req);
+  }
+}
+
 void handle_tick() {
 
   // TODO: you may wish to take action here.  This method is called at
   // fixed time intervals, according to how you set 'tick_period' in
   // 'master_node_init'.
-  // p
+  scale_workers();
+
+  // stop work whose client has gone away; the worker still answers, so
+  // its slot comes back through handle_worker_response as usual
+  std::map<int, reqInfo*>::iterator req_it;
+  for (req_it = mstate.requestsMap.begin(); req_it != mstate.requestsMap.end(); req_it++) {
+    reqInfo* info = req_it->second;
+    if (info->worker != NULL && !info->cancelled && !info->answered &&
+        !client_is_connected(info->client)) {
+      cancel_worker_request(info->worker, info->req->get_tag());
+      if (info->hedge_tag != 0)
+        cancel_worker_request(info->hedge_worker, info->hedge_tag);
+      info->cancelled = true;
+    }
+  }
+  drop_abandoned(mstate.cpu_waiting_queue);
+  drop_abandoned(mstate.disk_waiting_queue);
+  hedge_stragglers();
+
+  if (++mstate.ticks % STATS_PRINT_TICKS != 0)
+    return;
+
   printf("NUM OF WAITING REQUESTS: %lu\n", mstate.cpu_waiting_queue.size());
   printf("NUM OF PENDING REQUESTS: %d\n", mstate.num_pending_client_requests);
+  printf("WORKERS: %lu active, %lu standby, %d booting; "
+         "%.1f req/s (trend %+.2f/s), service %.0f ms\n",
+         mstate.active_workers.size(), mstate.standby_workers.size(),
+         mstate.num_booting, mstate.arrival_rate, mstate.arrival_trend,
+         1000 * mstate.service_time);
+
+  std::map<std::string, Latency_window>::iterator lat;
+  for (lat = mstate.latencies.begin(); lat != mstate.latencies.end(); lat++) {
+    printf("LATENCY %s: p50 %.0f ms p95 %.0f ms\n", lat->first.c_str(),
+           1000 * lat->second.p50, 1000 * lat->second.p95);
+  }
+  printf("HEDGED: %d (%d won)\n", mstate.num_hedged, mstate.num_hedges_won);
+
+  std::map<Worker_handle, Worker_stats>::iterator it;
+  for (it = mstate.worker_stats.begin(); it != mstate.worker_stats.end(); it++) {
+    const Worker_stats& stats = it->second;
+    printf("WORKER %p: queued %d/%d busy %d/%d rss %lld KB load %.2f\n",
+           it->first,
+           stats.queue_depth[WORK_CLASS_CPU], stats.queue_depth[WORK_CLASS_DISK],
+           stats.busy_threads[WORK_CLASS_CPU], stats.busy_threads[WORK_CLASS_DISK],
+           stats.rss_kb, stats.load_average);
+  }
 }
 
@@ -4,17 +4,28 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <sstream>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include "server/messages.h"
 #include "server/worker.h"
-#include "tools/work_queue.h"
+#include "tools/thread_pool.h"
 
 //#include <cstring>
 //#include <iostream>
 
+DECLARE_int32(cpu_threads);
+DECLARE_int32(io_threads);
+DECLARE_int32(short_job_threads);
+DECLARE_bool(short_job_threads_steal);
+
+// Compute work goes to a work-stealing pool with one thread per core
+// (or --cpu_threads); mostviewed requests, which mostly wait on the
+// disk, get their own pool so they never hold up a core. Requests the
+// master marks priority=0 take the pool's high lane, which may have
+// --short_job_threads cores to itself.
 struct Worker_state {
-    WorkQueue<Request_msg> cpu_work_queue;    
-    WorkQueue<Request_msg> disk_work_queue;    
+    ThreadPool* cpu_pool;
+    ThreadPool* disk_pool;
 } wstate;
 
 
@@ -26,26 +37,54 @@ static void create_computeprimes_req(Request_msg& req, int n) {
   req.set_arg("n", oss.str());
 }
 
+struct countprimes_task {
+  int tag;  // the compareprimes request's, so a cancel stops every piece
+  int n;
+  std::string response;
+};
+
+static void execute_countprimes_task(void* arg) {
+    countprimes_task* task = (countprimes_task*) arg;
+    Request_msg dummy_req(task->tag);
+    Response_msg dummy_resp(task->tag);
+    create_computeprimes_req(dummy_req, task->n);
+    execute_work(dummy_req, dummy_resp);
+    task->response = dummy_resp.get_response();
+}
+
+static bool stopped_early(const std::string& response) {
+    return response == CANCELLED_RESPONSE ||
+      response == DEADLINE_EXCEEDED_RESPONSE;
+}
+
 // Implements logic required by primerange command for the request
 // 'req' using multiple calls to execute_work.  This function fills in
-// the appropriate response.
+// the appropriate response.  The four counts are independent, so they
+// are forked as sub-tasks that idle threads can steal.
 static void execute_compareprimes(const Request_msg& req, Response_msg& resp) {
 
-    int params[4];
-    int counts[4];
+    countprimes_task tasks[4];
+    TaskGroup group;
 
     // grab the four arguments defining the two ranges
-    params[0] = atoi(req.get_arg("n1").c_str());
-    params[1] = atoi(req.get_arg("n2").c_str());
-    params[2] = atoi(req.get_arg("n3").c_str());
-    params[3] = atoi(req.get_arg("n4").c_str());
+    tasks[0].n = atoi(req.get_arg("n1").c_str());
+    tasks[1].n = atoi(req.get_arg("n2").c_str());
+    tasks[2].n = atoi(req.get_arg("n3").c_str());
+    tasks[3].n = atoi(req.get_arg("n4").c_str());
+
+    for (int i=0; i<4; i++) {
+      tasks[i].tag = req.get_tag();
+      wstate.cpu_pool->spawn(&group, execute_countprimes_task, &tasks[i]);
+    }
+    wstate.cpu_pool->wait(&group);
 
+    int counts[4];
     for (int i=0; i<4; i++) {
-      Request_msg dummy_req(0);
-      Response_msg dummy_resp(0);
-      create_computeprimes_req(dummy_req, params[i]);
-      execute_work(dummy_req, dummy_resp);
-      counts[i] = atoi(dummy_resp.get_response().c_str());
+      if (stopped_early(tasks[i].response)) {
+        resp.set_response(tasks[i].response);
+        return;
+      }
+      counts[i] = atoi(tasks[i].response.c_str());
     }
 
     if (counts[1]-counts[0] > counts[3]-counts[2])
@@ -54,46 +93,15 @@ static void execute_compareprimes(const Request_msg& req, Response_msg& resp) {
       resp.set_response("There are more primes in second range.");
 }
 
-void* executeWork_cpu(void* arg) {
-    while(1) {
-      Request_msg req = wstate.cpu_work_queue.get_work();
-      Response_msg resp(req.get_tag());
-      if (req.get_arg("cmd").compare("compareprimes") == 0) {
-        execute_compareprimes(req, resp);
-      } else {
-        execute_work(req, resp);
-      }
-      worker_send_response(resp);
-    }
-    return NULL;
-}
-void* executeWork_disk(void* arg) {
-    while(1) {
-      Request_msg req = wstate.disk_work_queue.get_work();
-      Response_msg resp(req.get_tag());
-      // There is only one type here
-      execute_work(req, resp);
-      worker_send_response(resp);
-    }
-    return NULL;
+// Runs at the start of each pool thread; 'arg' holds its THREAD_CLASS_*.
+static void place_pool_thread(int index, void* arg) {
+  worker_place_thread(*(int*) arg, index);
 }
 
-void worker_node_init(const Request_msg& params) {
-
-  // This is your chance to initialize your worker.  For example, you
-  // might initialize a few data structures, or maybe even spawn a few
-  // pthreads here.  Remember, when running on Amazon servers, worker
-  // processes will run on an instance with a dual-core CPU.
-  printf("**** Initializing worker: %s ****\n", params.get_arg("name").c_str());
-  pthread_t thread_1;
-  pthread_t thread_2;
-  pthread_t thread_3;
-  pthread_create(&thread_1, NULL, executeWork_cpu, NULL);
-  pthread_create(&thread_2, NULL, executeWork_cpu, NULL);
-  pthread_create(&thread_3, NULL, executeWork_disk, NULL);
-}
+static int cpu_thread_class = THREAD_CLASS_CPU;
+static int disk_thread_class = THREAD_CLASS_DISK;
 
-void* executeWork(void* arg) {
+static void executeWork(void* arg) {
   Request_msg* req = (Request_msg*) arg;
   Response_msg resp((*req).get_tag());
   if ((*req).get_arg("cmd").compare("compareprimes") == 0) {
@@ -107,23 +115,32 @@ void* executeWork(void* arg) {
     // 'execute_work'
     execute_work(*req, resp);
   }
+  delete req;
   // send a response string to the master
-  free(arg);
   worker_send_response(resp);
-  return NULL;
+}
+
+void worker_node_init(const Request_msg& params) {
+
+  // This is your chance to initialize your worker.  For example, you
+  // might initialize a few data structures, or maybe even spawn a few
+  // pthreads here.  The pools are sized from the --cpu_threads and
+  // --io_threads flags, which default to one compute thread per core.
+  printf("**** Initializing worker: %s ****\n", params.get_arg("name").c_str());
+  wstate.cpu_pool = new ThreadPool(FLAGS_cpu_threads, place_pool_thread,
+                                   &cpu_thread_class, FLAGS_short_job_threads,
+                                   FLAGS_short_job_threads_steal);
+  wstate.disk_pool = new ThreadPool(FLAGS_io_threads, place_pool_thread,
+                                    &disk_thread_class);
 }
 
 void worker_handle_request(const Request_msg& req) {
-   if(req.get_arg("cmd").compare("mostviewed") == 0) {
-        wstate.disk_work_queue.put_work(req);
-        return;
-   }
-    wstate.cpu_work_queue.put_work(req);
-/*pthread_t thread_id;
-  pthread_attr_t attr; // thread attribute
-  Request_msg* cpyReq = new Request_msg(req);
-  // set thread detachstate attribute to DETACHED 
-  pthread_attr_init(&attr);
-  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-  pthread_create(&thread_id, &attr, executeWork, cpyReq);*/
+  Request_msg* job = new Request_msg(req);
+  if(req.get_arg("cmd").compare("mostviewed") == 0) {
+    wstate.disk_pool->submit(executeWork, job);
+    return;
+  }
+  int lane = req.get_arg("priority") == "0" ?
+    ThreadPool::LANE_HIGH : ThreadPool::LANE_NORMAL;
+  wstate.cpu_pool->submit(executeWork, job, lane);
 }